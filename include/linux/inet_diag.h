@@ -97,9 +97,10 @@ enum {
 	INET_DIAG_INFO,
 	INET_DIAG_VEGASINFO,
 	INET_DIAG_CONG,
+	INET_DIAG_MPTCPINFO,
 };
 
-#define INET_DIAG_MAX INET_DIAG_CONG
+#define INET_DIAG_MAX INET_DIAG_MPTCPINFO
 
 
 /* INET_DIAG_MEM */
@@ -120,6 +121,20 @@ struct tcpvegas_info {
 	__u32	tcpv_minrtt;
 };
 
+/* INET_DIAG_MPTCPINFO */
+
+struct mptcp_diag_info {
+	__u32	mptcpi_token;		/* Local token of the connection */
+	__u8	mptcpi_path_index;
+	__u8	mptcpi_subflows;	/* Subflows of the connection */
+	__u8	mptcpi_fallback;	/* Fell back to infinite mapping */
+	__u8	mptcpi_pad;
+	__u32	mptcpi_srtt;		/* usec */
+	__u32	mptcpi_snd_cwnd;
+	__u64	mptcpi_bytes_sched;
+	__u64	mptcpi_bytes_reinjected;
+};
+
 #ifdef __KERNEL__
 struct sock;
 struct inet_hashinfo;
@@ -0,0 +1,98 @@
+/*
+ *	MPTCP implementation - Generic netlink path-manager interface
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _LINUX_MPTCP_H
+#define _LINUX_MPTCP_H
+
+#include <linux/types.h>
+
+#define MPTCP_GENL_NAME		"mptcp"
+#define MPTCP_GENL_VERSION	1
+
+#define MPTCP_GENL_MCAST_EVENT_NAME	"mptcp_events"
+
+/**
+ * enum mptcp_commands - supported mptcp commands and events
+ *
+ * @MPTCP_CMD_UNSPEC: unspecified command
+ *
+ * @MPTCP_CMD_SUB_CREATE: create a new subflow for the connection
+ *	%MPTCP_ATTR_TOKEN between the local address %MPTCP_ATTR_SADDR4/6 and
+ *	the remote address %MPTCP_ATTR_DADDR4/6 (both must be known by the
+ *	connection). %MPTCP_ATTR_BACKUP is optional. The reply carries the
+ *	%MPTCP_ATTR_PATH_INDEX of the new subflow.
+ * @MPTCP_CMD_SUB_DESTROY: reset the subflow %MPTCP_ATTR_PATH_INDEX of the
+ *	connection %MPTCP_ATTR_TOKEN
+ * @MPTCP_CMD_SUB_PRIORITY: set (%MPTCP_ATTR_BACKUP present) or clear the
+ *	backup-flag of the subflow %MPTCP_ATTR_PATH_INDEX of the connection
+ *	%MPTCP_ATTR_TOKEN and announce it with MP_PRIO
+ * @MPTCP_EVENT_CREATED: a connection has been created (it sends
+ *	%MPTCP_ATTR_TOKEN, %MPTCP_ATTR_FAMILY and the addresses and ports of
+ *	the initial subflow)
+ * @MPTCP_EVENT_ESTABLISHED: the initial subflow is fully established
+ *	(same attributes as %MPTCP_EVENT_CREATED, plus %MPTCP_ATTR_PATH_INDEX)
+ * @MPTCP_EVENT_CLOSED: a connection has been destroyed (it sends
+ *	%MPTCP_ATTR_TOKEN)
+ * @MPTCP_EVENT_ANNOUNCED: the peer announced a new address with ADD_ADDR
+ *	(it sends %MPTCP_ATTR_TOKEN, %MPTCP_ATTR_REM_ID, %MPTCP_ATTR_FAMILY,
+ *	%MPTCP_ATTR_DADDR4/6 and %MPTCP_ATTR_DPORT if one was given)
+ * @MPTCP_EVENT_REMOVED: the peer removed an address with REMOVE_ADDR (it
+ *	sends %MPTCP_ATTR_TOKEN and %MPTCP_ATTR_REM_ID)
+ */
+enum mptcp_commands {
+	MPTCP_CMD_UNSPEC,
+	MPTCP_CMD_SUB_CREATE,
+	MPTCP_CMD_SUB_DESTROY,
+	MPTCP_CMD_SUB_PRIORITY,
+	MPTCP_EVENT_CREATED,
+	MPTCP_EVENT_ESTABLISHED,
+	MPTCP_EVENT_CLOSED,
+	MPTCP_EVENT_ANNOUNCED,
+	MPTCP_EVENT_REMOVED,
+/* private: internal use only */
+	__MPTCP_CMD_AFTER_LAST
+};
+#define MPTCP_CMD_MAX (__MPTCP_CMD_AFTER_LAST - 1)
+
+/**
+ * enum mptcp_attrs - supported mptcp attributes
+ *
+ * @MPTCP_ATTR_UNSPEC: unspecified attribute
+ *
+ * @MPTCP_ATTR_TOKEN: local token of the connection (u32)
+ * @MPTCP_ATTR_FAMILY: address family of the addresses (u16, AF_INET/AF_INET6)
+ * @MPTCP_ATTR_SADDR4: local IPv4 address (be32)
+ * @MPTCP_ATTR_SADDR6: local IPv6 address (struct in6_addr)
+ * @MPTCP_ATTR_DADDR4: remote IPv4 address (be32)
+ * @MPTCP_ATTR_DADDR6: remote IPv6 address (struct in6_addr)
+ * @MPTCP_ATTR_SPORT: local port (be16)
+ * @MPTCP_ATTR_DPORT: remote port (be16)
+ * @MPTCP_ATTR_REM_ID: address-id announced by the peer (u8)
+ * @MPTCP_ATTR_PATH_INDEX: path-index identifying a subflow (u8)
+ * @MPTCP_ATTR_BACKUP: flag, the subflow is a backup-subflow
+ */
+enum mptcp_attrs {
+	MPTCP_ATTR_UNSPEC,
+	MPTCP_ATTR_TOKEN,
+	MPTCP_ATTR_FAMILY,
+	MPTCP_ATTR_SADDR4,
+	MPTCP_ATTR_SADDR6,
+	MPTCP_ATTR_DADDR4,
+	MPTCP_ATTR_DADDR6,
+	MPTCP_ATTR_SPORT,
+	MPTCP_ATTR_DPORT,
+	MPTCP_ATTR_REM_ID,
+	MPTCP_ATTR_PATH_INDEX,
+	MPTCP_ATTR_BACKUP,
+/* private: internal use only */
+	__MPTCP_ATTR_AFTER_LAST
+};
+#define MPTCP_ATTR_MAX (__MPTCP_ATTR_AFTER_LAST - 1)
+
+#endif /* _LINUX_MPTCP_H */
@@ -233,6 +233,20 @@ enum
 	LINUX_MIB_TCPTIMEWAITOVERFLOW,		/* TCPTimeWaitOverflow */
 	LINUX_MIB_TCPREQQFULLDOCOOKIES,		/* TCPReqQFullDoCookies */
 	LINUX_MIB_TCPREQQFULLDROP,		/* TCPReqQFullDrop */
+	LINUX_MIB_MPTCPFALLBACKSYNACK,		/* MPTCPFallbackSynAck */
+	LINUX_MIB_MPTCPINFINITEMAPRX,		/* MPTCPInfiniteMapRx */
+	LINUX_MIB_MPTCPINFINITEMAPTX,		/* MPTCPInfiniteMapTx */
+	LINUX_MIB_MPTCPCSUMFAIL,		/* MPTCPCsumFail */
+	LINUX_MIB_MPTCPJOINNOTOKEN,		/* MPTCPJoinNoTokenFound */
+	LINUX_MIB_MPTCPJOININFINITE,		/* MPTCPJoinInfiniteMap */
+	LINUX_MIB_MPTCPJOINSYNACKMAC,		/* MPTCPJoinSynAckHMacFailure */
+	LINUX_MIB_MPTCPJOINACKMAC,		/* MPTCPJoinAckHMacFailure */
+	LINUX_MIB_MPTCPOFOQUEUE,		/* MPTCPOFOQueue */
+	LINUX_MIB_MPTCPOFODROP,			/* MPTCPOFODrop */
+	LINUX_MIB_MPTCPREINJECTQUEUE,		/* MPTCPReinjectQueue */
+	LINUX_MIB_MPTCPREINJECTSENT,		/* MPTCPReinjectSent */
+	LINUX_MIB_MPTCPRBUFRETRANS,		/* MPTCPRbufRetrans */
+	LINUX_MIB_MPTCPRBUFPENAL,		/* MPTCPRbufPenal */
 	__LINUX_MIB_MAX
 };
 
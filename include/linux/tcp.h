@@ -106,6 +106,7 @@ enum {
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
 #define TCP_USER_TIMEOUT	18	/* How long for loss retry before timeout */
+#define MPTCP_SCHEDULER		43	/* MPTCP packet scheduler */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
@@ -274,7 +275,7 @@ struct tcp_out_options {
 	struct mptcp_loc4 *addr4;/* v4 addresses for MPTCP */
 	struct mptcp_loc6 *addr6;/* v6 addresses for MPTCP */
 
-	u16	remove_addrs;	/* list of address id */
+	u64	remove_addrs;	/* list of address id */
 	u8	addr_id;	/* address id */
 #endif /* CONFIG_MPTCP */
 };
@@ -349,6 +350,8 @@ static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
 	return (struct tcp_request_sock *)req;
 }
 
+#define MPTCP_SCHED_NAME_MAX	16
+
 struct tcp_sock {
 	/* inet_connection_sock has to be the first member of tcp_sock */
 	struct inet_connection_sock	inet_conn;
@@ -543,9 +546,11 @@ struct tcp_sock {
 		close_it:1;	/* Should this socket get closed by mptcp_data_ready? */
 	struct mptcp_tcp_sock *mptcp;
 #ifdef CONFIG_MPTCP
-	struct hlist_nulls_node tk_table;
+	/* One node per token-table, to stay hashed in both while resizing */
+	struct hlist_nulls_node tk_table[2];
 	u32		mptcp_loc_token;
 	u64		mptcp_loc_key;
+	char		mptcp_sched_name[MPTCP_SCHED_NAME_MAX];
 #endif /* CONFIG_MPTCP */
 };
 
@@ -34,6 +34,7 @@
 #include <linux/ipv6.h>
 #include <linux/list.h>
 #include <linux/net.h>
+#include <linux/rbtree.h>
 #include <linux/skbuff.h>
 #include <linux/socket.h>
 #include <linux/tcp.h>
@@ -72,8 +73,11 @@ struct mptcp_request_sock {
 	 * that tuple hashtable. At the moment, though, I extend the
 	 * request_sock.
 	 */
-	struct list_head		collide_tuple;
-	struct hlist_nulls_node		collide_tk;
+	struct hlist_nulls_node		collide_tuple;
+	u32				collide_hash; /* Bucket of collide_tuple */
+	struct hlist_nulls_node		collide_tk[2];
+	/* Of the mpcb, for the lockless lookup of collide_tuple */
+	struct sock			*meta_sk;
 	u32				mptcp_rem_nonce;
 	u32				mptcp_loc_token;
 	u64				mptcp_loc_key;
@@ -103,6 +107,11 @@ struct mptcp_tcp_sock {
 	u64	map_data_seq;
 	u32	map_subseq;
 	u16	map_data_len;
+	/* Running DSS-checksum of the current mapping, covering the subflow's
+	 * data up to map_csum_seq.
+	 */
+	__wsum	map_csum;
+	u32	map_csum_seq;
 	u16	slave_sk:1,
 		fully_established:1,
 		attached:1,
@@ -111,29 +120,42 @@ struct mptcp_tcp_sock {
 		include_mpc:1,
 		mapping_present:1,
 		map_data_fin:1,
+		map_csum_dss:1, /* DSS-option has been added to map_csum */
 		low_prio:1, /* use this socket as backup */
 		send_mp_prio:1, /* Trigger to send mp_prio on this socket */
-		pre_established:1; /* State between sending 3rd ACK and receiving
+		pre_established:1, /* State between sending 3rd ACK and receiving
 		 	 	    * the fourth ack of new subflows.
 		 	 	    */
+		cc_counted:1; /* Part of the mpcb's cc_agg */
 
 	/* isn: needed to translate abs to relative subflow seqnums */
 	u32	snt_isn;
 	u32	last_data_seq;
 	u8	path_index;
-	u8	add_addr4; /* bit-field of addrs not yet sent to our peer */
-	u8	add_addr6;
+	u32	add_addr4; /* bit-field of addrs not yet sent to our peer */
+	u32	add_addr6;
 	u8	rem_id;
 
 	u32	last_rbuf_opti;	/* Timestamp of last rbuf optimization */
 	unsigned int sent_pkts;
 
-	struct sk_buff  *shortcut_ofoqueue; /* Shortcut to the current modified
-					     * skb in the ofo-queue.
-					     */
+	/* Exported through INET_DIAG (see mptcp_diag_get_info) */
+	u64	bytes_sched;	  /* Data-level bytes sent on this subflow */
+	u64	bytes_reinjected; /* Part of it, that has been reinjected */
 
 	int	init_rcv_wnd;
 	u32	infinite_cutoff_seq;
+	u32	ecmp_retrans;	/* total_retrans at the last ECMP-check */
+	u8	ecmp_peer;	/* pi of the subflow we seem to share a path with */
+	u8	ecmp_hits;	/* ... during that many ECMP-checks in a row */
+	/* Last meta-skb of the write-queue the scheduler is done with on this
+	 * subflow. Cleared when the skb leaves the queue.
+	 */
+	struct sk_buff *sched_hint;
+	/* Snapshot of the congestion-state, see mptcp_cc_agg_update */
+	u32	cc_cwnd;
+	u32	cc_srtt;
+	u64	cc_rate;
 	struct delayed_work work;
 	u32	mptcp_loc_nonce;
 	struct tcp_sock *tp; /* Where is my daddy? */
@@ -150,18 +172,84 @@ struct multipath_options {
 		dss_csum:1,
 		join_ack:1,
 		is_mp_join:1;
-	u8	rem4_bits;
-	u8	rem6_bits;
+	u32	rem4_bits;
+	u32	rem6_bits;
 
 	u32	mptcp_rem_token;/* Remote token */
 	u64	mptcp_rem_key;	/* Remote key */
 
-	struct	mptcp_rem4 addr4[MPTCP_MAX_ADDR];
+	/* The remote addresses are only stored in the rx_opt of the mpcb.
+	 * The tables are allocated on demand (see mptcp_addr_table_grow),
+	 * addr4_size/addr6_size being the number of allocated entries.
+	 */
+	struct	mptcp_rem4 *addr4;
+	u8	addr4_size;
 #if IS_ENABLED(CONFIG_IPV6)
-	struct	mptcp_rem6 addr6[MPTCP_MAX_ADDR];
+	struct	mptcp_rem6 *addr6;
+	u8	addr6_size;
 #endif
 };
 
+struct mptcp_diag_info;
+
+#define MPTCP_SCHED_SIZE	16
+
+/* Track the copies of the segments that have been acked at the subflow-level
+ * (see acked_pi in struct tcp_skb_cb), so that they are not duplicated once
+ * more. Only the DATA_ACK stops reinjections and meta-retransmissions.
+ */
+#define MPTCP_SCHED_TRACK_ACKED	0x1
+/* The subflow returned by get_subflow stays the right choice for a run of
+ * new segments, until its congestion- or send-window is full. This saves the
+ * calls to the scheduler in mptcp_write_xmit.
+ */
+#define MPTCP_SCHED_BATCH	0x2
+
+struct mptcp_sched_ops {
+	struct list_head	list;
+
+	/* Select the subflow on which @skb should be sent. @skb may be NULL,
+	 * if we only want to know whether a subflow is available.
+	 */
+	struct sock *		(*get_subflow)(struct sock *meta_sk,
+					       struct sk_buff *skb);
+	/* Return the next segment to be sent and set *@reinject
+	 * (see __mptcp_next_segment).
+	 */
+	struct sk_buff *	(*next_segment)(struct sock *meta_sk,
+						int *reinject);
+	void			(*init)(struct sock *meta_sk);
+
+	u32			flags;
+	char			name[MPTCP_SCHED_NAME_MAX];
+	struct module		*owner;
+};
+
+/* Scaling of the rates in struct mptcp_cc_agg */
+#define MPTCP_CC_AGG_SCALE	24
+
+/* Congestion-state of all subflows, shared by the coupled congestion
+ * controls. Maintained incrementally by mptcp_cc_agg_update out of the
+ * per-subflow snapshots (cc_cwnd/cc_srtt in struct mptcp_tcp_sock) of
+ * the subflows that can send.
+ */
+struct mptcp_cc_agg {
+	u64	sum_rate;	/* Sum of (cwnd << MPTCP_CC_AGG_SCALE) / srtt */
+	u64	max_rate;	/* Largest rate, scaled like sum_rate */
+	u8	max_rate_pi;
+	u32	max_cwnd;
+	u8	cnt_max;	/* Number of subflows at max_cwnd */
+	u8	best_pi;	/* Subflow with the largest cwnd / srtt^2 */
+	u32	best_cwnd;
+	u32	best_srtt;
+	/* Bumped when a subflow comes or goes, when the srtt of a subflow
+	 * changes, or when max_cwnd/cnt_max or the best path change. Thus,
+	 * it only stays put if the cwnd of a subflow changes without any
+	 * effect on these.
+	 */
+	u32	gen;
+};
+
 struct mptcp_cb {
 	struct sock *meta_sk;
 
@@ -185,22 +273,25 @@ struct mptcp_cb {
 	/* socket count in this connection */
 	u8 cnt_subflows;
 	u8 cnt_established;
-	u8 last_pi_selected;
 
-	u32 noneligible;	/* Path mask of temporarily non
+	u64 noneligible;	/* Path mask of temporarily non
 				 * eligible subflows by the scheduler
 				 */
 
-	struct sk_buff_head reinject_queue;
+	struct mptcp_cc_agg cc_agg;
+
+	struct rb_root reinject_tree;	/* Segments to be reinjected */
+	struct rb_root ofo_tree;	/* Meta out-of-order queue */
 
-	u16 remove_addrs;
+	/* The packet scheduler and its private data */
+	struct mptcp_sched_ops *sched_ops;
+	u32 mptcp_sched[MPTCP_SCHED_SIZE / sizeof(u32)];
+
+	u64 remove_addrs;
 
 	u8 dfin_path_index;
-	/* Worker struct for subflow establishment */
-	struct work_struct subflow_work;
-	struct delayed_work subflow_retry_work;
-	/* Worker to handle interface/address changes if socket is owned */
-	struct work_struct address_work;
+	/* Workers of the path-manager, allocated on demand */
+	struct mptcp_pm_work *pm_work;
 	/* Mutex needed, because otherwise mptcp_close will complain that the
 	 * socket is owned by the user.
 	 * E.g., mptcp_sub_close_wq is taking the meta-lock.
@@ -226,23 +317,30 @@ struct mptcp_cb {
 				      struct request_sock *req,
 				      struct dst_entry *dst);
 
-	/* Local addresses */
-	struct mptcp_loc4 addr4[MPTCP_MAX_ADDR];
-	u8 loc4_bits; /* Bitfield, indicating which of the above indexes are set */
+	/* Local addresses, allocated on demand (see mptcp_addr_table_grow) */
+	struct mptcp_loc4 *addr4;
+	u32 loc4_bits; /* Bitfield, indicating which of the above indexes are set */
+	u8 addr4_size;
 	u8 next_v4_index;
 
-	struct mptcp_loc6 addr6[MPTCP_MAX_ADDR];
-	u8 loc6_bits;
+	struct mptcp_loc6 *addr6;
+	u32 loc6_bits;
+	u8 addr6_size;
 	u8 next_v6_index;
+	/* Generation of the per-netns address-table we are in sync with */
+	u32 addr_gen;
 
-	u32 path_index_bits;
+	u64 path_index_bits;	/* Bit pi - 1 is set if pi is in use */
 	/* Next pi to pick up in case a new path becomes available */
 	u8 next_path_index;
 };
 
-static inline int mptcp_pi_to_flag(int pi)
+/* Path-indices range from 1 to MPTCP_MAX_PATHS (0 is the meta-socket) */
+#define MPTCP_MAX_PATHS		64
+
+static inline u64 mptcp_pi_to_flag(int pi)
 {
-	return 1 << (pi - 1);
+	return 1ULL << (pi - 1);
 }
 
 #define MPTCP_SUB_CAPABLE			0
@@ -281,6 +379,11 @@ static inline int mptcp_pi_to_flag(int pi)
 #define MPTCP_SUB_LEN_ACK_64		8
 #define MPTCP_SUB_LEN_ACK_64_ALIGN	8
 
+/* Total length of the DSS-option carrying a data-ack and a mapping */
+#define MPTCP_SUB_LEN_DSM_ALIGN  (MPTCP_SUB_LEN_DSS_ALIGN +		\
+				  MPTCP_SUB_LEN_ACK_ALIGN +		\
+				  MPTCP_SUB_LEN_SEQ_ALIGN)
+
 #define MPTCP_SUB_ADD_ADDR		3
 #define MPTCP_SUB_LEN_ADD_ADDR4		8
 #define MPTCP_SUB_LEN_ADD_ADDR6		20
@@ -505,7 +608,7 @@ struct mp_prio {
 	__u8	addr_id;
 } __attribute__((__packed__));
 
-static inline int mptcp_sub_len_remove_addr(u16 bitfield)
+static inline int mptcp_sub_len_remove_addr(u64 bitfield)
 {
 	unsigned int c;
 	for (c = 0; bitfield; c++)
@@ -513,7 +616,7 @@ static inline int mptcp_sub_len_remove_addr(u16 bitfield)
 	return MPTCP_SUB_LEN_REMOVE_ADDR + c - 1;
 }
 
-static inline int mptcp_sub_len_remove_addr_align(u16 bitfield)
+static inline int mptcp_sub_len_remove_addr_align(u64 bitfield)
 {
 	return ALIGN(mptcp_sub_len_remove_addr(bitfield), 4);
 }
@@ -523,17 +626,19 @@ static inline int mptcp_sub_len_dss(struct mp_dss *m, int csum)
 	return 4 + m->A * (4 + m->a * 4) + m->M * (10  +m->m * 4 + csum * 2);
 }
 
-/* Default MSS for MPTCP
- * All subflows will be using that MSS. If any subflow has a lower MSS, it is
- * just not used. */
-#define MPTCP_MSS 1400
 #define MPTCP_SYN_RETRIES 3
-extern int sysctl_mptcp_mss;
 extern int sysctl_mptcp_ndiffports;
 extern int sysctl_mptcp_enabled;
 extern int sysctl_mptcp_checksum;
 extern int sysctl_mptcp_debug;
 extern int sysctl_mptcp_syn_retries;
+extern int sysctl_mptcp_userspace_pm;
+extern int sysctl_mptcp_ecmp_paths;
+extern int sysctl_mptcp_ecmp_hash;
+extern int sysctl_mptcp_ecmp_seed;
+extern int sysctl_mptcp_rbuf_opti;
+extern int sysctl_mptcp_rbuf_rtt_ratio;
+extern int sysctl_mptcp_rbuf_depth;
 
 extern struct workqueue_struct *mptcp_wq;
 
@@ -543,11 +648,6 @@ extern struct workqueue_struct *mptcp_wq;
 			printk(KERN_DEBUG __FILE__ ": " fmt, ##args);	\
 	} while (0)
 
-static inline int mptcp_sysctl_mss(void)
-{
-	return sysctl_mptcp_mss;
-}
-
 /* Iterates over all subflows */
 #define mptcp_for_each_tp(mpcb, tp)					\
 	for ((tp) = (mpcb)->connection_list; (tp); (tp) = (tp)->mptcp->next)
@@ -564,9 +664,12 @@ static inline int mptcp_sysctl_mss(void)
 	     __sk = __temp,						\
 		     __temp = __sk ? (struct sock *)tcp_sk(__sk)->mptcp->next : NULL)
 
-/* Iterates over all bit set to 1 in a bitset */
+/* Iterates over all bits set to 1 in a bitset. b must not be larger than
+ * 32 bits, because ffs() truncates to int.
+ */
 #define mptcp_for_each_bit_set(b, i)					\
-	for (i = ffs(b) - 1; i >= 0; i = ffs(b >> (i + 1) << (i + 1)) - 1)
+	for (i = ffs(b) - 1; i >= 0;					\
+	     i = ffs((u64)(b) >> (i + 1) << (i + 1)) - 1)
 
 #define mptcp_for_each_bit_unset(b, i)					\
 	mptcp_for_each_bit_set(~b, i)
@@ -577,23 +680,72 @@ void mptcp_set_state(struct sock *sk);
 void mptcp_sock_destruct(struct sock *sk);
 void mptcp_sock_def_error_report(struct sock *sk);
 
-void mptcp_add_meta_ofo_queue(struct sock *meta_sk, struct sk_buff *skb,
-			      struct sock *sk);
+/* Intervals of a queue are disjoint and never adjacent - those are merged.
+ * Inside an interval, the skbs have strictly increasing seq and end_seq and
+ * each one starts at most at the end of the previous one.
+ */
+struct mptcp_seq_interval {
+	struct rb_node		node;
+	u32			seq;
+	u32			end_seq;
+	struct sk_buff_head	queue;
+};
+
+#define mptcp_seq_entry(ptr) rb_entry(ptr, struct mptcp_seq_interval, node)
+
+struct mptcp_seq_interval *mptcp_seq_queue_find(const struct rb_root *root,
+						u32 seq,
+						struct mptcp_seq_interval **next);
+int mptcp_seq_queue_add(struct rb_root *root, struct sk_buff *skb,
+			struct sock *meta_sk);
+void mptcp_seq_queue_free(struct rb_root *root, struct mptcp_seq_interval *it);
+void mptcp_seq_queue_purge(struct rb_root *root);
+void mptcp_seq_queue_init(void);
+void mptcp_add_meta_ofo_queue(struct sock *meta_sk, struct sk_buff *skb);
 void mptcp_ofo_queue(struct sock *meta_sk);
 void mptcp_purge_ofo_queue(struct tcp_sock *meta_tp);
+int mptcp_reinject_queue_add(struct mptcp_cb *mpcb, struct sk_buff *skb);
+struct sk_buff *mptcp_reinject_queue_head(const struct mptcp_cb *mpcb);
+void mptcp_reinject_queue_unlink(struct mptcp_cb *mpcb, struct sk_buff *skb);
+void mptcp_reinject_queue_after(struct mptcp_cb *mpcb, struct sk_buff *skb,
+				struct sk_buff *buff);
+void mptcp_clean_reinject_queue(struct mptcp_cb *mpcb, u32 snd_una);
+void mptcp_purge_reinject_queue(struct tcp_sock *meta_tp);
+void mptcp_reinject_queue_clear_pi(struct mptcp_cb *mpcb, u8 path_index);
+int mptcp_try_coalesce(struct sock *meta_sk, struct sk_buff *to,
+		       struct sk_buff *from);
 void mptcp_cleanup_rbuf(struct sock *meta_sk, int copied);
 int mptcp_alloc_mpcb(struct sock *master_sk, __u64 remote_key, u32 window);
 int mptcp_add_sock(struct sock *meta_sk, struct sock *sk, u8 rem_id, gfp_t flags);
 void mptcp_del_sock(struct sock *sk);
+void mptcp_cc_agg_update(struct sock *sk);
 void mptcp_update_metasocket(struct sock *sock, struct sock *meta_sk);
+int __mptcp_addr_table_grow(void **table, u8 *size, int i, size_t entry_size);
+void mptcp_free_addr_tables(struct mptcp_cb *mpcb);
+
+/* Makes sure that index i of an address-table can be used */
+#define mptcp_addr_table_grow(table, size, i)				\
+	__mptcp_addr_table_grow((void **)&(table), &(size), i, sizeof(*(table)))
 void mptcp_reinject_data(struct sock *orig_sk, int clone_it);
+int mptcp_skb_data_seq(const struct sk_buff *skb, const struct sock *sk,
+		       u32 *seq, u32 *end_seq);
 void mptcp_update_sndbuf(struct mptcp_cb *mpcb);
-struct sk_buff *mptcp_next_segment(struct sock *sk, int *reinject);
+struct sk_buff *mptcp_rcv_buf_optimization(struct sock *sk, int penal);
 void mptcp_send_fin(struct sock *meta_sk);
 void mptcp_send_reset(struct sock *sk, struct sk_buff *skb);
 void mptcp_send_active_reset(struct sock *meta_sk, gfp_t priority);
 int mptcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		     int push_one, gfp_t gfp);
+unsigned int mptcp_current_mss(struct sock *meta_sk);
+int mptcp_register_scheduler(struct mptcp_sched_ops *sched);
+void mptcp_unregister_scheduler(struct mptcp_sched_ops *sched);
+void mptcp_init_scheduler(struct mptcp_cb *mpcb);
+void mptcp_cleanup_scheduler(struct mptcp_cb *mpcb);
+int mptcp_set_scheduler(struct sock *sk, const char *name);
+int mptcp_set_default_scheduler(const char *name);
+void mptcp_get_default_scheduler(char *name);
+int mptcp_is_available(struct sock *sk, struct sk_buff *skb);
+struct sk_buff *__mptcp_next_segment(struct sock *meta_sk, int *reinject);
 void mptcp_parse_options(const uint8_t *ptr, int opsize,
 			 struct tcp_options_received *opt_rx,
 			 struct multipath_options *mopt,
@@ -638,12 +790,13 @@ int mptcp_backlog_rcv(struct sock *meta_sk, struct sk_buff *skb);
 struct sock *mptcp_sk_clone(struct sock *sk, int family, const gfp_t priority);
 void mptcp_ack_handler(unsigned long);
 void mptcp_set_keepalive(struct sock *sk, int val);
+void mptcp_diag_get_info(const struct sock *sk, struct mptcp_diag_info *info);
 
-static inline void mptcp_fragment(struct sk_buff *skb, struct sk_buff *buff)
+/* Returns the next segment to be sent, as chosen by the scheduler */
+static inline struct sk_buff *mptcp_next_segment(struct sock *meta_sk,
+						 int *reinject)
 {
-	u8 flags = TCP_SKB_CB(skb)->mptcp_flags;
-	TCP_SKB_CB(skb)->mptcp_flags = flags & ~(MPTCPHDR_FIN);
-	TCP_SKB_CB(buff)->mptcp_flags = flags;
+	return tcp_sk(meta_sk)->mpcb->sched_ops->next_segment(meta_sk, reinject);
 }
 
 static inline void mptcp_push_pending_frames(struct sock *meta_sk)
@@ -692,19 +845,17 @@ static inline int mptcp_skb_cloned(const struct sk_buff *skb,
 {
 	/* If it does not has a DSS-mapping (MPTCPHDR_SEQ), it does not come
 	 * from the meta-level send-queue and thus dataref is as usual.
-	 * If it has a DSS-mapping dataref is 2, if we are coming straight from
-	 * the meta-send-queue.
-	 * It is 1, if we took the segment from a pskb_copy'd segment of the
-	 * reinject-queue.
 	 *
-	 * It will be > 2, if the segment is also referenced at another place.
-	 * E.g., an rbuf-opti reinjection is held in the meta-queue, subflow-queue
-	 * and in the queue of the new subflow.
+	 * If it has a DSS-mapping, it either is a clone of a segment of the
+	 * meta-send-queue or a private copy (pskb_copy) of a GSO-segment. The
+	 * segments in the meta-send-queue only hold a reference to the payload
+	 * (skb_header_release), thus we only have to care about someone else
+	 * holding our header - e.g., a previous transmission still sitting in
+	 * the qdisc, or a copy of the segment on another subflow.
 	 */
 	return tp->mpc &&
 	       ((!mptcp_is_data_seq(skb) && skb_cloned(skb)) ||
-		(mptcp_is_data_seq(skb) && skb->cloned &&
-		 (atomic_read(&skb_shinfo(skb)->dataref) & SKB_DATAREF_MASK) > 2));
+		(mptcp_is_data_seq(skb) && skb_header_cloned(skb)));
 }
 
 /* Sets the data_seq and returns pointer to the in-skb field of the data_seq.
@@ -757,48 +908,133 @@ static inline int is_master_tp(const struct tcp_sock *tp)
 	return !tp->mpc || (!tp->mptcp->slave_sk && !is_meta_tp(tp));
 }
 
+/* Called when @skb gets split at the TCP-level and @buff holds the tail */
+static inline void mptcp_fragment(const struct sock *sk, struct sk_buff *skb,
+				  struct sk_buff *buff)
+{
+	u8 flags = TCP_SKB_CB(skb)->mptcp_flags;
+	TCP_SKB_CB(skb)->mptcp_flags = flags & ~(MPTCPHDR_FIN);
+	TCP_SKB_CB(buff)->mptcp_flags = flags;
+
+	if (is_meta_sk(sk)) {
+		/* The tail has been sent on the same subflows as the head */
+		TCP_SKB_CB(buff)->path_mask = TCP_SKB_CB(skb)->path_mask;
+		TCP_SKB_CB(buff)->acked_pi = TCP_SKB_CB(skb)->acked_pi;
+	} else if (mptcp_is_data_seq(skb)) {
+		/* The DSS-mapping (see mptcp_skb_entail) covers the whole
+		 * original segment. It is still valid for the tail, thus we
+		 * simply repeat it.
+		 */
+		TCP_SKB_CB(buff)->dss_map = TCP_SKB_CB(skb)->dss_map;
+	}
+}
+
+/* skb_split has moved everything beyond @len from @skb to @buff. The
+ * DSS-checksum relies on skb->csum, thus derive both checksums from the
+ * one of the original segment by summing up only the smaller part.
+ */
+static inline void mptcp_split_csum(struct sk_buff *skb, struct sk_buff *buff,
+				    u32 len)
+{
+	__wsum csum = skb->csum;
+
+	if (buff->len < len) {
+		buff->csum = skb_checksum(buff, 0, buff->len, 0);
+		skb->csum = csum_block_sub(csum, buff->csum, len);
+	} else {
+		skb->csum = skb_checksum(skb, 0, len, 0);
+		buff->csum = csum_block_add(0, csum_sub(csum, skb->csum), len);
+	}
+}
+
+/* Can the data of the meta-socket be left to the checksum-offloading of
+ * the subflows? Otherwise, the checksum better gets computed while copying
+ * the data from user-space.
+ */
+static inline int mptcp_can_offload_csum(const struct mptcp_cb *mpcb)
+{
+	struct sock *sk;
+
+	if (mpcb->rx_opt.dss_csum)
+		return 0;
+
+	mptcp_for_each_sk(mpcb, sk) {
+		if (!(sk->sk_route_caps & NETIF_F_ALL_CSUM))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* The DSS-mapping shares the tcp_skb_cb with the inet(6)_skb_parm. Wipe it
+ * from the segment handed to the IP-layer by tcp_transmit_skb.
+ */
+static inline void mptcp_skb_clear_dss_map(const struct tcp_sock *tp,
+					   struct sk_buff *skb)
+{
+	if (tp->mpc && mptcp_is_data_seq(skb))
+		memset(&TCP_SKB_CB(skb)->header, 0,
+		       sizeof(TCP_SKB_CB(skb)->header));
+}
+
+static inline int mptcp_ofo_queue_empty(const struct tcp_sock *meta_tp)
+{
+	return RB_EMPTY_ROOT(&meta_tp->mpcb->ofo_tree);
+}
+
+static inline int mptcp_reinject_queue_empty(const struct mptcp_cb *mpcb)
+{
+	return RB_EMPTY_ROOT(&mpcb->reinject_tree);
+}
+
 static inline int mptcp_req_sk_saw_mpc(const struct request_sock *req)
 {
 	return tcp_rsk(req)->saw_mpc;
 }
 
-static inline void mptcp_hash_request_remove(struct request_sock *req)
+static inline void mptcp_init_request_tuple(struct request_sock *req,
+					    struct mptcp_cb *mpcb)
 {
-	int in_softirq = 0;
+	struct mptcp_request_sock *mtreq = mptcp_rsk(req);
 
-	if (list_empty(&mptcp_rsk(req)->collide_tuple))
-		return;
+	mtreq->mpcb = mpcb;
+	mtreq->meta_sk = mpcb->meta_sk;
+	/* Keep ->next, lockless lookups may still walk this recycled node */
+	mtreq->collide_tuple.pprev = NULL;
+}
 
-	if (in_softirq()) {
-		spin_lock(&mptcp_reqsk_hlock);
-		in_softirq = 1;
-	} else {
-		spin_lock_bh(&mptcp_reqsk_hlock);
-	}
+static inline void mptcp_hash_request_add(struct request_sock *req, u32 hash)
+{
+	struct mptcp_request_sock *mtreq = mptcp_rsk(req);
+	struct mptcp_reqsk_bucket *b = &mptcp_reqsk_htb[hash];
 
-	list_del(&mptcp_rsk(req)->collide_tuple);
+	mtreq->collide_hash = hash;
 
-	if (in_softirq)
-		spin_unlock(&mptcp_reqsk_hlock);
-	else
-		spin_unlock_bh(&mptcp_reqsk_hlock);
+	spin_lock(&b->lock);
+	hlist_nulls_add_head_rcu(&mtreq->collide_tuple, &b->head);
+	spin_unlock(&b->lock);
+}
+
+static inline void mptcp_hash_request_remove(struct request_sock *req)
+{
+	struct mptcp_request_sock *mtreq = mptcp_rsk(req);
+	struct mptcp_reqsk_bucket *b;
+
+	if (hlist_nulls_unhashed(&mtreq->collide_tuple))
+		return;
+
+	b = &mptcp_reqsk_htb[mtreq->collide_hash];
+	spin_lock_bh(&b->lock);
+	hlist_nulls_del_init_rcu(&mtreq->collide_tuple);
+	spin_unlock_bh(&b->lock);
 }
 
 static inline void mptcp_reqsk_destructor(struct request_sock *req)
 {
-	if (!mptcp_rsk(req)->mpcb) {
-		if (in_softirq()) {
-			mptcp_reqsk_remove_tk(req);
-		} else {
-			rcu_read_lock_bh();
-			spin_lock(&mptcp_tk_hashlock);
-			hlist_nulls_del_rcu(&mptcp_rsk(req)->collide_tk);
-			spin_unlock(&mptcp_tk_hashlock);
-			rcu_read_unlock_bh();
-		}
-	} else {
+	if (!mptcp_rsk(req)->mpcb)
+		mptcp_reqsk_remove_tk(req);
+	else
 		mptcp_hash_request_remove(req);
-	}
 }
 
 static inline void mptcp_init_mp_opt(struct multipath_options *mopt)
@@ -905,6 +1141,54 @@ static inline int mptcp_sk_can_send(const struct sock *sk)
 	return (1 << sk->sk_state) & (TCPF_ESTABLISHED | TCPF_CLOSE_WAIT);
 }
 
+static inline void *mptcp_sched_priv(const struct mptcp_cb *mpcb)
+{
+	return (void *)mpcb->mptcp_sched;
+}
+
+static inline int mptcp_is_backup(const struct tcp_sock *tp)
+{
+	return tp->rx_opt.low_prio || tp->mptcp->low_prio;
+}
+
+/* Are we not allowed to reinject this skb on tp? */
+static inline int mptcp_dont_reinject_skb(const struct tcp_sock *tp,
+					  const struct sk_buff *skb)
+{
+	/* If the skb has already been enqueued in this sk, try to find
+	 * another one.
+	 * An exception is a DATA_FIN without data. These ones are not
+	 * reinjected at the subflow-level as they do not consume
+	 * subflow-sequence-number space.
+	 */
+	return skb &&
+		/* We either have a data_fin with data or not a data_fin */
+		((mptcp_is_data_fin(skb) && TCP_SKB_CB(skb)->end_seq - TCP_SKB_CB(skb)->seq  > 1) ||
+		!mptcp_is_data_fin(skb)) &&
+		/* Has the skb already been enqueued into this subsocket? */
+		mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask;
+}
+
+/* skb leaves the meta write-queue - the schedulers must not resume at it */
+static inline void mptcp_sched_hint_forget(struct mptcp_cb *mpcb,
+					   const struct sk_buff *skb)
+{
+	struct tcp_sock *tp;
+
+	mptcp_for_each_tp(mpcb, tp) {
+		if (tp->mptcp->sched_hint == skb)
+			tp->mptcp->sched_hint = NULL;
+	}
+}
+
+static inline void mptcp_sched_hint_reset(struct mptcp_cb *mpcb)
+{
+	struct tcp_sock *tp;
+
+	mptcp_for_each_tp(mpcb, tp)
+		tp->mptcp->sched_hint = NULL;
+}
+
 static inline int mptcp_sk_can_recv(const struct sock *sk)
 {
 	return (1 << sk->sk_state) & (TCPF_ESTABLISHED | TCP_FIN_WAIT1 | TCP_FIN_WAIT2);
@@ -1030,57 +1314,55 @@ static inline int mptcp_mp_fail_rcvd(struct sock *sk, struct tcphdr *th)
 	return 0;
 }
 
-/* Find the first free index in the bitfield */
-static inline int __mptcp_find_free_index(u8 bitfield, int j, u8 base)
+/* Find the first free index in the bitfield, starting at base and wrapping
+ * around at MPTCP_MAX_ADDR. Index j is skipped.
+ */
+static inline int __mptcp_find_free_index(u32 bitfield, int j, u8 base)
 {
 	int i;
-	mptcp_for_each_bit_unset(bitfield >> base, i) {
-		/* We wrapped at the bitfield - try from 0 on */
-		if (i + base >= sizeof(bitfield) * 8) {
-			mptcp_for_each_bit_unset(bitfield, i) {
-				if (i != j)
-					return i;
-			}
-			goto exit;
-		}
-		if (i + base != j)
-			return i + base;
+
+	for (i = base; i < MPTCP_MAX_ADDR; i++) {
+		if (i != j && !(bitfield & (1U << i)))
+			return i;
 	}
-exit:
+	for (i = 0; i < base && i < MPTCP_MAX_ADDR; i++) {
+		if (i != j && !(bitfield & (1U << i)))
+			return i;
+	}
+
 	return -1;
 }
 
-static inline int mptcp_find_free_index(u8 bitfield)
+static inline int mptcp_find_free_index(u32 bitfield)
 {
 	return __mptcp_find_free_index(bitfield, -1, 0);
 }
 
-/* Find the first index whose bit in the bit-field == 0 */
+/* Find the first unused path-index, starting at next_path_index */
 static inline u8 mptcp_set_new_pathindex(struct mptcp_cb *mpcb)
 {
-	u8 base = mpcb->next_path_index;
+	int base = mpcb->next_path_index;
 	int i;
 
 	/* Start at 1, because 0 is reserved for the meta-sk */
-	mptcp_for_each_bit_unset(mpcb->path_index_bits >> base, i) {
-		if (i + base < 1)
-			continue;
-		if (i + base >= sizeof(mpcb->path_index_bits) * 8)
-			break;
-		i += base;
-		mpcb->path_index_bits |= (1 << i);
-		mpcb->next_path_index = i + 1;
-		return i;
+	if (base < 1 || base > MPTCP_MAX_PATHS)
+		base = 1;
+
+	for (i = base; i <= MPTCP_MAX_PATHS; i++) {
+		if (!(mpcb->path_index_bits & mptcp_pi_to_flag(i)))
+			goto found;
 	}
-	mptcp_for_each_bit_unset(mpcb->path_index_bits, i) {
-		if (i < 1)
-			continue;
-		mpcb->path_index_bits |= (1 << i);
-		mpcb->next_path_index = i + 1;
-		return i;
+	for (i = 1; i < base; i++) {
+		if (!(mpcb->path_index_bits & mptcp_pi_to_flag(i)))
+			goto found;
 	}
 
 	return 0;
+
+found:
+	mpcb->path_index_bits |= mptcp_pi_to_flag(i);
+	mpcb->next_path_index = i + 1;
+	return i;
 }
 
 static inline int mptcp_v6_is_v4_mapped(struct sock *sk)
@@ -1091,11 +1373,6 @@ static inline int mptcp_v6_is_v4_mapped(struct sock *sk)
 
 #else /* CONFIG_MPTCP */
 
-static inline int mptcp_sysctl_mss(void)
-{
-	return 0;
-}
-
 #define mptcp_debug(fmt, args...)	\
 	do {				\
 	} while(0)
@@ -1152,8 +1429,14 @@ static inline int mptcp_req_sk_saw_mpc(const struct request_sock *req)
 	return 0;
 }
 static inline void mptcp_purge_ofo_queue(struct tcp_sock *meta_tp) {}
+static inline void mptcp_purge_reinject_queue(struct tcp_sock *meta_tp) {}
+static inline int mptcp_ofo_queue_empty(const struct tcp_sock *meta_tp)
+{
+	return 1;
+}
 static inline void mptcp_cleanup_rbuf(const struct sock *meta_sk, int copied) {}
 static inline void mptcp_del_sock(const struct sock *sk) {}
+static inline void mptcp_cc_agg_update(const struct sock *sk) {}
 static inline void mptcp_reinject_data(struct sock *orig_sk, int clone_it) {}
 static inline void mptcp_init_buffer_space(const struct sock *sk) {}
 static inline void mptcp_update_sndbuf(const struct mptcp_cb *mpcb) {}
@@ -1260,13 +1543,28 @@ static inline int mptcp_write_xmit(struct sock *sk, unsigned int mss_now,
 {
 	return 0;
 }
+static inline unsigned int mptcp_current_mss(struct sock *meta_sk)
+{
+	return 0;
+}
 static inline struct sock *mptcp_sk_clone(const struct sock *sk,
 					  int family, int priority)
 {
 	return NULL;
 }
 static inline void mptcp_set_keepalive(struct sock *sk, int val) {}
-static inline void mptcp_fragment(struct sk_buff *skb, struct sk_buff *buff) {}
+static inline void mptcp_diag_get_info(const struct sock *sk,
+				       struct mptcp_diag_info *info) {}
+static inline void mptcp_fragment(const struct sock *sk, struct sk_buff *skb,
+				  struct sk_buff *buff) {}
+static inline void mptcp_split_csum(struct sk_buff *skb, struct sk_buff *buff,
+				    u32 len) {}
+static inline int mptcp_can_offload_csum(const struct mptcp_cb *mpcb)
+{
+	return 0;
+}
+static inline void mptcp_skb_clear_dss_map(const struct tcp_sock *tp,
+					   struct sk_buff *skb) {}
 #endif /* CONFIG_MPTCP */
 
 #endif /* _MPTCP_H */
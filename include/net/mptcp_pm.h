@@ -37,17 +37,58 @@
 #include <linux/skbuff.h>
 #include <linux/spinlock_types.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include <net/request_sock.h>
 #include <net/sock.h>
 #include <net/tcp.h>
 
-/* Max number of local or remote addresses we can store.
- * When changing, see the bitfield below in mptcp_loc4/6. */
-#define MPTCP_MAX_ADDR	8
+/* Max number of local or remote addresses we can store (per family).
+ * When changing, see the bitfields below in mptcp_rem4/6 and the u32
+ * address-bitfields of the mpcb. The v6 address-ids are offset by
+ * MPTCP_MAX_ADDR, thus they must all fit in the u64 remove_addrs.
+ */
+#define MPTCP_MAX_ADDR	32
+
+/* The address-tables of the mpcb are allocated on demand and grow by this
+ * number of entries.
+ */
+#define MPTCP_ADDR_CHUNK	4
 
 #define MPTCP_SUBFLOW_RETRY_DELAY	1000
 
+/* ECMP-aware ndiffports (see sysctl mptcp_ecmp_paths). The subflows are
+ * checked for a shared bottleneck every MPTCP_ECMP_INTERVAL ms. A pair has
+ * to look shared during MPTCP_ECMP_HITS intervals in a row before one of
+ * them is re-rolled. The checks stop after MPTCP_ECMP_STABLE intervals
+ * without any suspicious pair.
+ */
+#define MPTCP_ECMP_MAX_PATHS		64
+#define MPTCP_ECMP_INTERVAL		1000
+#define MPTCP_ECMP_RTT_SHIFT		3
+#define MPTCP_ECMP_PORT_TRIES		64
+#define MPTCP_ECMP_BIND_TRIES		4
+#define MPTCP_ECMP_HITS			3
+#define MPTCP_ECMP_STABLE		10
+
+/* Peer-cache: MPTCP_PEER_DEPTH entries per bucket at most, forgotten
+ * after MPTCP_PEER_TIMEOUT.
+ */
+#define MPTCP_PEER_HSIZE		256
+#define MPTCP_PEER_DEPTH		4
+#define MPTCP_PEER_ADDRS		8
+#define MPTCP_PEER_PATHS		8
+#define MPTCP_PEER_TIMEOUT		(10 * 60 * HZ)
+
+/* Hash-models of the fabric (sysctl mptcp_ecmp_hash) */
+#define MPTCP_ECMP_HASH_XOR		0
+#define MPTCP_ECMP_HASH_JHASH		1
+
+/* Address-events arriving within this delay (in ms) are handled in a single
+ * pass over the connections.
+ */
+#define MPTCP_ADDR_EVENT_DELAY		100
+
 struct mptcp_loc4 {
 	u8		id;
 	u8		low_prio:1;
@@ -57,8 +98,8 @@ struct mptcp_loc4 {
 
 struct mptcp_rem4 {
 	u8		id;
-	u8		bitfield;
-	u8		retry_bitfield;
+	u32		bitfield;
+	u32		retry_bitfield;
 	__be16		port;
 	struct in_addr	addr;
 };
@@ -72,36 +113,84 @@ struct mptcp_loc6 {
 
 struct mptcp_rem6 {
 	u8		id;
-	u8		bitfield;
-	u8		retry_bitfield;
+	u32		bitfield;
+	u32		retry_bitfield;
 	__be16		port;
 	struct in6_addr	addr;
 };
 
+/* The local addresses usable by MPTCP. Every change bumps the generation. */
+struct mptcp_loc_addr {
+	struct mptcp_loc4 locaddr4[MPTCP_MAX_ADDR];
+	u32 loc4_bits;
+
+	struct mptcp_loc6 locaddr6[MPTCP_MAX_ADDR];
+	u32 loc6_bits;
+
+	u32 generation;
+};
+
 struct mptcp_cb;
 #ifdef CONFIG_MPTCP
 
+/* Most connections never go beyond the initial subflow. Thus, the workers
+ * of the path-manager are only allocated once they are needed (see
+ * mptcp_pm_work_get).
+ */
+struct mptcp_pm_work {
+	struct mptcp_cb		*mpcb;
+
+	/* Worker struct for subflow establishment */
+	struct work_struct	subflow_work;
+	struct delayed_work	subflow_retry_work;
+	/* Worker to reconcile the local addresses with the per-netns table */
+	struct work_struct	address_work;
+	/* Worker re-rolling ndiffports-subflows that share an ECMP-path */
+	struct delayed_work	ecmp_work;
+	u8			ecmp_stable; /* Intervals without suspects */
+};
+
+/* Per-netns state of the path-manager. The notifiers only update the
+ * address-table. address_work then queues the mptcp_address_worker of the
+ * connections whose mpcb->addr_gen is behind, so that they reconcile
+ * their address-list with the table.
+ */
+struct mptcp_pm_ns {
+	struct mptcp_loc_addr	addrs;
+	spinlock_t		lock;	/* Protects addrs */
+
+	struct delayed_work	address_work;
+	struct net		*net;
+
+	/* Peer-cache, see mptcp_peer.c */
+	struct hlist_head	peer_hash[MPTCP_PEER_HSIZE];
+	spinlock_t		peer_lock;
+	u32			peer_rnd;
+};
+
 #define MPTCP_HASH_SIZE                1024
 
 /* This second hashtable is needed to retrieve request socks
  * created as a result of a join request. While the SYN contains
  * the token, the final ack does not, so we need a separate hashtable
  * to retrieve the mpcb.
+ *
+ * Lookups are lockless, like in the ehash - the request-socks are
+ * SLAB_DESTROY_BY_RCU. Writers take the lock of the bucket.
  */
-extern struct list_head mptcp_reqsk_htb[MPTCP_HASH_SIZE];
-extern spinlock_t mptcp_reqsk_hlock;	/* hashtable protection */
+struct mptcp_reqsk_bucket {
+	spinlock_t		lock;
+	struct hlist_nulls_head	head;
+};
 
-/* Lock, protecting the two hash-tables that hold the token. Namely,
- * mptcp_reqsk_tk_htb and tk_hashtable
- */
-extern spinlock_t mptcp_tk_hashlock;	/* hashtable protection */
+extern struct mptcp_reqsk_bucket mptcp_reqsk_htb[MPTCP_HASH_SIZE];
 
 void mptcp_create_subflows(struct sock *meta_sk);
 void mptcp_create_subflow_worker(struct work_struct *work);
 void mptcp_retry_subflow_worker(struct work_struct *work);
 struct mp_join *mptcp_find_join(struct sk_buff *skb);
 u8 mptcp_get_loc_addrid(struct mptcp_cb *mpcb, struct sock *sk);
-void __mptcp_hash_insert(struct tcp_sock *meta_tp, u32 token);
+void mptcp_hash_insert(struct tcp_sock *meta_tp, u32 token);
 void mptcp_hash_remove_bh(struct tcp_sock *meta_tp);
 void mptcp_hash_remove(struct tcp_sock *meta_tp);
 struct sock *mptcp_hash_find(u32 token);
@@ -116,9 +205,26 @@ void mptcp_connect_init(struct tcp_sock *tp);
 void mptcp_set_addresses(struct sock *meta_sk);
 int mptcp_check_req(struct sk_buff *skb);
 void mptcp_address_worker(struct work_struct *work);
+void mptcp_ecmp_worker(struct work_struct *work);
+struct mptcp_pm_work *mptcp_pm_work_get(struct mptcp_cb *mpcb);
 int mptcp_pm_addr_event_handler(unsigned long event, void *ptr, int family);
+struct mptcp_pm_ns *mptcp_pm_get_ns(const struct net *net);
+void mptcp_pm_addr_changed(struct mptcp_pm_ns *ns);
 int mptcp_pm_init(void);
 void mptcp_pm_undo(void);
+void mptcp_nl_conn_event(struct sock *sk, u8 event);
+void mptcp_nl_addr_event(const struct mptcp_cb *mpcb, u8 event, u8 rem_id,
+			 sa_family_t family, const void *addr, __be16 port);
+int mptcp_nl_init(void);
+void mptcp_nl_undo(void);
+void mptcp_peer_init_ns(struct mptcp_pm_ns *ns);
+void mptcp_peer_flush_ns(struct mptcp_pm_ns *ns);
+void mptcp_peer_save_path(struct sock *sk);
+void mptcp_peer_save_addrs(struct sock *meta_sk);
+void mptcp_peer_seed_addrs(struct sock *meta_sk);
+void mptcp_peer_init_metrics(struct sock *sk);
+int mptcp_peer_path_failed(struct sock *meta_sk, sa_family_t family,
+			   const void *loc, const void *rem);
 
 #else /* CONFIG_MPTCP */
 static inline void mptcp_reqsk_new_mptcp(struct request_sock *req,
@@ -126,6 +232,7 @@ static inline void mptcp_reqsk_new_mptcp(struct request_sock *req,
 					 const struct multipath_options *mopt)
 {}
 static inline void mptcp_hash_remove(struct tcp_sock *meta_tp) {}
+static inline void mptcp_peer_init_metrics(struct sock *sk) {}
 #endif /* CONFIG_MPTCP */
 
 #endif /*_MPTCP_PM_H*/
@@ -54,8 +54,9 @@ struct sock *mptcp_v4_search_req(const __be16 rport, const __be32 raddr,
 				 const __be32 laddr);
 int mptcp_init4_subsockets(struct sock *meta_sk, const struct mptcp_loc4 *loc,
 			   struct mptcp_rem4 *rem);
-void mptcp_pm_addr4_event_handler(struct in_ifaddr *ifa, unsigned long event,
-				  struct mptcp_cb *mpcb);
+void mptcp_pm_addr4_event_handler(struct in_ifaddr *ifa, unsigned long event);
+void mptcp_v4_update_loc_addrs(struct mptcp_cb *mpcb,
+			       const struct mptcp_loc_addr *addrs);
 int mptcp_pm_v4_init(void);
 void mptcp_pm_v4_undo(void);
 void mptcp_v4_send_add_addr(int loc_id, struct mptcp_cb *mpcb);
@@ -64,8 +64,9 @@ struct sock *mptcp_v6_search_req(const __be16 rport, const struct in6_addr *radd
 				 const struct in6_addr *laddr);
 int mptcp_init6_subsockets(struct sock *meta_sk, const struct mptcp_loc6 *loc,
 			   struct mptcp_rem6 *rem);
-void mptcp_pm_addr6_event_handler(struct inet6_ifaddr *ifa, unsigned long event,
-				  struct mptcp_cb *mpcb);
+void mptcp_pm_addr6_event_handler(struct inet6_ifaddr *ifa, unsigned long event);
+void mptcp_v6_update_loc_addrs(struct mptcp_cb *mpcb,
+			       const struct mptcp_loc_addr *addrs);
 int mptcp_pm_v6_init(void);
 void mptcp_pm_v6_undo(void);
 void mptcp_v6_send_add_addr(int loc_id, struct mptcp_cb *mpcb);
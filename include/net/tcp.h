@@ -364,6 +364,8 @@ extern unsigned int tcp_cwnd_test(struct tcp_sock *tp, struct sk_buff *skb);
 extern int tcp_mtu_probe(struct sock *sk);
 extern int tcp_init_tso_segs(struct sock *sk, struct sk_buff *skb,
 			     unsigned int mss_now);
+extern void tcp_set_skb_tso_segs(struct sock *sk, struct sk_buff *skb,
+				 unsigned int mss_now);
 extern void __pskb_trim_head(struct sk_buff *skb, int len);
 extern void tcp_queue_skb(struct sock *sk, struct sk_buff *skb);
 extern void tcp_init_nondata_skb(struct sk_buff *skb, u32 seq, u8 flags);
@@ -755,7 +757,22 @@ struct tcp_skb_cb {
 #endif
 		} header;	/* For incoming frames		*/
 #ifdef CONFIG_MPTCP
-		__u32 path_mask; /* path indices that tried to send this skb */
+		struct {
+			__u64 path_mask; /* path indices that tried to send this skb */
+			__u8 acked_pi;	 /* path index of the first copy acked
+					  * at the subflow-level
+					  */
+		};
+		/* DSS-mapping of a segment in the send-queue of a subflow.
+		 * The option is built out of it by mptcp_options_write.
+		 */
+		struct {
+			__u32	data_seq;
+			__u32	subseq;		/* relative to snt_isn	*/
+			__u16	data_len;
+			__sum16	csum;
+			__u8	data_fin;
+		} dss_map;
 #endif
 	};
 	__u32		seq;		/* Starting sequence number	*/
@@ -767,6 +784,8 @@ struct tcp_skb_cb {
 	__u8		mptcp_flags;	/* flags for the MPTCP layer    */
 	__u8		dss_off;	/* Number of 4-byte words until
 					 * seq-number */
+	__u8		csum_complete;	/* skb->csum still covers the
+					 * whole received segment */
 #endif
 	__u8		flags;		/* TCP header flags.		*/
 	__u8		sacked;		/* State flags for SACK/FACK.	*/
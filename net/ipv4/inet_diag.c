@@ -21,6 +21,7 @@
 
 #include <net/icmp.h>
 #include <net/tcp.h>
+#include <net/mptcp.h>
 #include <net/ipv6.h>
 #include <net/inet_common.h>
 #include <net/inet_connection_sock.h>
@@ -108,6 +109,13 @@ static int inet_csk_diag_fill(struct sock *sk,
 		       icsk->icsk_ca_ops->name);
 	}
 
+#ifdef CONFIG_MPTCP
+	if ((ext & (1 << (INET_DIAG_MPTCPINFO - 1))) &&
+	    sk->sk_protocol == IPPROTO_TCP && tcp_sk(sk)->mpc)
+		mptcp_diag_get_info(sk, INET_DIAG_PUT(skb, INET_DIAG_MPTCPINFO,
+					sizeof(struct mptcp_diag_info)));
+#endif
+
 	r->idiag_family = sk->sk_family;
 	r->idiag_state = sk->sk_state;
 	r->idiag_timer = 0;
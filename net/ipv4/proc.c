@@ -256,6 +256,20 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TCPTimeWaitOverflow", LINUX_MIB_TCPTIMEWAITOVERFLOW),
 	SNMP_MIB_ITEM("TCPReqQFullDoCookies", LINUX_MIB_TCPREQQFULLDOCOOKIES),
 	SNMP_MIB_ITEM("TCPReqQFullDrop", LINUX_MIB_TCPREQQFULLDROP),
+	SNMP_MIB_ITEM("MPTCPFallbackSynAck", LINUX_MIB_MPTCPFALLBACKSYNACK),
+	SNMP_MIB_ITEM("MPTCPInfiniteMapRx", LINUX_MIB_MPTCPINFINITEMAPRX),
+	SNMP_MIB_ITEM("MPTCPInfiniteMapTx", LINUX_MIB_MPTCPINFINITEMAPTX),
+	SNMP_MIB_ITEM("MPTCPCsumFail", LINUX_MIB_MPTCPCSUMFAIL),
+	SNMP_MIB_ITEM("MPTCPJoinNoTokenFound", LINUX_MIB_MPTCPJOINNOTOKEN),
+	SNMP_MIB_ITEM("MPTCPJoinInfiniteMap", LINUX_MIB_MPTCPJOININFINITE),
+	SNMP_MIB_ITEM("MPTCPJoinSynAckHMacFailure", LINUX_MIB_MPTCPJOINSYNACKMAC),
+	SNMP_MIB_ITEM("MPTCPJoinAckHMacFailure", LINUX_MIB_MPTCPJOINACKMAC),
+	SNMP_MIB_ITEM("MPTCPOFOQueue", LINUX_MIB_MPTCPOFOQUEUE),
+	SNMP_MIB_ITEM("MPTCPOFODrop", LINUX_MIB_MPTCPOFODROP),
+	SNMP_MIB_ITEM("MPTCPReinjectQueue", LINUX_MIB_MPTCPREINJECTQUEUE),
+	SNMP_MIB_ITEM("MPTCPReinjectSent", LINUX_MIB_MPTCPREINJECTSENT),
+	SNMP_MIB_ITEM("MPTCPRbufRetrans", LINUX_MIB_MPTCPRBUFRETRANS),
+	SNMP_MIB_ITEM("MPTCPRbufPenal", LINUX_MIB_MPTCPRBUFPENAL),
 	SNMP_MIB_SENTINEL
 };
 
@@ -888,8 +888,13 @@ int tcp_sendpage(struct sock *sk, struct page *page, int offset,
 {
 	ssize_t res;
 
-	if (!(sk->sk_route_caps & NETIF_F_SG) ||
-	    !(sk->sk_route_caps & NETIF_F_ALL_CSUM) || tcp_sk(sk)->mpc)
+	/* With MPTCP, the segments go out on the subflows.
+	 * mptcp_skb_entail computes the checksum if a subflow has no
+	 * hw-csum, and the stack linearizes them if it has no sg.
+	 */
+	if (!tcp_sk(sk)->mpc &&
+	    (!(sk->sk_route_caps & NETIF_F_SG) ||
+	     !(sk->sk_route_caps & NETIF_F_ALL_CSUM)))
 		return sock_no_sendpage(sk->sk_socket, page, offset, size,
 					flags);
 
@@ -956,14 +961,7 @@ int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	/* This should be in poll */
 	clear_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
 
-
-	/* If we want to support TSO later, we'll need
-	 * to define xmit_size_goal to something much larger
-	 */
-	if (tp->mpc)
-		mss_now = size_goal = mptcp_sysctl_mss();
-	else
-		mss_now = tcp_send_mss(sk, &size_goal, flags);
+	mss_now = tcp_send_mss(sk, &size_goal, flags);
 
 	/* Ok commence sending. */
 	iovlen = msg->msg_iovlen;
@@ -974,13 +972,10 @@ int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (sk->sk_err || (sk->sk_shutdown & SEND_SHUTDOWN))
 		goto out_err;
 
-	if (tp->mpc)
-		/* At the moment we assume sg is unavailable on any interface.
-		 * In the future we should set sg to 1 if *all* interfaces support sg
-		 */
-		sg = 0;
-	else
-		sg = sk->sk_route_caps & NETIF_F_SG;
+	/* For MPTCP, the stack linearizes the segments of the subflows whose
+	 * interface does not support sg.
+	 */
+	sg = tp->mpc || (sk->sk_route_caps & NETIF_F_SG);
 
 	while (--iovlen >= 0) {
 		size_t seglen = iov->iov_len;
@@ -1016,14 +1011,14 @@ new_segment:
 				/*
 				 * Check whether we can use HW checksum.
 				 *
-				 * If dss-csum is enabled, we do not do hw-csum.
-				 * In case of non-mptcp we check the
-				 * device-capabilities.
-				 * In case of mptcp, hw-csum's will be handled
-				 * later in mptcp_write_xmit.
+				 * In case of mptcp, we do not do hw-csum if
+				 * dss-csum is enabled or if a subflow cannot
+				 * offload it. The checksum is then computed
+				 * while copying the data, instead of in an
+				 * additional pass in mptcp_skb_entail.
 				 */
-				if (((tp->mpc && !tp->mpcb->rx_opt.dss_csum) || !tp->mpc) &&
-				    (tp->mpc || sk->sk_route_caps & NETIF_F_ALL_CSUM))
+				if (tp->mpc ? mptcp_can_offload_csum(tp->mpcb) :
+				    sk->sk_route_caps & NETIF_F_ALL_CSUM)
 					skb->ip_summed = CHECKSUM_PARTIAL;
 
 				skb_entail(sk, skb);
@@ -1145,8 +1140,7 @@ wait_for_memory:
 			if ((err = sk_stream_wait_memory(sk, &timeo)) != 0)
 				goto do_error;
 
-			if (!tp->mpc)
-				mss_now = tcp_send_mss(sk, &size_goal, flags);
+			mss_now = tcp_send_mss(sk, &size_goal, flags);
 		}
 	}
 
@@ -2143,6 +2137,8 @@ int tcp_disconnect(struct sock *sk, int flags)
 	__skb_queue_purge(&sk->sk_receive_queue);
 	tcp_write_queue_purge(sk);
 	__skb_queue_purge(&tp->out_of_order_queue);
+	if (is_meta_sk(sk))
+		mptcp_purge_ofo_queue(tp);
 #ifdef CONFIG_NET_DMA
 	__skb_queue_purge(&sk->sk_async_wait_queue);
 #endif
@@ -2157,7 +2153,8 @@ int tcp_disconnect(struct sock *sk, int flags)
 		struct sock *subsk, *tmpsk;
 		struct tcp_sock *tp = tcp_sk(sk);
 
-		__skb_queue_purge(&tp->mpcb->reinject_queue);
+		mptcp_sched_hint_reset(tp->mpcb);
+		mptcp_purge_reinject_queue(tp);
 
 		if (tp->inside_tk_table) {
 			mptcp_hash_remove_bh(tp);
@@ -2249,6 +2246,25 @@ static int do_tcp_setsockopt(struct sock *sk, int level,
 		release_sock(sk);
 		return err;
 	}
+#ifdef CONFIG_MPTCP
+	case MPTCP_SCHEDULER: {
+		char name[MPTCP_SCHED_NAME_MAX];
+
+		if (optlen < 1)
+			return -EINVAL;
+
+		val = strncpy_from_user(name, optval,
+					min_t(long, MPTCP_SCHED_NAME_MAX-1, optlen));
+		if (val < 0)
+			return -EFAULT;
+		name[val] = 0;
+
+		lock_sock(sk);
+		err = mptcp_set_scheduler(sk, name);
+		release_sock(sk);
+		return err;
+	}
+#endif
 	case TCP_COOKIE_TRANSACTIONS: {
 		struct tcp_cookie_transactions ctd;
 		struct tcp_cookie_values *cvp = NULL;
@@ -2688,6 +2704,25 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 		if (copy_to_user(optval, icsk->icsk_ca_ops->name, len))
 			return -EFAULT;
 		return 0;
+#ifdef CONFIG_MPTCP
+	case MPTCP_SCHEDULER: {
+		char name[MPTCP_SCHED_NAME_MAX];
+
+		if (get_user(len, optlen))
+			return -EFAULT;
+		len = min_t(unsigned int, len, MPTCP_SCHED_NAME_MAX);
+		if (put_user(len, optlen))
+			return -EFAULT;
+
+		if (tp->mptcp_sched_name[0] != '\0')
+			strncpy(name, tp->mptcp_sched_name, MPTCP_SCHED_NAME_MAX);
+		else
+			mptcp_get_default_scheduler(name);
+		if (copy_to_user(optval, name, len))
+			return -EFAULT;
+		return 0;
+	}
+#endif
 
 	case TCP_COOKIE_TRANSACTIONS: {
 		struct tcp_cookie_transactions ctd;
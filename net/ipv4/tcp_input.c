@@ -930,6 +930,9 @@ reset:
 		tp->snd_cwnd = 1;
 	else
 		tp->snd_cwnd = tcp_init_cwnd(tp, dst);
+
+	if (tp->mpc)
+		mptcp_peer_init_metrics(sk);
 	tp->snd_cwnd_stamp = tcp_time_stamp;
 }
 
@@ -1474,6 +1477,13 @@ static struct sk_buff *tcp_shift_skb_data(struct sock *sk, struct sk_buff *skb,
 	if (!sk_can_gso(sk))
 		goto fallback;
 
+	/* Each subflow-segment carries its own DSS-mapping in the
+	 * tcp_skb_cb, which would get lost when shifting it into another
+	 * segment.
+	 */
+	if (tp->mpc)
+		goto fallback;
+
 	/* Normally R but no L won't result in plain S */
 	if (!dup_sack &&
 	    (TCP_SKB_CB(skb)->sacked & (TCPCB_LOST|TCPCB_SACKED_RETRANS)) == TCPCB_SACKED_RETRANS)
@@ -3729,6 +3739,9 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	if (tp->mpc)
+		mptcp_cc_agg_update(sk);
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(__sk_dst_get(sk));
 
@@ -4835,7 +4848,7 @@ static int tcp_prune_ofo_queue(struct sock *sk)
 	int res = 0;
 
 	if (is_meta_sk(sk)) {
-		if (!skb_queue_empty(&tp->out_of_order_queue)) {
+		if (!mptcp_ofo_queue_empty(tp)) {
 			NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_OFOPRUNED);
 			mptcp_purge_ofo_queue(tp);
 
@@ -5669,6 +5682,8 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 					(u32 *)hash_mac_check);
 			if (memcmp(hash_mac_check,
 				   (char *)&tp->rx_opt.mptcp_recv_tmac, 8)) {
+				NET_INC_STATS_BH(sock_net(sk),
+						 LINUX_MIB_MPTCPJOINSYNACKMAC);
 				sock_orphan(sk);
 				tp->mptcp->teardown = 1;
 				goto reset_and_undo;
@@ -5706,6 +5721,9 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 			 /* hold in mptcp_inherit_sk due to initialization to 2 */
 			sock_put(sk);
 		} else {
+			if (tp->request_mptcp)
+				NET_INC_STATS_BH(sock_net(sk),
+						 LINUX_MIB_MPTCPFALLBACKSYNACK);
 			tp->request_mptcp = 0;
 
 			if (tp->inside_tk_table)
@@ -1647,6 +1647,9 @@ static __sum16 tcp_v4_checksum_init(struct sk_buff *skb)
 		if (!tcp_v4_check(skb->len, iph->saddr,
 				  iph->daddr, skb->csum)) {
 			skb->ip_summed = CHECKSUM_UNNECESSARY;
+#ifdef CONFIG_MPTCP
+			TCP_SKB_CB(skb)->csum_complete = 1;
+#endif
 			return 0;
 		}
 	}
@@ -1769,6 +1772,9 @@ int tcp_v4_rcv(struct sk_buff *skb)
 	 * Packet length and doff are validated by header prediction,
 	 * provided case of th->doff==0 is eliminated.
 	 * So, we defer the checks. */
+#ifdef CONFIG_MPTCP
+	TCP_SKB_CB(skb)->csum_complete = 0;
+#endif
 	if (!skb_csum_unnecessary(skb) && tcp_v4_checksum_init(skb))
 		goto bad_packet;
 
@@ -2090,7 +2096,7 @@ void tcp_v4_destroy_sock(struct sock *sk)
 		/* Cleanup up the write buffer. */
 		tcp_write_queue_purge(sk);
 
-		__skb_queue_purge(&tp->mpcb->reinject_queue);
+		mptcp_purge_reinject_queue(tp);
 		mptcp_purge_ofo_queue(tp);
 	} else {
 		/* mptcp_del_sock MUST be before tcp_write_queue_purge because
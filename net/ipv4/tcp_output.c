@@ -837,27 +837,10 @@ int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 	tp = tcp_sk(sk);
 
 	if (likely(clone_it)) {
-		if (unlikely((!tp->mpc && skb_cloned(skb)) || mptcp_skb_cloned(skb, tp))) {
-			struct sk_buff *newskb;
-			if (mptcp_is_data_seq(skb))
-				skb_push(skb, MPTCP_SUB_LEN_DSS_ALIGN +
-					      MPTCP_SUB_LEN_ACK_ALIGN +
-					      MPTCP_SUB_LEN_SEQ_ALIGN);
-
-			newskb = pskb_copy(skb, gfp_mask);
-
-			if (mptcp_is_data_seq(skb)) {
-				skb_pull(skb, MPTCP_SUB_LEN_DSS_ALIGN +
-					      MPTCP_SUB_LEN_ACK_ALIGN +
-					      MPTCP_SUB_LEN_SEQ_ALIGN);
-				skb_pull(newskb, MPTCP_SUB_LEN_DSS_ALIGN +
-					      MPTCP_SUB_LEN_ACK_ALIGN +
-					      MPTCP_SUB_LEN_SEQ_ALIGN);
-			}
-			skb = newskb;
-		} else {
+		if (unlikely((!tp->mpc && skb_cloned(skb)) || mptcp_skb_cloned(skb, tp)))
+			skb = pskb_copy(skb, gfp_mask);
+		else
 			skb = skb_clone(skb, gfp_mask);
-		}
 		if (unlikely(!skb))
 			return -ENOBUFS;
 	}
@@ -939,6 +922,8 @@ int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 		TCP_ADD_STATS(sock_net(sk), TCP_MIB_OUTSEGS,
 			      tcp_skb_pcount(skb));
 
+	mptcp_skb_clear_dss_map(tp, skb);
+
 	err = icsk->icsk_af_ops->queue_xmit(skb, &inet->cork.fl);
 	if (likely(err <= 0))
 		return err;
@@ -966,8 +951,8 @@ void tcp_queue_skb(struct sock *sk, struct sk_buff *skb)
 }
 
 /* Initialize TSO segments for a packet. */
-static void tcp_set_skb_tso_segs(struct sock *sk, struct sk_buff *skb,
-				 unsigned int mss_now)
+void tcp_set_skb_tso_segs(struct sock *sk, struct sk_buff *skb,
+			  unsigned int mss_now)
 {
 	if (skb->len <= mss_now || !sk_can_gso(sk) ||
 	    skb->ip_summed == CHECKSUM_NONE) {
@@ -1077,7 +1062,7 @@ int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len,
 	TCP_SKB_CB(buff)->flags = flags;
 	TCP_SKB_CB(buff)->sacked = TCP_SKB_CB(skb)->sacked;
 	if (tp->mpc)
-		mptcp_fragment(skb, buff);
+		mptcp_fragment(sk, skb, buff);
 
 	if (!skb_shinfo(skb)->nr_frags && skb->ip_summed != CHECKSUM_PARTIAL) {
 		/* Copy and checksum data tail into the new buffer. */
@@ -1088,6 +1073,10 @@ int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len,
 		skb_trim(skb, len);
 
 		skb->csum = csum_block_sub(skb->csum, buff->csum, len);
+	} else if (is_meta_sk(sk) && skb->ip_summed == CHECKSUM_NONE) {
+		/* The DSS-checksum relies on skb->csum */
+		skb_split(skb, buff, len);
+		mptcp_split_csum(skb, buff, len);
 	} else {
 		skb->ip_summed = CHECKSUM_PARTIAL;
 		skb_split(skb, buff, len);
@@ -1299,9 +1288,8 @@ unsigned int tcp_current_mss(struct sock *sk)
 	struct tcp_out_options opts;
 	struct tcp_md5sig_key *md5;
 
-	/* if sk is the meta-socket, return the common MSS */
-	if (tp->mpc)
-		return mptcp_sysctl_mss();
+	if (is_meta_sk(sk))
+		return mptcp_current_mss(sk);
 
 	mss_now = tp->mss_cache;
 
@@ -1549,13 +1537,20 @@ int tso_fragment(struct sock *sk, struct sk_buff *skb, unsigned int len,
 	TCP_SKB_CB(skb)->flags = flags & ~(TCPHDR_FIN | TCPHDR_PSH);
 	TCP_SKB_CB(buff)->flags = flags;
 	if (tcp_sk(sk)->mpc)
-		mptcp_fragment(skb, buff);
+		mptcp_fragment(sk, skb, buff);
 
 	/* This packet was never sent out yet, so no SACK bits. */
 	TCP_SKB_CB(buff)->sacked = 0;
 
-	buff->ip_summed = skb->ip_summed = CHECKSUM_PARTIAL;
-	skb_split(skb, buff, len);
+	if (is_meta_sk(sk) && skb->ip_summed == CHECKSUM_NONE) {
+		/* The DSS-checksum relies on skb->csum */
+		buff->ip_summed = CHECKSUM_NONE;
+		skb_split(skb, buff, len);
+		mptcp_split_csum(skb, buff, len);
+	} else {
+		buff->ip_summed = skb->ip_summed = CHECKSUM_PARTIAL;
+		skb_split(skb, buff, len);
+	}
 
 	/* Fix up tso_factor for both original and new SKB.  */
 	tcp_set_skb_tso_segs(sk, skb, mss_now);
@@ -1796,7 +1791,10 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 
 	sent_pkts = 0;
 
-	if (!push_one) {
+	/* On MPTCP-subflows, the probe would merge segments with different
+	 * DSS-mappings. MTU-probing is done in mptcp_write_xmit instead.
+	 */
+	if (!push_one && !tp->mpc) {
 		/* Do MTU probing. */
 		result = tcp_mtu_probe(sk);
 		if (!result) {
@@ -2497,10 +2495,7 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 
 	skb_dst_set(skb, dst_clone(dst));
 
-	if (mptcp_req_sk_saw_mpc(req))
-		mss = mptcp_sysctl_mss();
-	else
-		mss = dst_metric_advmss(dst);
+	mss = dst_metric_advmss(dst);
 
 	if (tp->rx_opt.user_mss && tp->rx_opt.user_mss < mss)
 		mss = tp->rx_opt.user_mss;
@@ -2516,7 +2511,7 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 			req->window_clamp = tcp_full_space(sk);
 
 		tcp_select_initial_window(tcp_full_space(sk),
-			mss - (ireq->tstamp_ok && !mptcp_req_sk_saw_mpc(req) ? TCPOLEN_TSTAMP_ALIGNED : 0),
+			mss - (ireq->tstamp_ok ? TCPOLEN_TSTAMP_ALIGNED : 0),
 			&req->rcv_wnd,
 			&req->window_clamp,
 			ireq->wscale_ok,
@@ -2635,10 +2630,7 @@ static void tcp_connect_init(struct sock *sk)
 	if (!tp->window_clamp)
 		tp->window_clamp = dst_metric(dst, RTAX_WINDOW);
 
-	if (mptcp_doit(sk))
-		tp->advmss = mptcp_sysctl_mss();
-	else
-		tp->advmss = dst_metric_advmss(dst);
+	tp->advmss = dst_metric_advmss(dst);
 
 	if (tp->rx_opt.user_mss && tp->rx_opt.user_mss < tp->advmss)
 		tp->advmss = tp->rx_opt.user_mss;
@@ -1625,6 +1625,9 @@ static __sum16 tcp_v6_checksum_init(struct sk_buff *skb)
 		if (!tcp_v6_check(skb->len, &ipv6_hdr(skb)->saddr,
 				  &ipv6_hdr(skb)->daddr, skb->csum)) {
 			skb->ip_summed = CHECKSUM_UNNECESSARY;
+#ifdef CONFIG_MPTCP
+			TCP_SKB_CB(skb)->csum_complete = 1;
+#endif
 			return 0;
 		}
 	}
@@ -1801,6 +1804,9 @@ static int tcp_v6_rcv(struct sk_buff *skb)
 	if (!pskb_may_pull(skb, th->doff*4))
 		goto discard_it;
 
+#ifdef CONFIG_MPTCP
+	TCP_SKB_CB(skb)->csum_complete = 0;
+#endif
 	if (!skb_csum_unnecessary(skb) && tcp_v6_checksum_init(skb))
 		goto bad_packet;
 
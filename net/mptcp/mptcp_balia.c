@@ -0,0 +1,169 @@
+/*
+ * MPTCP implementation - BALANCED LINKED ADAPTATION CONGESTION CONTROL:
+ *
+ * Algorithm design:
+ * Qiuyu Peng, Anwar Walid, Jaehyun Hwang, Steven H. Low
+ * "Multipath TCP: Analysis, Design and Implementation"
+ *
+ * With x_r = cwnd_r / rtt_r the rate of subflow r and
+ * alpha_r = max_k(x_k) / x_r, each ACK on subflow r increases its window by
+ *
+ *	x_r / (rtt_r * (sum_k x_k)^2) * (1 + alpha_r) / 2 * (4 + alpha_r) / 5
+ *
+ * and a loss decreases it by cwnd_r / 2 * min(alpha_r, 1.5). The rates come
+ * from the congestion-aggregate of the mpcb (see mptcp_cc_agg_update).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <net/tcp.h>
+#include <net/mptcp.h>
+
+#include <linux/module.h>
+
+static int scale = 10;
+
+struct mptcp_balia {
+	u32	ai_cnt;	/* Accumulated increase, scaled by scale */
+};
+
+static inline u64 mptcp_balia_scale(u64 val, int scale)
+{
+	return val << scale;
+}
+
+/* alpha_r = max_k(x_k) / x_r, scaled */
+static u64 mptcp_balia_alpha(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	return div64_u64(mptcp_balia_scale(tp->mpcb->cc_agg.max_rate, scale),
+			 tp->mptcp->cc_rate);
+}
+
+/* The increase of the window for one ACK, scaled */
+static u32 mptcp_balia_ai(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct mptcp_cc_agg *agg = &tp->mpcb->cc_agg;
+	u64 alpha, share, wnd, num;
+
+	alpha = mptcp_balia_alpha(sk);
+
+	/* x_r / sum_k(x_k) */
+	share = div64_u64(mptcp_balia_scale(tp->mptcp->cc_rate, scale),
+			  agg->sum_rate);
+
+	/* rtt_r * sum_k(x_k) = sum_k(cwnd_k * rtt_r / rtt_k) */
+	wnd = (agg->sum_rate * tp->mptcp->cc_srtt) >>
+	      (MPTCP_CC_AGG_SCALE - scale);
+	if (unlikely(!wnd))
+		return 0;
+
+	/* (1 + alpha) * (4 + alpha) / 10 */
+	num = share * div_u64((mptcp_balia_scale(1, scale) + alpha) *
+			      (mptcp_balia_scale(4, scale) + alpha),
+			      mptcp_balia_scale(10, scale));
+
+	return (u32)min_t(u64, div64_u64(num, wnd),
+			  mptcp_balia_scale(1, scale));
+}
+
+static void mptcp_balia_init(struct sock *sk)
+{
+	struct mptcp_balia *ca = inet_csk_ca(sk);
+
+	ca->ai_cnt = 0;
+}
+
+static u32 mptcp_balia_ssthresh(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u64 alpha;
+
+	if (!tp->mpc || tp->mpcb->cnt_established <= 1)
+		return tcp_reno_ssthresh(sk);
+
+	/* Not (yet) part of the aggregate */
+	mptcp_cc_agg_update(sk);
+	if (!tp->mptcp->cc_rate)
+		return tcp_reno_ssthresh(sk);
+
+	/* cwnd - cwnd / 2 * min(alpha, 1.5) */
+	alpha = min_t(u64, mptcp_balia_alpha(sk), 3 << (scale - 1));
+
+	return max(tp->snd_cwnd -
+		   (u32)(((u64)tp->snd_cwnd * alpha) >> (scale + 1)), 2U);
+}
+
+static void mptcp_balia_cong_avoid(struct sock *sk, u32 ack, u32 in_flight)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_balia *ca = inet_csk_ca(sk);
+
+	if (!tp->mpc || tp->mpcb->cnt_established <= 1) {
+		tcp_reno_cong_avoid(sk, ack, in_flight);
+		return;
+	}
+
+	if (!tcp_is_cwnd_limited(sk, in_flight))
+		return;
+
+	/* slow start if it is in the safe area */
+	if (tp->snd_cwnd <= tp->snd_ssthresh) {
+		tcp_slow_start(tp);
+		return;
+	}
+
+	mptcp_cc_agg_update(sk);
+	if (!tp->mptcp->cc_rate) {
+		tcp_cong_avoid_ai(tp, tp->snd_cwnd);
+		return;
+	}
+
+	if (sysctl_tcp_abc) {
+		if (tp->bytes_acked >= tp->snd_cwnd * tp->mss_cache) {
+			tp->bytes_acked -= tp->snd_cwnd * tp->mss_cache;
+			if (tp->snd_cwnd < tp->snd_cwnd_clamp)
+				tp->snd_cwnd++;
+		}
+		return;
+	}
+
+	ca->ai_cnt += mptcp_balia_ai(sk);
+	if (ca->ai_cnt >= (1 << scale)) {
+		if (tp->snd_cwnd < tp->snd_cwnd_clamp)
+			tp->snd_cwnd++;
+		ca->ai_cnt -= 1 << scale;
+	}
+}
+
+static struct tcp_congestion_ops mptcp_balia = {
+	.init		= mptcp_balia_init,
+	.ssthresh	= mptcp_balia_ssthresh,
+	.cong_avoid	= mptcp_balia_cong_avoid,
+	.min_cwnd	= tcp_reno_min_cwnd,
+	.owner		= THIS_MODULE,
+	.name		= "balia",
+};
+
+static int __init mptcp_balia_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct mptcp_balia) > ICSK_CA_PRIV_SIZE);
+	return tcp_register_congestion_control(&mptcp_balia);
+}
+
+static void __exit mptcp_balia_unregister(void)
+{
+	tcp_unregister_congestion_control(&mptcp_balia);
+}
+
+module_init(mptcp_balia_register);
+module_exit(mptcp_balia_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("MPTCP BALIA CONGESTION CONTROL");
+MODULE_VERSION("0.1");
@@ -47,11 +47,6 @@ struct mptcp_ccc {
 	bool	forced_update;
 };
 
-static inline int mptcp_ccc_sk_can_send(const struct sock *sk)
-{
-	return mptcp_sk_can_send(sk) && tcp_sk(sk)->srtt;
-}
-
 static inline u64 mptcp_get_alpha(struct sock *meta_sk)
 {
 	struct mptcp_ccc *mptcp_ccc = inet_csk_ca(meta_sk);
@@ -81,12 +76,14 @@ static inline void mptcp_set_forced(struct sock *meta_sk, bool force)
 	mptcp_ccc->forced_update = force;
 }
 
+/* alpha = best_cwnd / best_rtt^2 / (sum(cwnd_i / rtt_i))^2, see RFC6356.
+ * The aggregate of the subflows is maintained by mptcp_cc_agg_update.
+ */
 static void mptcp_recalc_alpha(struct sock *sk)
 {
 	struct mptcp_cb *mpcb = tcp_sk(sk)->mpcb;
-	struct sock *sub_sk;
-	int best_cwnd = 0, best_rtt = 0, can_send = 0;
-	u64 max_numerator = 0, sum_denominator = 0, alpha = 1;
+	const struct mptcp_cc_agg *agg;
+	u64 sum_denominator, alpha = 1;
 
 	if (!mpcb)
 		return;
@@ -96,62 +93,22 @@ static void mptcp_recalc_alpha(struct sock *sk)
 	if (mpcb->cnt_subflows <= 1)
 		goto exit;
 
-	/* Do regular alpha-calculation for multiple subflows */
-
-	/* Find the max numerator of the alpha-calculation */
-	mptcp_for_each_sk(mpcb, sub_sk) {
-		struct tcp_sock *sub_tp = tcp_sk(sub_sk);
-		u64 tmp;
-
-		if (!mptcp_ccc_sk_can_send(sub_sk))
-			continue;
-
-		can_send++;
-
-		/* We need to look for the path, that provides the max-value.
-		 * Integer-overflow is not possible here, because
-		 * tmp will be in u64.
-		 */
-		tmp = div64_u64(mptcp_ccc_scale(sub_tp->snd_cwnd,
-				alpha_scale_num), sub_tp->srtt * sub_tp->srtt);
-
-		if (tmp >= max_numerator) {
-			max_numerator = tmp;
-			best_cwnd = sub_tp->snd_cwnd;
-			best_rtt = sub_tp->srtt;
-		}
-	}
+	mptcp_cc_agg_update(sk);
+	agg = &mpcb->cc_agg;
 
 	/* No subflow is able to send - we don't care anymore */
-	if (unlikely(!can_send))
+	if (unlikely(!agg->best_pi))
 		goto exit;
 
-	/* Calculate the denominator */
-	mptcp_for_each_sk(mpcb, sub_sk) {
-		struct tcp_sock *sub_tp = tcp_sk(sub_sk);
-
-		if (!mptcp_ccc_sk_can_send(sub_sk))
-			continue;
-
-		sum_denominator += div_u64(
-				mptcp_ccc_scale(sub_tp->snd_cwnd,
-						alpha_scale_den) * best_rtt,
-						sub_tp->srtt);
-	}
+	/* sum(cwnd_i * best_rtt / rtt_i), scaled by alpha_scale_den */
+	sum_denominator = (agg->sum_rate * agg->best_srtt) >>
+			  (MPTCP_CC_AGG_SCALE - alpha_scale_den);
 	sum_denominator *= sum_denominator;
-	if (unlikely(!sum_denominator)) {
-		printk(KERN_ERR"%s: sum_denominator == 0, cnt_established:%d\n",
-				__func__, mpcb->cnt_subflows);
-		mptcp_for_each_sk(mpcb, sub_sk) {
-			struct tcp_sock *sub_tp = tcp_sk(sub_sk);
-			printk(KERN_ERR"%s: pi:%d, state:%d\n, rtt:%u, cwnd: %u",
-					__func__, sub_tp->mptcp->path_index,
-					sub_sk->sk_state, sub_tp->srtt,
-					sub_tp->snd_cwnd);
-		}
-	}
+	if (unlikely(!sum_denominator))
+		goto exit;
 
-	alpha = div64_u64(mptcp_ccc_scale(best_cwnd, alpha_scale_num), sum_denominator);
+	alpha = div64_u64(mptcp_ccc_scale(agg->best_cwnd, alpha_scale_num),
+			  sum_denominator);
 
 	if (unlikely(!alpha))
 		alpha = 1;
@@ -43,8 +43,10 @@
 #include <net/xfrm.h>
 
 #include <linux/kconfig.h>
+#include <linux/mptcp.h>
 #include <linux/module.h>
 #include <linux/list.h>
+#include <linux/inet_diag.h>
 #include <linux/jhash.h>
 #include <linux/tcp.h>
 #include <linux/net.h>
@@ -60,23 +62,46 @@
 static struct kmem_cache *mptcp_sock_cache __read_mostly;
 static struct kmem_cache *mptcp_cb_cache __read_mostly;
 
-int sysctl_mptcp_mss __read_mostly = MPTCP_MSS;
 int sysctl_mptcp_ndiffports __read_mostly = 1;
 int sysctl_mptcp_enabled __read_mostly = 1;
 int sysctl_mptcp_checksum __read_mostly = 1;
 int sysctl_mptcp_debug __read_mostly = 0;
 int sysctl_mptcp_syn_retries __read_mostly = MPTCP_SYN_RETRIES;
+int sysctl_mptcp_userspace_pm __read_mostly = 0;
+int sysctl_mptcp_ecmp_paths __read_mostly = 0;
+int sysctl_mptcp_ecmp_hash __read_mostly = MPTCP_ECMP_HASH_XOR;
+int sysctl_mptcp_ecmp_seed __read_mostly = 0;
+int sysctl_mptcp_rbuf_opti __read_mostly = 1;
+int sysctl_mptcp_rbuf_rtt_ratio __read_mostly = 4;
+int sysctl_mptcp_rbuf_depth __read_mostly = 4;
 EXPORT_SYMBOL(sysctl_mptcp_debug);
 
 #ifdef CONFIG_SYSCTL
+static int zero;
+static int one = 1;
+static int mptcp_ecmp_max_paths = MPTCP_ECMP_MAX_PATHS;
+static int mptcp_ecmp_max_hash = MPTCP_ECMP_HASH_JHASH;
+
+static int proc_mptcp_scheduler(ctl_table *ctl, int write,
+				void __user *buffer, size_t *lenp,
+				loff_t *ppos)
+{
+	char val[MPTCP_SCHED_NAME_MAX];
+	ctl_table tbl = {
+		.data = val,
+		.maxlen = MPTCP_SCHED_NAME_MAX,
+	};
+	int ret;
+
+	mptcp_get_default_scheduler(val);
+
+	ret = proc_dostring(&tbl, write, buffer, lenp, ppos);
+	if (write && ret == 0)
+		ret = mptcp_set_default_scheduler(val);
+	return ret;
+}
+
 static ctl_table mptcp_skeleton[] = {
-	{
-		.procname = "mptcp_mss",
-		.data = &sysctl_mptcp_mss,
-		.maxlen = sizeof(int),
-		.mode = 0644,
-		.proc_handler = &proc_dointvec
-	},
 	{
 		.procname = "mptcp_ndiffports",
 		.data = &sysctl_mptcp_ndiffports,
@@ -112,6 +137,69 @@ static ctl_table mptcp_skeleton[] = {
 		.mode = 0644,
 		.proc_handler = &proc_dointvec
 	},
+	{
+		.procname = "mptcp_scheduler",
+		.mode = 0644,
+		.maxlen = MPTCP_SCHED_NAME_MAX,
+		.proc_handler = proc_mptcp_scheduler,
+	},
+	{
+		.procname = "mptcp_userspace_pm",
+		.data = &sysctl_mptcp_userspace_pm,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec
+	},
+	{
+		.procname = "mptcp_ecmp_paths",
+		.data = &sysctl_mptcp_ecmp_paths,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec_minmax,
+		.extra1 = &zero,
+		.extra2 = &mptcp_ecmp_max_paths,
+	},
+	{
+		.procname = "mptcp_ecmp_hash",
+		.data = &sysctl_mptcp_ecmp_hash,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec_minmax,
+		.extra1 = &zero,
+		.extra2 = &mptcp_ecmp_max_hash,
+	},
+	{
+		.procname = "mptcp_ecmp_seed",
+		.data = &sysctl_mptcp_ecmp_seed,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec
+	},
+	{
+		.procname = "mptcp_rbuf_opti",
+		.data = &sysctl_mptcp_rbuf_opti,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec_minmax,
+		.extra1 = &zero,
+		.extra2 = &one,
+	},
+	{
+		.procname = "mptcp_rbuf_rtt_ratio",
+		.data = &sysctl_mptcp_rbuf_rtt_ratio,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec_minmax,
+		.extra1 = &one,
+	},
+	{
+		.procname = "mptcp_rbuf_depth",
+		.data = &sysctl_mptcp_rbuf_depth,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = &proc_dointvec_minmax,
+		.extra1 = &one,
+	},
 	{ }
 };
 
@@ -218,6 +306,25 @@ void mptcp_sock_def_error_report(struct sock *sk)
 	return;
 }
 
+/* Fills the INET_DIAG_MPTCPINFO-attribute of the subflow @sk */
+void mptcp_diag_get_info(const struct sock *sk, struct mptcp_diag_info *info)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct mptcp_cb *mpcb = tp->mpcb;
+
+	memset(info, 0, sizeof(*info));
+
+	info->mptcpi_token = mpcb->mptcp_loc_token;
+	info->mptcpi_path_index = tp->mptcp->path_index;
+	info->mptcpi_subflows = mpcb->cnt_subflows;
+	info->mptcpi_fallback = mpcb->infinite_mapping;
+	info->mptcpi_srtt = jiffies_to_usecs(tp->srtt) >> 3;
+	info->mptcpi_snd_cwnd = tp->snd_cwnd;
+	info->mptcpi_bytes_sched = tp->mptcp->bytes_sched;
+	info->mptcpi_bytes_reinjected = tp->mptcp->bytes_reinjected;
+}
+EXPORT_SYMBOL(mptcp_diag_get_info);
+
 void mptcp_set_keepalive(struct sock *sk, int val)
 {
 	struct sock *sk_it;
@@ -637,9 +744,6 @@ int mptcp_alloc_mpcb(struct sock *meta_sk, __u64 remote_key, u32 window)
 	meta_tp->mptcp->snt_isn = meta_tp->write_seq; /* Initial data-sequence-number */
 	meta_icsk->icsk_probes_out = 0;
 
-	meta_tp->mss_cache = mptcp_sysctl_mss();
-	meta_tp->advmss = mptcp_sysctl_mss();
-
 	/* Set mptcp-pointers */
 	master_tp->mpcb = mpcb;
 	master_tp->meta_sk = meta_sk;
@@ -653,7 +757,7 @@ int mptcp_alloc_mpcb(struct sock *meta_sk, __u64 remote_key, u32 window)
 	meta_tp->was_meta_sk = 0;
 
 	/* Initialize the queues */
-	skb_queue_head_init(&mpcb->reinject_queue);
+	mpcb->reinject_tree = RB_ROOT;
 	skb_queue_head_init(&master_tp->out_of_order_queue);
 	tcp_prequeue_init(master_tp);
 
@@ -675,11 +779,6 @@ int mptcp_alloc_mpcb(struct sock *meta_sk, __u64 remote_key, u32 window)
 
 	mutex_init(&mpcb->mutex);
 
-	/* Initialize workqueue-struct */
-	INIT_WORK(&mpcb->subflow_work, mptcp_create_subflow_worker);
-	INIT_DELAYED_WORK(&mpcb->subflow_retry_work, mptcp_retry_subflow_worker);
-	INIT_WORK(&mpcb->address_work, mptcp_address_worker);
-
 	/* Init the accept_queue structure, we support a queue of 32 pending
 	 * connections, it does not need to be huge, since we only store  here
 	 * pending subflow creations.
@@ -693,6 +792,8 @@ int mptcp_alloc_mpcb(struct sock *meta_sk, __u64 remote_key, u32 window)
 		return -ENOMEM;
 	}
 
+	mptcp_init_scheduler(mpcb);
+
 	/* Redefine function-pointers as the meta-sk is now fully ready */
 	meta_sk->sk_backlog_rcv = mptcp_backlog_rcv;
 	meta_sk->sk_destruct = mptcp_sock_destruct;
@@ -707,13 +808,7 @@ int mptcp_alloc_mpcb(struct sock *meta_sk, __u64 remote_key, u32 window)
 
 	if (!meta_tp->inside_tk_table) {
 		/* Adding the meta_tp in the token hashtable - coming from server-side */
-		rcu_read_lock();
-		spin_lock(&mptcp_tk_hashlock);
-
-		__mptcp_hash_insert(meta_tp, mpcb->mptcp_loc_token);
-
-		spin_unlock(&mptcp_tk_hashlock);
-		rcu_read_unlock();
+		mptcp_hash_insert(meta_tp, mpcb->mptcp_loc_token);
 	}
 	master_tp->inside_tk_table = 0;
 
@@ -722,6 +817,8 @@ int mptcp_alloc_mpcb(struct sock *meta_sk, __u64 remote_key, u32 window)
 	mptcp_debug("%s: created mpcb with token %#x\n",
 		    __func__, mpcb->mptcp_loc_token);
 
+	mptcp_nl_conn_event(meta_sk, MPTCP_EVENT_CREATED);
+
 	return 0;
 }
 
@@ -764,6 +861,8 @@ void mptcp_destroy_meta_sk(struct sock *meta_sk)
 {
 	kfree(inet_csk(meta_sk)->icsk_accept_queue.listen_opt);
 	kmem_cache_free(mptcp_sock_cache, tcp_sk(meta_sk)->mptcp);
+	mptcp_free_addr_tables(tcp_sk(meta_sk)->mpcb);
+	kfree(tcp_sk(meta_sk)->mpcb->pm_work);
 	kmem_cache_free(mptcp_cb_cache, tcp_sk(meta_sk)->mpcb);
 	bh_unlock_sock(meta_sk);
 	sk_free(meta_sk);
@@ -780,6 +879,13 @@ void mptcp_sock_destruct(struct sock *sk)
 		/* Taken when mpcb pointer was set */
 		sock_put(mptcp_meta_sk(sk));
 	} else {
+		mptcp_nl_conn_event(sk, MPTCP_EVENT_CLOSED);
+		mptcp_cleanup_scheduler(tcp_sk(sk)->mpcb);
+		if (!tcp_sk(sk)->mpcb->server_side)
+			mptcp_peer_save_addrs(sk);
+		mptcp_free_addr_tables(tcp_sk(sk)->mpcb);
+		/* The workers hold a reference while pending */
+		kfree(tcp_sk(sk)->mpcb->pm_work);
 		kmem_cache_free(mptcp_cb_cache, tcp_sk(sk)->mpcb);
 
 		mptcp_debug("%s destroying meta-sk\n", __func__);
@@ -857,6 +963,28 @@ int mptcp_add_sock(struct sock *meta_sk, struct sock *sk, u8 rem_id, gfp_t flags
 	return 0;
 }
 
+/* The path-index of sk may be handed to a new subflow. Thus, it must be
+ * removed from the path_mask of the segments sent on sk. Otherwise, the
+ * new subflow would skip them as if it had already sent them.
+ */
+static void mptcp_release_pathindex(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_cb *mpcb = tp->mpcb;
+	struct sock *meta_sk = mptcp_meta_sk(sk);
+	u64 flag = mptcp_pi_to_flag(tp->mptcp->path_index);
+	struct sk_buff *skb;
+
+	tcp_for_write_queue(skb, meta_sk) {
+		if (skb == tcp_send_head(meta_sk))
+			break;
+		TCP_SKB_CB(skb)->path_mask &= ~flag;
+	}
+	mptcp_reinject_queue_clear_pi(mpcb, tp->mptcp->path_index);
+
+	mpcb->path_index_bits &= ~flag;
+}
+
 void mptcp_del_sock(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk), *tp_prev;
@@ -873,6 +1001,9 @@ void mptcp_del_sock(struct sock *sk)
 	mpcb = tp->mpcb;
 	tp_prev = mpcb->connection_list;
 
+	if (!mpcb->server_side)
+		mptcp_peer_save_path(sk);
+
 	mptcp_debug("%s: Removing subsock tok %#x pi:%d state %d is_meta? %d\n",
 		    __func__, mpcb->mptcp_loc_token, tp->mptcp->path_index,
 		    sk->sk_state, is_meta_sk(sk));
@@ -892,11 +1023,13 @@ void mptcp_del_sock(struct sock *sk)
 
 	tp->mptcp->next = NULL;
 	tp->mptcp->attached = 0;
-	mpcb->path_index_bits &= ~(1 << tp->mptcp->path_index);
+	mptcp_cc_agg_update(sk);
 
 	if (!skb_queue_empty(&sk->sk_write_queue))
 		mptcp_reinject_data(sk, 0);
 
+	mptcp_release_pathindex(sk);
+
 	if (is_master_tp(tp))
 		mpcb->master_sk = NULL;
 	else
@@ -905,6 +1038,190 @@ void mptcp_del_sock(struct sock *sk)
 	rcu_assign_pointer(inet_sk(sk)->inet_opt, NULL);
 }
 
+/* In TCP_CA_Recovery, snd_cwnd is artificially inflated (see RFC5681) */
+static inline u32 mptcp_cc_agg_cwnd(const struct sock *sk)
+{
+	if (inet_csk(sk)->icsk_ca_state == TCP_CA_Recovery)
+		return tcp_sk(sk)->snd_ssthresh;
+	return tcp_sk(sk)->snd_cwnd;
+}
+
+/* Is cwnd_a / srtt_a^2 >= cwnd_b / srtt_b^2 ? */
+static inline int mptcp_cc_agg_better(u32 cwnd_a, u32 srtt_a,
+				      u32 cwnd_b, u32 srtt_b)
+{
+	return (u64)cwnd_a * srtt_b * srtt_b >= (u64)cwnd_b * srtt_a * srtt_a;
+}
+
+/* The subflow with the largest rate, cwnd or cwnd/srtt^2 went away */
+static void mptcp_cc_agg_rescan(struct mptcp_cb *mpcb)
+{
+	struct mptcp_cc_agg *agg = &mpcb->cc_agg;
+	struct sock *sk;
+
+	agg->max_rate = 0;
+	agg->max_rate_pi = 0;
+	agg->max_cwnd = 0;
+	agg->cnt_max = 0;
+	agg->best_pi = 0;
+
+	mptcp_for_each_sk(mpcb, sk) {
+		struct mptcp_tcp_sock *mptcp = tcp_sk(sk)->mptcp;
+
+		if (!mptcp->cc_counted)
+			continue;
+
+		if (mptcp->cc_rate > agg->max_rate) {
+			agg->max_rate = mptcp->cc_rate;
+			agg->max_rate_pi = mptcp->path_index;
+		}
+
+		if (mptcp->cc_cwnd > agg->max_cwnd) {
+			agg->max_cwnd = mptcp->cc_cwnd;
+			agg->cnt_max = 1;
+		} else if (mptcp->cc_cwnd == agg->max_cwnd) {
+			agg->cnt_max++;
+		}
+
+		if (!agg->best_pi ||
+		    mptcp_cc_agg_better(mptcp->cc_cwnd, mptcp->cc_srtt,
+					agg->best_cwnd, agg->best_srtt)) {
+			agg->best_pi = mptcp->path_index;
+			agg->best_cwnd = mptcp->cc_cwnd;
+			agg->best_srtt = mptcp->cc_srtt;
+		}
+	}
+}
+
+/* Called whenever the cwnd or srtt of the subflow sk may have changed (at
+ * the end of tcp_ack and by the congestion controls). Replaces the
+ * contribution of sk to the mpcb's cc_agg - in O(1), unless sk was the
+ * subflow with the largest rate, cwnd or cwnd/srtt^2 and it shrank.
+ */
+void mptcp_cc_agg_update(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_tcp_sock *mptcp = tp->mptcp;
+	struct mptcp_cc_agg *agg = &tp->mpcb->cc_agg;
+	u32 old_max = agg->max_cwnd, cwnd = 0, srtt = 0;
+	u32 old_srtt = mptcp->cc_srtt;
+	u32 old_best_cwnd = agg->best_cwnd, old_best_srtt = agg->best_srtt;
+	u8 old_cnt = agg->cnt_max, old_best_pi = agg->best_pi;
+	int counted, rescan = 0;
+
+	counted = mptcp->attached && mptcp_sk_can_send(sk) && tp->srtt;
+	if (counted) {
+		cwnd = mptcp_cc_agg_cwnd(sk);
+		srtt = tp->srtt;
+	}
+
+	if (counted == mptcp->cc_counted && cwnd == mptcp->cc_cwnd &&
+	    srtt == mptcp->cc_srtt)
+		return;
+
+	if (counted != mptcp->cc_counted || srtt != old_srtt)
+		agg->gen++;
+
+	if (mptcp->cc_counted) {
+		agg->sum_rate -= mptcp->cc_rate;
+		if (mptcp->cc_cwnd == agg->max_cwnd)
+			agg->cnt_max--;
+	}
+
+	mptcp->cc_counted = counted;
+	mptcp->cc_cwnd = cwnd;
+	mptcp->cc_srtt = srtt;
+	mptcp->cc_rate = 0;
+
+	if (counted) {
+		mptcp->cc_rate = div_u64((u64)cwnd << MPTCP_CC_AGG_SCALE, srtt);
+		agg->sum_rate += mptcp->cc_rate;
+
+		if (cwnd > agg->max_cwnd) {
+			agg->max_cwnd = cwnd;
+			agg->cnt_max = 1;
+		} else if (cwnd == agg->max_cwnd) {
+			agg->cnt_max++;
+		}
+	}
+	if (!agg->cnt_max)
+		rescan = 1;
+
+	if (mptcp->path_index == agg->max_rate_pi) {
+		if (counted && mptcp->cc_rate >= agg->max_rate)
+			agg->max_rate = mptcp->cc_rate;
+		else
+			rescan = 1;
+	} else if (counted && mptcp->cc_rate > agg->max_rate) {
+		agg->max_rate = mptcp->cc_rate;
+		agg->max_rate_pi = mptcp->path_index;
+	}
+
+	if (mptcp->path_index == agg->best_pi) {
+		if (counted && mptcp_cc_agg_better(cwnd, srtt, agg->best_cwnd,
+						   agg->best_srtt)) {
+			agg->best_cwnd = cwnd;
+			agg->best_srtt = srtt;
+		} else {
+			rescan = 1;
+		}
+	} else if (counted && (!agg->best_pi ||
+			       mptcp_cc_agg_better(cwnd, srtt, agg->best_cwnd,
+						   agg->best_srtt))) {
+		agg->best_pi = mptcp->path_index;
+		agg->best_cwnd = cwnd;
+		agg->best_srtt = srtt;
+	}
+
+	if (rescan)
+		mptcp_cc_agg_rescan(tp->mpcb);
+
+	if (agg->max_cwnd != old_max || agg->cnt_max != old_cnt ||
+	    agg->best_pi != old_best_pi || agg->best_cwnd != old_best_cwnd ||
+	    agg->best_srtt != old_best_srtt)
+		agg->gen++;
+}
+EXPORT_SYMBOL_GPL(mptcp_cc_agg_update);
+
+/* The address-tables are allocated on demand and grow by MPTCP_ADDR_CHUNK
+ * entries, up to MPTCP_MAX_ADDR. Connections with a single subflow thus
+ * only pay for a few entries.
+ *
+ * Called with the meta-lock held, the tables may move in memory.
+ */
+int __mptcp_addr_table_grow(void **table, u8 *size, int i, size_t entry_size)
+{
+	int new_size;
+	void *new;
+
+	if (i < *size)
+		return 0;
+
+	if (i >= MPTCP_MAX_ADDR)
+		return -EINVAL;
+
+	new_size = min_t(int, roundup(i + 1, MPTCP_ADDR_CHUNK), MPTCP_MAX_ADDR);
+	new = krealloc(*table, new_size * entry_size, GFP_ATOMIC);
+	if (!new)
+		return -ENOMEM;
+
+	memset(new + *size * entry_size, 0, (new_size - *size) * entry_size);
+	*table = new;
+	*size = new_size;
+
+	return 0;
+}
+
+void mptcp_free_addr_tables(struct mptcp_cb *mpcb)
+{
+	kfree(mpcb->addr4);
+	kfree(mpcb->addr6);
+	kfree(mpcb->rx_opt.addr4);
+#if IS_ENABLED(CONFIG_IPV6)
+	kfree(mpcb->rx_opt.addr6);
+#endif
+}
+
 /**
  * Updates the metasocket ULID/port data, based on the given sock.
  * The argument sock must be the sock accessible to the application.
@@ -920,6 +1237,10 @@ void mptcp_update_metasocket(struct sock *sk, struct sock *meta_sk)
 	case AF_INET6:
 		/* If the socket is v4 mapped, we continue with v4 operations */
 		if (!mptcp_v6_is_v4_mapped(sk)) {
+			if (mptcp_addr_table_grow(mpcb->addr6,
+						  mpcb->addr6_size, 0))
+				break;
+
 			ipv6_addr_copy(&mpcb->addr6[0].addr, &inet6_sk(sk)->saddr);
 			mpcb->addr6[0].id = 0;
 			mpcb->addr6[0].port = 0;
@@ -935,6 +1256,9 @@ void mptcp_update_metasocket(struct sock *sk, struct sock *meta_sk)
 		}
 #endif
 	case AF_INET:
+		if (mptcp_addr_table_grow(mpcb->addr4, mpcb->addr4_size, 0))
+			break;
+
 		mpcb->addr4[0].addr.s_addr = inet_sk(sk)->inet_saddr;
 		mpcb->addr4[0].id = 0;
 		mpcb->addr4[0].port = 0;
@@ -951,13 +1275,19 @@ void mptcp_update_metasocket(struct sock *sk, struct sock *meta_sk)
 
 	mptcp_set_addresses(meta_sk);
 
+	/* Open the subflows to the addresses the peer had announced before */
+	if (!mpcb->server_side)
+		mptcp_peer_seed_addrs(meta_sk);
+
 	switch (sk->sk_family) {
 	case AF_INET:
-		tcp_sk(sk)->mptcp->low_prio = mpcb->addr4[0].low_prio;
+		if (mpcb->loc4_bits & 1)
+			tcp_sk(sk)->mptcp->low_prio = mpcb->addr4[0].low_prio;
 		break;
 #if IS_ENABLED(CONFIG_IPV6)
 	case AF_INET6:
-		tcp_sk(sk)->mptcp->low_prio = mpcb->addr6[0].low_prio;
+		if (mpcb->loc6_bits & 1)
+			tcp_sk(sk)->mptcp->low_prio = mpcb->addr6[0].low_prio;
 		break;
 #endif
 	}
@@ -1048,7 +1378,7 @@ static int mptcp_sub_send_fin(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sk_buff *skb = tcp_write_queue_tail(sk);
-	int mss_now = mptcp_sysctl_mss();
+	int mss_now = tcp_current_mss(sk);
 
 	if (tcp_send_head(sk) != NULL) {
 		TCP_SKB_CB(skb)->flags |= TCPHDR_FIN;
@@ -1403,7 +1733,6 @@ int mptcp_create_master_sk(struct sock *meta_sk, __u64 remote_key, u32 window)
 #endif
 
 	master_tp->mptcp->init_rcv_wnd = master_tp->rcv_wnd;
-	master_tp->advmss = mptcp_sysctl_mss();
 
 	return 0;
 
@@ -1444,9 +1773,10 @@ int mptcp_check_req_master(struct sock *sk, struct sock *child,
 	child_tp->mptcp->snt_isn = tcp_rsk(req)->snt_isn;
 
 	mpcb = child_tp->mpcb;
-	if (mopt->list_rcvd)
-		memcpy(&mpcb->rx_opt, mopt, sizeof(*mopt));
-
+	/* The remote addresses are only stored once the mpcb exists (see
+	 * mptcp_parse_options), thus there are no address-tables to take over.
+	 */
+	mpcb->rx_opt.list_rcvd = mopt->list_rcvd;
 	mpcb->rx_opt.dss_csum = sysctl_mptcp_checksum || mtreq->dss_csum;
 	mpcb->rx_opt.mpcb = mpcb;
 
@@ -1490,8 +1820,10 @@ struct sock *mptcp_check_req_child(struct sock *meta_sk, struct sock *child,
 			(u8 *)&mtreq->mptcp_loc_nonce,
 			(u32 *)hash_mac_check);
 
-	if (memcmp(hash_mac_check, (char *)&rx_opt->mptcp_recv_mac, 20))
+	if (memcmp(hash_mac_check, (char *)&rx_opt->mptcp_recv_mac, 20)) {
+		NET_INC_STATS_BH(sock_net(meta_sk), LINUX_MIB_MPTCPJOINACKMAC);
 		goto teardown;
+	}
 
 	/* The child is a clone of the meta socket, we must now reset
 	 * some of the fields
@@ -1512,8 +1844,6 @@ struct sock *mptcp_check_req_child(struct sock *meta_sk, struct sock *child,
 		 */
 		goto teardown;
 
-	child_tp->advmss = mptcp_sysctl_mss();
-
 	child_tp->mptcp->slave_sk = 1;
 	child_tp->mptcp->snt_isn = tcp_rsk(req)->snt_isn;
 	child_tp->mptcp->init_rcv_wnd = req->rcv_wnd;
@@ -1554,6 +1884,8 @@ static int __init mptcp_init(void)
 	if (!mptcp_cb_cache)
 		goto mptcp_cb_cache_failed;
 
+	mptcp_seq_queue_init();
+
 	mptcp_wq = alloc_workqueue("mptcp_wq", WQ_UNBOUND | WQ_MEM_RECLAIM, 8);
 	if (!mptcp_wq)
 		goto alloc_workqueue_failed;
@@ -1562,6 +1894,10 @@ static int __init mptcp_init(void)
 	if (ret)
 		goto mptcp_pm_failed;
 
+	ret = mptcp_nl_init();
+	if (ret)
+		goto mptcp_nl_failed;
+
 #ifdef CONFIG_SYSCTL
 	mptcp_sysclt = register_sysctl_paths(mptcp_path, mptcp_skeleton);
 	if (!mptcp_sysclt) {
@@ -1574,6 +1910,8 @@ out:
 	return ret;
 
 register_sysctl_failed:
+	mptcp_nl_undo();
+mptcp_nl_failed:
 	mptcp_pm_undo();
 mptcp_pm_failed:
 	destroy_workqueue(mptcp_wq);
@@ -34,13 +34,16 @@
 #include <net/mptcp_v6.h>
 
 #include <linux/kconfig.h>
+#include <linux/mptcp.h>
 
 static inline void mptcp_become_fully_estab(struct sock *sk)
 {
 	tcp_sk(sk)->mptcp->fully_established = 1;
 
-	if (is_master_tp(tcp_sk(sk)))
+	if (is_master_tp(tcp_sk(sk))) {
+		mptcp_nl_conn_event(sk, MPTCP_EVENT_ESTABLISHED);
 		mptcp_create_subflows(mptcp_meta_sk(sk));
+	}
 }
 
 /**
@@ -49,7 +52,7 @@ static inline void mptcp_become_fully_estab(struct sock *sk)
  */
 static void mptcp_clean_rtx_queue(struct sock *meta_sk)
 {
-	struct sk_buff *skb, *tmp;
+	struct sk_buff *skb;
 	struct tcp_sock *meta_tp = tcp_sk(meta_sk);
 	struct mptcp_cb *mpcb = meta_tp->mpcb;
 	int acked = 0;
@@ -80,18 +83,13 @@ static void mptcp_clean_rtx_queue(struct sock *meta_sk)
 		}
 
 		meta_tp->packets_out -= tcp_skb_pcount(skb);
+		mptcp_sched_hint_forget(mpcb, skb);
 		sk_wmem_free_skb(meta_sk, skb);
 
 		acked = 1;
 	}
 	/* Remove acknowledged data from the reinject queue */
-	skb_queue_walk_safe(&mpcb->reinject_queue, skb, tmp) {
-		if (before(meta_tp->snd_una, TCP_SKB_CB(skb)->end_seq))
-			break;
-
-		__skb_unlink(skb, &mpcb->reinject_queue);
-		__kfree_skb(skb);
-	}
+	mptcp_clean_reinject_queue(mpcb, meta_tp->snd_una);
 
 	if (acked) {
 		tcp_rearm_rto(meta_sk);
@@ -194,6 +192,110 @@ static int mptcp_rcv_state_process(struct sock *meta_sk, struct sock *sk,
 	return 0;
 }
 
+/* Checksum of @len bytes of the payload of @skb, starting at @offset. If the
+ * NIC provided CHECKSUM_COMPLETE, skb->csum still covers the whole segment
+ * and only the TCP-header has to be removed from it.
+ */
+static __wsum mptcp_skb_payload_csum(const struct sk_buff *skb,
+				     unsigned int offset, unsigned int len)
+{
+	if (TCP_SKB_CB(skb)->csum_complete && !offset && len == skb->len &&
+	    skb->ip_summed == CHECKSUM_UNNECESSARY) {
+		const unsigned char *th = skb_transport_header(skb);
+
+		return csum_sub(skb->csum, csum_partial(th, skb->data - th, 0));
+	}
+
+	return skb_checksum(skb, offset, len, 0);
+}
+
+/* Is @skb (at least partially) covered by the current mapping? */
+static inline int mptcp_skb_in_mapping(const struct tcp_sock *tp,
+				       const struct sk_buff *skb)
+{
+	/* tp->map_data_len may be 0 in case of a data-fin */
+	if (tp->mptcp->map_data_len)
+		return after(tp->mptcp->map_subseq + tp->mptcp->map_data_len,
+			     TCP_SKB_CB(skb)->seq);
+
+	return !before(tp->mptcp->map_subseq, TCP_SKB_CB(skb)->seq);
+}
+
+/* Add the part of @skb that is covered by the mapping and not yet part of
+ * map_csum to the running DSS-checksum.
+ */
+static void mptcp_dss_csum_add(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 seq = TCP_SKB_CB(skb)->seq, end_seq = seq + skb->len;
+	u32 map_end = tp->mptcp->map_subseq + tp->mptcp->map_data_len;
+
+	/* Mapping ends in the middle of the packet - csum only these bytes */
+	if (after(end_seq, map_end))
+		end_seq = map_end;
+
+	if (after(end_seq, tp->mptcp->map_csum_seq)) {
+		unsigned int offset = 0;
+		__wsum csum;
+
+		if (before(seq, tp->mptcp->map_csum_seq))
+			offset = tp->mptcp->map_csum_seq - seq;
+
+		csum = mptcp_skb_payload_csum(skb, offset,
+					      end_seq - seq - offset);
+
+		/* After an odd number of bytes, this part starts in the middle
+		 * of a 16-bit word - csum_block_add swaps its bytes.
+		 */
+		tp->mptcp->map_csum = csum_block_add(tp->mptcp->map_csum, csum,
+					tp->mptcp->map_csum_seq - tp->mptcp->map_subseq);
+		tp->mptcp->map_csum_seq = end_seq;
+	}
+
+	if (mptcp_is_data_seq(skb) && !tp->mptcp->map_csum_dss) {
+		__be32 data_seq = htonl((u32)(tp->mptcp->map_data_seq >> 32));
+		__wsum csum = tp->mptcp->map_csum;
+
+		csum = skb_checksum(skb, skb_transport_offset(skb) +
+				    TCP_SKB_CB(skb)->dss_off,
+				    MPTCP_SUB_LEN_SEQ_CSUM, csum);
+		tp->mptcp->map_csum = csum_partial(&data_seq, sizeof(data_seq),
+						   csum);
+
+		tp->mptcp->map_csum_dss = 1; /* Just do it once */
+	}
+}
+
+/* Called for each segment, once its mapping has been validated. Thus, the
+ * data gets checksummed while it is still cache-hot, and the verification
+ * at the end of the mapping is a mere fold.
+ */
+static void mptcp_dss_csum_update(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_cb *mpcb = tp->mpcb;
+	struct sk_buff *tmp;
+
+	if (!mpcb->rx_opt.dss_csum || mpcb->infinite_mapping ||
+	    !tp->mptcp->mapping_present)
+		return;
+
+	/* The mapping may have arrived after some of the segments it covers.
+	 * These are in front of @skb in the receive-queue.
+	 */
+	if (before(tp->mptcp->map_csum_seq, TCP_SKB_CB(skb)->seq)) {
+		skb_queue_walk(&sk->sk_receive_queue, tmp) {
+			if (tmp == skb)
+				break;
+			if (mptcp_skb_in_mapping(tp, tmp))
+				mptcp_dss_csum_add(sk, tmp);
+		}
+	}
+
+	if (mptcp_skb_in_mapping(tp, skb))
+		mptcp_dss_csum_add(sk, skb);
+}
+
 /**
  * @return:
  *  i) 1: Everything's fine.
@@ -206,67 +308,28 @@ static int mptcp_verif_dss_csum(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sk_buff *tmp, *last = NULL;
-	__wsum csum_tcp = 0; /* cumulative checksum of pld + mptcp-header */
-	int ans = 1, overflowed = 0, offset = 0, dss_csum_added = 0;
-	int iter = 0;
+	int ans = 1;
 
+	/* The full mapping is there, but the segments behind the one that
+	 * completed it have not yet been seen by mptcp_dss_csum_update.
+	 */
 	skb_queue_walk(&sk->sk_receive_queue, tmp) {
-		unsigned int csum_len;
-
-		/* tp->map_data_len may be 0 in case of a data-fin */
-		if ((tp->mptcp->map_data_len &&
-		     !after(tp->mptcp->map_subseq + tp->mptcp->map_data_len, TCP_SKB_CB(tmp)->seq)) ||
-		    (!tp->mptcp->map_data_len && before(tp->mptcp->map_subseq, TCP_SKB_CB(tmp)->seq)))
+		if (!mptcp_skb_in_mapping(tp, tmp))
 			break;
 
-		if (before(tp->mptcp->map_subseq + tp->mptcp->map_data_len, TCP_SKB_CB(tmp)->end_seq))
-			/* Mapping ends in the middle of the packet -
-			 * csum only these bytes */
-			csum_len = tp->mptcp->map_subseq + tp->mptcp->map_data_len - TCP_SKB_CB(tmp)->seq;
-		else
-			csum_len = tmp->len;
-
-		offset = 0;
-		if (overflowed) {
-			char first_word[4];
-			first_word[0] = 0;
-			first_word[1] = 0;
-			first_word[2] = 0;
-			first_word[3] = *(tmp->data);
-			csum_tcp = csum_partial(first_word, 4, csum_tcp);
-			offset = 1;
-			csum_len--;
-			overflowed = 0;
-		}
-
-		csum_tcp = skb_checksum(tmp, offset, csum_len, csum_tcp);
-
-		/* Was it on an odd-length?  Then we have to merge the next byte
-		 * correctly (see above)*/
-		if (csum_len != (csum_len & (~1)))
-			overflowed = 1;
-
-		if (mptcp_is_data_seq(tmp) && !dss_csum_added) {
-			__be32 data_seq = htonl((u32)(tp->mptcp->map_data_seq >> 32));
-			csum_tcp = skb_checksum(tmp, skb_transport_offset(tmp) +
-						TCP_SKB_CB(tmp)->dss_off,
-						MPTCP_SUB_LEN_SEQ_CSUM,
-						csum_tcp);
-			csum_tcp = csum_partial(&data_seq, sizeof(data_seq), csum_tcp);
-
-			dss_csum_added = 1; /* Just do it once */
-		}
+		mptcp_dss_csum_add(sk, tmp);
 		last = tmp;
-		iter++;
 	}
 
 	/* Now, checksum must be 0 */
-	if (unlikely(csum_fold(csum_tcp))) {
+	if (unlikely(csum_fold(tp->mptcp->map_csum))) {
 		mptcp_debug("%s csum is wrong: %#x data_seq %u "
-			    "dss_csum_added %d overflowed %d iterations %d\n",
-			    __func__, csum_fold(csum_tcp),
-			    TCP_SKB_CB(last)->seq, dss_csum_added,
-			    overflowed, iter);
+			    "dss_csum_added %d csum_seq %u\n",
+			    __func__, csum_fold(tp->mptcp->map_csum),
+			    TCP_SKB_CB(last)->seq, tp->mptcp->map_csum_dss,
+			    tp->mptcp->map_csum_seq);
+
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_MPTCPCSUMFAIL);
 
 		tp->mptcp->csum_error = 1;
 		/* map_data_seq is the data-seq number of the
@@ -321,6 +384,57 @@ static inline void mptcp_prepare_skb(struct sk_buff *skb, struct sk_buff *next,
 	}
 }
 
+/* Merges from at the end of to, which is already queued at the meta-level.
+ * Either the data of from fits in the tailroom of to, or its page-frags are
+ * moved to to. That way, the meta-queues are not filled with many small
+ * skbs coming from different subflows.
+ *
+ * @return: 1 if from has been merged and can be freed, otherwise 0.
+ */
+int mptcp_try_coalesce(struct sock *meta_sk, struct sk_buff *to,
+		       struct sk_buff *from)
+{
+	int len = from->len, delta, i;
+
+	if (TCP_SKB_CB(from)->seq != TCP_SKB_CB(to)->end_seq ||
+	    mptcp_is_data_fin(from) || mptcp_is_data_fin(to) ||
+	    tcp_hdr(from)->syn || tcp_hdr(from)->fin ||
+	    tcp_hdr(to)->syn || tcp_hdr(to)->fin ||
+	    skb_cloned(to) || skb_has_frag_list(to))
+		return 0;
+
+	if (!skb_is_nonlinear(to) && len <= skb_tailroom(to)) {
+		BUG_ON(skb_copy_bits(from, 0, skb_put(to, len), len));
+		goto merged;
+	}
+
+	if (skb_headlen(from) || skb_cloned(from) || skb_has_frag_list(from) ||
+	    skb_shinfo(to)->nr_frags + skb_shinfo(from)->nr_frags > MAX_SKB_FRAGS)
+		return 0;
+
+	/* All that is left of from once its frags are gone */
+	delta = from->truesize - sizeof(struct sk_buff) -
+		(skb_end_pointer(from) - from->head);
+	if (delta < 0)
+		return 0;
+
+	for (i = 0; i < skb_shinfo(from)->nr_frags; i++)
+		skb_shinfo(to)->frags[skb_shinfo(to)->nr_frags++] =
+			skb_shinfo(from)->frags[i];
+	/* The page references now belong to to */
+	skb_shinfo(from)->nr_frags = 0;
+
+	to->len += len;
+	to->data_len += len;
+	to->truesize += delta;
+	atomic_add(delta, &meta_sk->sk_rmem_alloc);
+	sk_mem_charge(meta_sk, delta);
+
+merged:
+	TCP_SKB_CB(to)->end_seq = TCP_SKB_CB(from)->end_seq;
+	return 1;
+}
+
 /**
  * @return: 1 if the segment has been eaten and can be suppressed,
  *          otherwise 0.
@@ -352,6 +466,8 @@ static inline void mptcp_reset_mapping(struct tcp_sock *tp)
 	tp->mptcp->map_subseq = 0;
 	tp->mptcp->map_data_fin = 0;
 	tp->mptcp->mapping_present = 0;
+	tp->mptcp->map_csum = 0;
+	tp->mptcp->map_csum_dss = 0;
 }
 
 /* The DSS-mapping received on the sk only covers the second half of the skb
@@ -370,7 +486,9 @@ static void mptcp_skb_trim_head(struct sk_buff *skb, struct sock *sk, u32 seq)
 	else
 		__pskb_trim_head(skb, len - skb_headlen(skb));
 
-	TCP_SKB_CB(skb)->seq = htonl(new_seq);
+	TCP_SKB_CB(skb)->seq = new_seq;
+	/* skb->csum no longer matches the data */
+	TCP_SKB_CB(skb)->csum_complete = 0;
 
 	skb->truesize -= len;
 	atomic_sub(len, &sk->sk_rmem_alloc);
@@ -418,6 +536,10 @@ static int mptcp_skb_split_tail(struct sk_buff *skb, struct sock *sk, u32 seq)
 
 	skb_split(skb, buff, len);
 
+	/* skb->csum covered the whole segment, none of the halves */
+	TCP_SKB_CB(skb)->csum_complete = 0;
+	TCP_SKB_CB(buff)->csum_complete = 0;
+
 	/* buff has no TCP/IP-header - thus drop the reference */
 	skb_header_release(buff);
 
@@ -458,6 +580,8 @@ static int mptcp_prevalidate_skb(struct sock *sk, struct sk_buff *skb)
 			__kfree_skb(skb);
 			return 1;
 		} else {
+			NET_INC_STATS_BH(sock_net(sk),
+					 LINUX_MIB_MPTCPINFINITEMAPRX);
 			mpcb->infinite_mapping = 1;
 			tp->mptcp->fully_established = 1;
 		}
@@ -539,6 +663,7 @@ static int mptcp_detect_mapping(struct sock *sk, struct sk_buff *skb)
 	/* Mapping not yet set on this subflow - we set it here! */
 
 	if (!data_len) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_MPTCPINFINITEMAPRX);
 		mpcb->infinite_mapping = 1;
 		tp->mptcp->fully_established = 1;
 		/* We need to repeat mp_fail's until the sender felt
@@ -630,6 +755,7 @@ static int mptcp_detect_mapping(struct sock *sk, struct sk_buff *skb)
 	tp->mptcp->map_data_len = data_len;
 	tp->mptcp->map_subseq = sub_seq;
 	tp->mptcp->map_data_fin = mptcp_is_data_fin(skb) ? 1 : 0;
+	tp->mptcp->map_csum_seq = sub_seq;
 	tp->mptcp->mapping_present = 1;
 
 	return 0;
@@ -762,7 +888,7 @@ static int mptcp_queue_skb(struct sock *sk)
 	struct mptcp_cb *mpcb = tp->mpcb;
 	struct sk_buff *tmp, *tmp1;
 	u64 rcv_nxt64 = mptcp_get_rcv_nxt_64(meta_tp);
-	int eaten = 0;
+	int eaten = 0, coalesced;
 
 	/* Have we not yet received the full mapping? */
 	if (!tp->mptcp->mapping_present ||
@@ -797,7 +923,7 @@ static int mptcp_queue_skb(struct sock *sk)
 
 			skb_set_owner_r(tmp1, meta_sk);
 
-			mptcp_add_meta_ofo_queue(meta_sk, tmp1, sk);
+			mptcp_add_meta_ofo_queue(meta_sk, tmp1);
 		}
 	} else {
 		/* Ready for the meta-rcv-queue */
@@ -816,6 +942,7 @@ static int mptcp_queue_skb(struct sock *sk)
 			__skb_unlink(tmp1, &sk->sk_receive_queue);
 
 			eaten = 0;
+			coalesced = 0;
 			/* Is direct copy possible ? */
 			if (TCP_SKB_CB(tmp1)->seq == meta_tp->rcv_nxt &&
 			    meta_tp->ucopy.task == current &&
@@ -825,8 +952,18 @@ static int mptcp_queue_skb(struct sock *sk)
 				eaten = mptcp_direct_copy(tmp1, tp, meta_sk);
 
 			if (!eaten) {
-				__skb_queue_tail(&meta_sk->sk_receive_queue, tmp1);
-				skb_set_owner_r(tmp1, meta_sk);
+				struct sk_buff *tail;
+
+				tail = skb_peek_tail(&meta_sk->sk_receive_queue);
+				/* Coalescing still needs sk_data_ready, thus
+				 * it does not count as eaten.
+				 */
+				if (tail && mptcp_try_coalesce(meta_sk, tail, tmp1)) {
+					coalesced = 1;
+				} else {
+					__skb_queue_tail(&meta_sk->sk_receive_queue, tmp1);
+					skb_set_owner_r(tmp1, meta_sk);
+				}
 			}
 			mptcp_check_rcvseq_wrap(meta_tp,
 						TCP_SKB_CB(tmp1)->end_seq -
@@ -837,10 +974,10 @@ static int mptcp_queue_skb(struct sock *sk)
 				mptcp_fin(meta_sk);
 
 			/* Check if this fills a gap in the ofo queue */
-			if (!skb_queue_empty(&meta_tp->out_of_order_queue))
+			if (!mptcp_ofo_queue_empty(meta_tp))
 				mptcp_ofo_queue(meta_sk);
 
-			if (eaten)
+			if (eaten || coalesced)
 				__kfree_skb(tmp1);
 		}
 	}
@@ -889,6 +1026,8 @@ restart:
 		if (mptcp_validate_mapping(sk, skb) < 0)
 			goto restart;
 
+		mptcp_dss_csum_update(sk, skb);
+
 		/* Push a level higher */
 		ret = mptcp_queue_skb(sk);
 		if (ret < 0) {
@@ -998,6 +1137,59 @@ void mptcp_fin(struct sock *meta_sk)
 	return;
 }
 
+/* The copies acked at the subflow-level by this ack reached the peer, even if
+ * the DATA_ACK does not yet cover them. Remember it in the meta-segments, so
+ * that the redundant scheduler does not send them again on the other
+ * subflows. The peer may still drop them at the meta-level, thus only the
+ * DATA_ACK frees them from reinjections and retransmissions.
+ *
+ * @sk's snd_una has already been updated, but the acked segments are still
+ * in its write-queue (tcp_clean_rtx_queue comes later).
+ */
+static void mptcp_mark_acked_copies(struct sock *meta_sk, struct sock *sk)
+{
+	struct tcp_sock *meta_tp = tcp_sk(meta_sk), *tp = tcp_sk(sk);
+	struct mptcp_cb *mpcb = meta_tp->mpcb;
+	struct sk_buff *skb, *meta_skb;
+
+	if (!(mpcb->sched_ops->flags & MPTCP_SCHED_TRACK_ACKED) ||
+	    mpcb->infinite_mapping)
+		return;
+
+	meta_skb = tcp_write_queue_head(meta_sk);
+	if (!meta_skb || meta_skb == tcp_send_head(meta_sk))
+		return;
+
+	tcp_for_write_queue(skb, sk) {
+		u32 seq, end_seq;
+
+		if (skb == tcp_send_head(sk) ||
+		    after(TCP_SKB_CB(skb)->end_seq, tp->snd_una))
+			break;
+
+		if (mptcp_skb_data_seq(skb, sk, &seq, &end_seq) ||
+		    !after(end_seq, meta_tp->snd_una))
+			continue;
+
+		/* Both queues are mostly in data-seq order, thus we continue
+		 * where the previous segment stopped.
+		 */
+		tcp_for_write_queue_from(meta_skb, meta_sk) {
+			struct tcp_skb_cb *tcb = TCP_SKB_CB(meta_skb);
+
+			if (meta_skb == tcp_send_head(meta_sk))
+				return;
+
+			if (!before(tcb->seq, end_seq))
+				break;
+
+			if (!tcb->acked_pi && !before(tcb->seq, seq) &&
+			    !after(tcb->end_seq, end_seq))
+				tcb->acked_pi = tp->mptcp->path_index;
+		}
+	}
+}
+
 /* Handle the DATA_ACK */
 int mptcp_data_ack(struct sock *sk, const struct sk_buff *skb)
 {
@@ -1128,6 +1320,8 @@ int mptcp_data_ack(struct sock *sk, const struct sk_buff *skb)
 		mptcp_rcv_state_process(meta_sk, sk, skb, data_seq, data_len);
 
 exit:
+	mptcp_mark_acked_copies(meta_sk, sk);
+
 	mptcp_push_pending_frames(meta_sk);
 
 	return flag;
@@ -1394,20 +1588,32 @@ void mptcp_parse_options(const uint8_t *ptr, int opsize,
 		}
 
 		if (mpadd->ipver == 4) {
+			u32 rem_bits = mopt->rem4_bits;
 			__be16 port = 0;
 			if (opsize == MPTCP_SUB_LEN_ADD_ADDR4 + 2)
 				port = mpadd->u.v4.port;
 
-			mptcp_v4_add_raddress(mopt, &mpadd->u.v4.addr, port,
-					      mpadd->addr_id);
+			if (!mptcp_v4_add_raddress(mopt, &mpadd->u.v4.addr,
+						   port, mpadd->addr_id) &&
+			    mopt->mpcb && mopt->rem4_bits != rem_bits)
+				mptcp_nl_addr_event(mopt->mpcb,
+						    MPTCP_EVENT_ANNOUNCED,
+						    mpadd->addr_id, AF_INET,
+						    &mpadd->u.v4.addr, port);
 #if IS_ENABLED(CONFIG_IPV6)
 		} else if (mpadd->ipver == 6) {
+			u32 rem_bits = mopt->rem6_bits;
 			__be16 port = 0;
 			if (opsize == MPTCP_SUB_LEN_ADD_ADDR6 + 2)
 				port = mpadd->u.v6.port;
 
-			mptcp_v6_add_raddress(mopt, &mpadd->u.v6.addr, port,
-					      mpadd->addr_id);
+			if (!mptcp_v6_add_raddress(mopt, &mpadd->u.v6.addr,
+						   port, mpadd->addr_id) &&
+			    mopt->mpcb && mopt->rem6_bits != rem_bits)
+				mptcp_nl_addr_event(mopt->mpcb,
+						    MPTCP_EVENT_ANNOUNCED,
+						    mpadd->addr_id, AF_INET6,
+						    &mpadd->u.v6.addr, port);
 #endif /* CONFIG_IPV6 */
 		}
 		break;
@@ -1426,8 +1632,12 @@ void mptcp_parse_options(const uint8_t *ptr, int opsize,
 
 		for (i = 0; i <= opsize - MPTCP_SUB_LEN_REMOVE_ADDR; i++) {
 			rem_id = (&mprem->addrs_id)[i];
-			if (!mptcp_rem_raddress(mopt, rem_id))
+			if (!mptcp_rem_raddress(mopt, rem_id)) {
+				mptcp_nl_addr_event(mopt->mpcb,
+						    MPTCP_EVENT_REMOVED,
+						    rem_id, 0, NULL, 0);
 				mptcp_send_reset_rem_id(mopt->mpcb, rem_id);
+			}
 		}
 		break;
 	}
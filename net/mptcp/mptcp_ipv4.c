@@ -70,9 +70,7 @@ static void mptcp_v4_reqsk_queue_hash_add(struct sock *meta_sk,
 
 	inet_csk_reqsk_queue_hash_add(meta_sk, req, timeout);
 
-	spin_lock(&mptcp_reqsk_hlock);
-	list_add(&mptcp_rsk(req)->collide_tuple, &mptcp_reqsk_htb[h]);
-	spin_unlock(&mptcp_reqsk_hlock);
+	mptcp_hash_request_add(req, h);
 }
 
 /* Similar to tcp_v4_conn_request */
@@ -96,8 +94,7 @@ static void mptcp_v4_join_request_short(struct sock *meta_sk,
 		return;
 
 	mtreq = mptcp_rsk(req);
-	mtreq->mpcb = mpcb;
-	INIT_LIST_HEAD(&mtreq->collide_tuple);
+	mptcp_init_request_tuple(req, mpcb);
 	mtreq->mptcp_rem_nonce = tmp_opt->mptcp_recv_nonce;
 	mtreq->mptcp_rem_key = mpcb->mptcp_rem_key;
 	mtreq->mptcp_loc_key = mpcb->mptcp_loc_key;
@@ -210,12 +207,12 @@ int mptcp_v4_rem_raddress(struct multipath_options *mopt, u8 id)
 	int i;
 
 	for (i = 0; i < MPTCP_MAX_ADDR; i++) {
-		if (!((1 << i) & mopt->rem4_bits))
+		if (!((1U << i) & mopt->rem4_bits))
 			continue;
 
 		if (mopt->addr4[i].id == id) {
 			/* remove address from bitfield */
-			mopt->rem4_bits &= ~(1 << i);
+			mopt->rem4_bits &= ~(1U << i);
 
 			return 0;
 		}
@@ -270,6 +267,11 @@ int mptcp_v4_add_raddress(struct multipath_options *mopt,
 		return -1;
 	}
 
+	/* Only the rx_opt of the mpcb owns address-tables */
+	if (!mopt->mpcb ||
+	    mptcp_addr_table_grow(mopt->addr4, mopt->addr4_size, i))
+		return -1;
+
 	rem4 = &mopt->addr4[i];
 
 	/* Address is not known yet, store it */
@@ -279,7 +281,7 @@ int mptcp_v4_add_raddress(struct multipath_options *mopt,
 	rem4->retry_bitfield = 0;
 	rem4->id = id;
 	mopt->list_rcvd = 1;
-	mopt->rem4_bits |= (1 << i);
+	mopt->rem4_bits |= (1U << i);
 
 	return 0;
 }
@@ -430,6 +432,19 @@ discard:
 	return 0;
 }
 
+static inline int mptcp_v4_req_match(const struct mptcp_request_sock *mtreq,
+				     const __be16 rport, const __be32 raddr,
+				     const __be32 laddr)
+{
+	const struct request_sock *req = rev_mptcp_rsk(mtreq);
+	const struct inet_request_sock *ireq = inet_rsk(req);
+
+	return ireq->rmt_port == rport &&
+	       ireq->rmt_addr == raddr &&
+	       ireq->loc_addr == laddr &&
+	       req->rsk_ops->family == AF_INET;
+}
+
 /* After this, the ref count of the meta_sk associated with the request_sock
  * is incremented. Thus it is the responsibility of the caller
  * to call sock_put() when the reference is not needed anymore.
@@ -437,28 +452,39 @@ discard:
 struct sock *mptcp_v4_search_req(const __be16 rport, const __be32 raddr,
 				 const __be32 laddr)
 {
+	const u32 hash = inet_synq_hash(raddr, rport, 0, MPTCP_HASH_SIZE);
+	const struct hlist_nulls_node *node;
 	struct mptcp_request_sock *mtreq;
 	struct sock *meta_sk = NULL;
 
-	spin_lock(&mptcp_reqsk_hlock);
-	list_for_each_entry(mtreq,
-			    &mptcp_reqsk_htb[inet_synq_hash(raddr, rport, 0,
-					    	    	    MPTCP_HASH_SIZE)],
-			    collide_tuple) {
-		const struct inet_request_sock *ireq = inet_rsk(rev_mptcp_rsk(mtreq));
-
-		if (ireq->rmt_port == rport &&
-		    ireq->rmt_addr == raddr &&
-		    ireq->loc_addr == laddr &&
-		    rev_mptcp_rsk(mtreq)->rsk_ops->family == AF_INET) {
-			meta_sk = mtreq->mpcb->meta_sk;
-			break;
+	rcu_read_lock();
+begin:
+	hlist_nulls_for_each_entry_rcu(mtreq, node, &mptcp_reqsk_htb[hash].head,
+				       collide_tuple) {
+		if (!mptcp_v4_req_match(mtreq, rport, raddr, laddr))
+			continue;
+
+		meta_sk = mtreq->meta_sk;
+		if (unlikely(!atomic_inc_not_zero(&meta_sk->sk_refcnt))) {
+			meta_sk = NULL;
+			goto out;
 		}
-	}
 
-	if (meta_sk)
-		sock_hold(meta_sk);
-	spin_unlock(&mptcp_reqsk_hlock);
+		/* The request-sock may have been freed and reused meanwhile */
+		if (unlikely(hlist_nulls_unhashed(&mtreq->collide_tuple) ||
+			     !mptcp_v4_req_match(mtreq, rport, raddr, laddr) ||
+			     mtreq->meta_sk != meta_sk)) {
+			sock_put(meta_sk);
+			goto begin;
+		}
+		goto out;
+	}
+	/* The last request-sock may have moved to another chain - restart */
+	if (get_nulls_value(node) != hash)
+		goto begin;
+	meta_sk = NULL;
+out:
+	rcu_read_unlock();
 
 	return meta_sk;
 }
@@ -477,7 +503,7 @@ int mptcp_init4_subsockets(struct sock *meta_sk, const struct mptcp_loc4 *loc,
 	int ulid_size = 0, ret;
 
 	/* Don't try again - even if it fails */
-	rem->bitfield |= (1 << loc->id);
+	rem->bitfield |= (1U << loc->id);
 
 	/** First, create and prepare the new socket */
 
@@ -496,7 +522,8 @@ int mptcp_init4_subsockets(struct sock *meta_sk, const struct mptcp_loc4 *loc,
 	sk = sock.sk;
 	tp = tcp_sk(sk);
 
-	if (mptcp_add_sock(meta_sk, sk, rem->id, GFP_KERNEL))
+	ret = mptcp_add_sock(meta_sk, sk, rem->id, GFP_KERNEL);
+	if (ret)
 		goto error;
 
 	tp->mptcp->slave_sk = 1;
@@ -510,7 +537,7 @@ int mptcp_init4_subsockets(struct sock *meta_sk, const struct mptcp_loc4 *loc,
 	ulid_size = sizeof(struct sockaddr_in);
 	loc_in.sin_family = AF_INET;
 	rem_in.sin_family = AF_INET;
-	loc_in.sin_port = 0;
+	loc_in.sin_port = loc->port;
 	if (rem->port)
 		rem_in.sin_port = rem->port;
 	else
@@ -574,13 +601,8 @@ static int mptcp_pm_netdev_event(struct notifier_block *this,
 	      event == NETDEV_CHANGE))
 		return NOTIFY_DONE;
 
-	if (dev->flags & IFF_NOMULTIPATH)
-		return NOTIFY_DONE;
-
-	/* Iterate over the addresses of the interface, then we go over the
-	 * mpcb's to modify them - that way we take tk_hash_lock for a shorter
-	 * time at each iteration. - otherwise we would need to take it from the
-	 * beginning till the end.
+	/* Update the table with each of the addresses of the interface. The
+	 * connections will be updated in a single pass afterwards.
 	 */
 	rcu_read_lock();
 	in_dev = __in_dev_get_rcu(dev);
@@ -595,85 +617,167 @@ static int mptcp_pm_netdev_event(struct notifier_block *this,
 	return NOTIFY_DONE;
 }
 
-void mptcp_pm_addr4_event_handler(struct in_ifaddr *ifa, unsigned long event,
-				  struct mptcp_cb *mpcb)
+static int mptcp_v4_find_address(const struct mptcp_loc4 *locs, u32 bits,
+				 __be32 addr)
 {
 	int i;
-	struct sock *sk, *tmpsk;
 
-	if (ifa->ifa_scope > RT_SCOPE_LINK ||
-	    (ifa->ifa_dev->dev->flags & IFF_NOMULTIPATH))
+	mptcp_for_each_bit_set(bits, i) {
+		if (locs[i].addr.s_addr == addr)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Update the per-netns address-table. The connections are told about the
+ * change by mptcp_pm_addr_changed().
+ */
+void mptcp_pm_addr4_event_handler(struct in_ifaddr *ifa, unsigned long event)
+{
+	struct net_device *dev = ifa->ifa_dev->dev;
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(dev_net(dev));
+	struct mptcp_loc_addr *addrs = &ns->addrs;
+	int i, low_prio = (dev->flags & IFF_MPBACKUP) ? 1 : 0;
+
+	if (ifa->ifa_scope > RT_SCOPE_LINK || (dev->flags & IFF_LOOPBACK))
 		return;
 
-	/* Look for the address among the local addresses */
-	mptcp_for_each_bit_set(mpcb->loc4_bits, i) {
-		if (mpcb->addr4[i].addr.s_addr == ifa->ifa_local)
-			goto found;
-	}
+	spin_lock_bh(&ns->lock);
 
-	/* Not yet in address-list */
-	if ((event == NETDEV_UP || event == NETDEV_CHANGE) && netif_running(ifa->ifa_dev->dev)) {
-		i = __mptcp_find_free_index(mpcb->loc4_bits, 0, mpcb->next_v4_index);
+	i = mptcp_v4_find_address(addrs->locaddr4, addrs->loc4_bits,
+				  ifa->ifa_local);
+
+	/* The interface may also have become NOMULTIPATH */
+	if (event == NETDEV_DOWN || !netif_running(dev) ||
+	    (dev->flags & IFF_NOMULTIPATH)) {
+		if (i < 0)
+			goto out;
+
+		addrs->loc4_bits &= ~(1U << i);
+	} else if (i < 0) {
+		i = mptcp_find_free_index(addrs->loc4_bits);
 		if (i < 0) {
 			mptcp_debug("MPTCP_PM: NETDEV_UP Reached max "
 				    "number of local IPv4 addresses: %d\n",
 				    MPTCP_MAX_ADDR);
-			return;
+			goto out;
 		}
 
-		/* update this mpcb */
-		mpcb->addr4[i].addr.s_addr = ifa->ifa_local;
-		mpcb->addr4[i].id = i;
-		mpcb->loc4_bits |= (1 << i);
-		mpcb->next_v4_index = i + 1;
-		/* re-send addresses */
-		mptcp_v4_send_add_addr(i, mpcb);
-		/* re-evaluate paths */
-		mptcp_create_subflows(mpcb->meta_sk);
+		addrs->locaddr4[i].addr.s_addr = ifa->ifa_local;
+		addrs->locaddr4[i].port = 0;
+		addrs->locaddr4[i].id = i;
+		addrs->locaddr4[i].low_prio = low_prio;
+		addrs->loc4_bits |= (1U << i);
+	} else if (addrs->locaddr4[i].low_prio != low_prio) {
+		addrs->locaddr4[i].low_prio = low_prio;
+	} else {
+		goto out;
 	}
-	return;
-found:
-	/* Address already in list. Reactivate/Deactivate the
-	 * concerned paths. */
+
+	mptcp_pm_addr_changed(ns);
+out:
+	spin_unlock_bh(&ns->lock);
+}
+
+static void mptcp_v4_add_loc_addr(struct mptcp_cb *mpcb,
+				  const struct mptcp_loc4 *loc)
+{
+	int i;
+
+	i = __mptcp_find_free_index(mpcb->loc4_bits, 0, mpcb->next_v4_index);
+	if (i < 0) {
+		mptcp_debug("%s: At max num of local addresses: %d --- not "
+			    "adding address: %pI4\n", __func__, MPTCP_MAX_ADDR,
+			    &loc->addr.s_addr);
+		return;
+	}
+
+	if (mptcp_addr_table_grow(mpcb->addr4, mpcb->addr4_size, i))
+		return;
+
+	mpcb->addr4[i].addr.s_addr = loc->addr.s_addr;
+	mpcb->addr4[i].port = 0;
+	mpcb->addr4[i].id = i;
+	mpcb->addr4[i].low_prio = loc->low_prio;
+	mpcb->loc4_bits |= (1U << i);
+	mpcb->next_v4_index = i + 1;
+	/* re-send addresses */
+	mptcp_v4_send_add_addr(i, mpcb);
+	/* re-evaluate paths */
+	mptcp_create_subflows(mpcb->meta_sk);
+}
+
+static void mptcp_v4_rem_loc_addr(struct mptcp_cb *mpcb, int i)
+{
+	struct sock *sk, *tmpsk;
+
+	/* Look for the sockets and remove them */
 	mptcp_for_each_sk_safe(mpcb, sk, tmpsk) {
-		struct tcp_sock *tp = tcp_sk(sk);
 		if (sk->sk_family != AF_INET ||
-		    inet_sk(sk)->inet_saddr != ifa->ifa_local)
+		    inet_sk(sk)->inet_saddr != mpcb->addr4[i].addr.s_addr)
 			continue;
 
-		if (event == NETDEV_DOWN) {
-			mptcp_reinject_data(sk, 0);
-			mptcp_sub_force_close(sk);
-		} else if (event == NETDEV_CHANGE) {
-			int new_low_prio = (ifa->ifa_dev->dev->flags & IFF_MPBACKUP) ?
-						1 : 0;
-			if (new_low_prio != tp->mptcp->low_prio)
-				tp->mptcp->send_mp_prio = 1;
-			tp->mptcp->low_prio = new_low_prio;
-		}
+		mptcp_reinject_data(sk, 0);
+		mptcp_sub_force_close(sk);
 	}
 
-	if (event == NETDEV_DOWN) {
-		mpcb->loc4_bits &= ~(1 << i);
+	mpcb->loc4_bits &= ~(1U << i);
 
-		/* Force sending directly the REMOVE_ADDR option */
-		mpcb->remove_addrs |= (1 << mpcb->addr4[i].id);
-		sk = mptcp_select_ack_sock(mpcb->meta_sk, 0);
-		if (sk)
-			tcp_send_ack(sk);
+	/* Force sending directly the REMOVE_ADDR option */
+	mpcb->remove_addrs |= (1ULL << mpcb->addr4[i].id);
+	sk = mptcp_select_ack_sock(mpcb->meta_sk, 0);
+	if (sk)
+		tcp_send_ack(sk);
 
-		mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, i)
-			mpcb->rx_opt.addr4[i].bitfield &= mpcb->loc4_bits;
-	}
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, i)
+		mpcb->rx_opt.addr4[i].bitfield &= mpcb->loc4_bits;
 }
 
-/* Send ADD_ADDR for loc_id on all available subflows */
-void mptcp_v4_send_add_addr(int loc_id, struct mptcp_cb *mpcb)
+/* Bring the local IPv4 addresses of @mpcb in line with @addrs.
+ *
+ * Must be called with the meta locked and bh disabled.
+ */
+void mptcp_v4_update_loc_addrs(struct mptcp_cb *mpcb,
+			       const struct mptcp_loc_addr *addrs)
 {
-	struct tcp_sock *tp;
+	struct sock *sk;
+	int i, j;
+
+	/* Addresses that disappeared from the table */
+	mptcp_for_each_bit_set(mpcb->loc4_bits, i) {
+		if (mptcp_v4_find_address(addrs->locaddr4, addrs->loc4_bits,
+					  mpcb->addr4[i].addr.s_addr) < 0)
+			mptcp_v4_rem_loc_addr(mpcb, i);
+	}
+
+	/* New addresses, or a changed backup-flag */
+	mptcp_for_each_bit_set(addrs->loc4_bits, j) {
+		const struct mptcp_loc4 *loc = &addrs->locaddr4[j];
+
+		i = mptcp_v4_find_address(mpcb->addr4, mpcb->loc4_bits,
+					  loc->addr.s_addr);
+		if (i < 0) {
+			mptcp_v4_add_loc_addr(mpcb, loc);
+			continue;
+		}
+
+		if (mpcb->addr4[i].low_prio == loc->low_prio)
+			continue;
+		mpcb->addr4[i].low_prio = loc->low_prio;
+
+		mptcp_for_each_sk(mpcb, sk) {
+			struct tcp_sock *tp = tcp_sk(sk);
 
-	mptcp_for_each_tp(mpcb, tp)
-		tp->mptcp->add_addr4 |= (1 << loc_id);
+			if (sk->sk_family != AF_INET ||
+			    inet_sk(sk)->inet_saddr != loc->addr.s_addr)
+				continue;
+
+			if (loc->low_prio != tp->mptcp->low_prio)
+				tp->mptcp->send_mp_prio = 1;
+			tp->mptcp->low_prio = loc->low_prio;
+		}
+	}
 }
 
 static struct notifier_block mptcp_pm_inetaddr_notifier = {
@@ -699,7 +803,8 @@ int mptcp_pm_v4_init(void)
 	}
 
 	ops->slab = kmem_cache_create(ops->slab_name, ops->obj_size, 0,
-				      SLAB_HWCACHE_ALIGN, NULL);
+				      SLAB_HWCACHE_ALIGN | SLAB_DESTROY_BY_RCU,
+				      NULL);
 
 	if (ops->slab == NULL) {
 		ret =  -ENOMEM;
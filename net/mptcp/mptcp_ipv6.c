@@ -85,9 +85,7 @@ static void mptcp_v6_reqsk_queue_hash_add(struct sock *meta_sk,
 
 	inet6_csk_reqsk_queue_hash_add(meta_sk, req, timeout);
 
-	spin_lock(&mptcp_reqsk_hlock);
-	list_add(&mptcp_rsk(req)->collide_tuple, &mptcp_reqsk_htb[h]);
-	spin_unlock(&mptcp_reqsk_hlock);
+	mptcp_hash_request_add(req, h);
 }
 
 /* Similar to tcp_v6_send_synack
@@ -284,8 +282,7 @@ static void mptcp_v6_join_request_short(struct sock *meta_sk,
 		return;
 
 	mtreq = mptcp_rsk(req);
-	mtreq->mpcb = mpcb;
-	INIT_LIST_HEAD(&mtreq->collide_tuple);
+	mptcp_init_request_tuple(req, mpcb);
 	mtreq->mptcp_rem_nonce = tmp_opt->mptcp_recv_nonce;
 	mtreq->mptcp_rem_key = mpcb->mptcp_rem_key;
 	mtreq->mptcp_loc_key = mpcb->mptcp_loc_key;
@@ -415,12 +412,12 @@ int mptcp_v6_rem_raddress(struct multipath_options *mopt, u8 id)
 	int i;
 
 	for (i = 0; i < MPTCP_MAX_ADDR; i++) {
-		if (!((1 << i) & mopt->rem6_bits))
+		if (!((1U << i) & mopt->rem6_bits))
 			continue;
 
 		if (mopt->addr6[i].id == id) {
 			/* remove address from bitfield */
-			mopt->rem6_bits &= ~(1 << i);
+			mopt->rem6_bits &= ~(1U << i);
 
 			return 0;
 		}
@@ -473,6 +470,11 @@ int mptcp_v6_add_raddress(struct multipath_options *mopt,
 		return -1;
 	}
 
+	/* Only the rx_opt of the mpcb owns address-tables */
+	if (!mopt->mpcb ||
+	    mptcp_addr_table_grow(mopt->addr6, mopt->addr6_size, i))
+		return -1;
+
 	rem6 = &mopt->addr6[i];
 
 	/* Address is not known yet, store it */
@@ -482,7 +484,7 @@ int mptcp_v6_add_raddress(struct multipath_options *mopt,
 	rem6->retry_bitfield = 0;
 	rem6->id = id;
 	mopt->list_rcvd = 1;
-	mopt->rem6_bits |= (1 << i);
+	mopt->rem6_bits |= (1U << i);
 
 	return 0;
 }
@@ -625,6 +627,20 @@ discard:
 	return 0;
 }
 
+static inline int mptcp_v6_req_match(const struct mptcp_request_sock *mtreq,
+				     const __be16 rport,
+				     const struct in6_addr *raddr,
+				     const struct in6_addr *laddr)
+{
+	const struct request_sock *req = rev_mptcp_rsk(mtreq);
+	const struct inet6_request_sock *treq = inet6_rsk(req);
+
+	return inet_rsk(req)->rmt_port == rport &&
+	       req->rsk_ops->family == AF_INET6 &&
+	       ipv6_addr_equal(&treq->rmt_addr, raddr) &&
+	       ipv6_addr_equal(&treq->loc_addr, laddr);
+}
+
 /* After this, the ref count of the meta_sk associated with the request_sock
  * is incremented. Thus it is the responsibility of the caller
  * to call sock_put() when the reference is not needed anymore.
@@ -632,28 +648,39 @@ discard:
 struct sock *mptcp_v6_search_req(const __be16 rport, const struct in6_addr *raddr,
 				 const struct in6_addr *laddr)
 {
+	const u32 hash = inet6_synq_hash(raddr, rport, 0, MPTCP_HASH_SIZE);
+	const struct hlist_nulls_node *node;
 	struct mptcp_request_sock *mtreq;
 	struct sock *meta_sk = NULL;
 
-	spin_lock(&mptcp_reqsk_hlock);
-	list_for_each_entry(mtreq,
-			    &mptcp_reqsk_htb[inet6_synq_hash(raddr, rport, 0,
-					    	    	     MPTCP_HASH_SIZE)],
-			    collide_tuple) {
-		const struct inet6_request_sock *treq = inet6_rsk(rev_mptcp_rsk(mtreq));
-
-		if (inet_rsk(rev_mptcp_rsk(mtreq))->rmt_port == rport &&
-		    rev_mptcp_rsk(mtreq)->rsk_ops->family == AF_INET6 &&
-		    ipv6_addr_equal(&treq->rmt_addr, raddr) &&
-		    ipv6_addr_equal(&treq->loc_addr, laddr)) {
-			meta_sk = mtreq->mpcb->meta_sk;
-			break;
+	rcu_read_lock();
+begin:
+	hlist_nulls_for_each_entry_rcu(mtreq, node, &mptcp_reqsk_htb[hash].head,
+				       collide_tuple) {
+		if (!mptcp_v6_req_match(mtreq, rport, raddr, laddr))
+			continue;
+
+		meta_sk = mtreq->meta_sk;
+		if (unlikely(!atomic_inc_not_zero(&meta_sk->sk_refcnt))) {
+			meta_sk = NULL;
+			goto out;
+		}
+
+		/* The request-sock may have been freed and reused meanwhile */
+		if (unlikely(hlist_nulls_unhashed(&mtreq->collide_tuple) ||
+			     !mptcp_v6_req_match(mtreq, rport, raddr, laddr) ||
+			     mtreq->meta_sk != meta_sk)) {
+			sock_put(meta_sk);
+			goto begin;
 		}
+		goto out;
 	}
-
-	if (meta_sk)
-		sock_hold(meta_sk);
-	spin_unlock(&mptcp_reqsk_hlock);
+	/* The last request-sock may have moved to another chain - restart */
+	if (get_nulls_value(node) != hash)
+		goto begin;
+	meta_sk = NULL;
+out:
+	rcu_read_unlock();
 
 	return meta_sk;
 }
@@ -675,7 +702,7 @@ int mptcp_init6_subsockets(struct sock *meta_sk, const struct mptcp_loc6 *loc,
 	 * There is a special case as the IPv6 address of the initial subflow
 	 * has an id = 0. The other ones have id's in the range [8, 16[.
 	 */
-	rem->bitfield |= (1 << (loc->id - min(loc->id, (u8)MPTCP_MAX_ADDR)));
+	rem->bitfield |= (1U << (loc->id - min(loc->id, (u8)MPTCP_MAX_ADDR)));
 
 	/** First, create and prepare the new socket */
 
@@ -694,7 +721,8 @@ int mptcp_init6_subsockets(struct sock *meta_sk, const struct mptcp_loc6 *loc,
 	sk = sock.sk;
 	tp = tcp_sk(sk);
 
-	if (mptcp_add_sock(meta_sk, sk, rem->id, GFP_KERNEL))
+	ret = mptcp_add_sock(meta_sk, sk, rem->id, GFP_KERNEL);
+	if (ret)
 		goto error;
 
 	tp->mptcp->slave_sk = 1;
@@ -708,7 +736,7 @@ int mptcp_init6_subsockets(struct sock *meta_sk, const struct mptcp_loc6 *loc,
 	ulid_size = sizeof(struct sockaddr_in6);
 	loc_in.sin6_family = AF_INET6;
 	rem_in.sin6_family = AF_INET6;
-	loc_in.sin6_port = 0;
+	loc_in.sin6_port = loc->port;
 	if (rem->port)
 		rem_in.sin6_port = rem->port;
 	else
@@ -787,7 +815,9 @@ static void mptcp_dad_callback(unsigned long arg)
 		mptcp_dad_init_timer(data, data->ifa);
 		add_timer(&data->timer);
 	} else {
-		mptcp_pm_inet6_addr_event(NULL, NETDEV_UP, data->ifa);
+		/* The address may have been deleted meanwhile */
+		if (data->ifa->state != INET6_IFADDR_STATE_DEAD)
+			mptcp_pm_inet6_addr_event(NULL, NETDEV_UP, data->ifa);
 		in6_ifa_put(data->ifa);
 		kfree(data);
 	}
@@ -812,7 +842,9 @@ static inline void mptcp_dad_setup_timer(struct inet6_ifaddr *ifa)
 static int mptcp_pm_inet6_addr_event(struct notifier_block *this,
 				     unsigned long event, void *ptr)
 {
-	if (mptcp_ipv6_is_in_dad_state((struct inet6_ifaddr *)ptr)) {
+	/* Wait for DAD to finish, unless the address is going away */
+	if (event != NETDEV_DOWN &&
+	    mptcp_ipv6_is_in_dad_state((struct inet6_ifaddr *)ptr)) {
 		mptcp_dad_setup_timer((struct inet6_ifaddr *)ptr);
 		return NOTIFY_DONE;
 	} else {
@@ -831,10 +863,8 @@ static int mptcp_pm_v6_netdev_event(struct notifier_block *this,
 	      event == NETDEV_CHANGE))
 		return NOTIFY_DONE;
 
-	/* Iterate over the addresses of the interface, then we go over the
-	 * mpcb's to modify them - that way we take tk_hash_lock for a shorter
-	 * time at each iteration. - otherwise we would need to take it from the
-	 * beginning till the end.
+	/* Update the table with each of the addresses of the interface. The
+	 * connections will be updated in a single pass afterwards.
 	 */
 	rcu_read_lock();
 	in6_dev = __in6_dev_get(dev);
@@ -849,80 +879,173 @@ static int mptcp_pm_v6_netdev_event(struct notifier_block *this,
 	return NOTIFY_DONE;
 }
 
-void mptcp_pm_addr6_event_handler(struct inet6_ifaddr *ifa, unsigned long event,
-				  struct mptcp_cb *mpcb)
+static int mptcp_v6_find_address(const struct mptcp_loc6 *locs, u32 bits,
+				 const struct in6_addr *addr)
 {
 	int i;
-	struct sock *sk, *tmpsk;
+
+	mptcp_for_each_bit_set(bits, i) {
+		if (ipv6_addr_equal(&locs[i].addr, addr))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Update the per-netns address-table. The connections are told about the
+ * change by mptcp_pm_addr_changed().
+ */
+void mptcp_pm_addr6_event_handler(struct inet6_ifaddr *ifa, unsigned long event)
+{
+	struct net_device *dev = ifa->idev->dev;
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(dev_net(dev));
+	struct mptcp_loc_addr *addrs = &ns->addrs;
 	int addr_type = ipv6_addr_type(&ifa->addr);
+	int i, low_prio = (dev->flags & IFF_MPBACKUP) ? 1 : 0;
 
 	/* Checks on interface and address-type */
 	if (ifa->scope > RT_SCOPE_LINK ||
-	    (ifa->idev->dev->flags & IFF_NOMULTIPATH) ||
+	    (dev->flags & IFF_LOOPBACK) ||
 	    addr_type == IPV6_ADDR_ANY ||
 	    (addr_type & IPV6_ADDR_LOOPBACK) ||
 	    (addr_type & IPV6_ADDR_LINKLOCAL))
 		return;
 
-	/* Look for the address among the local addresses */
-	mptcp_for_each_bit_set(mpcb->loc6_bits, i) {
-		if (ipv6_addr_equal(&mpcb->addr6[i].addr, &ifa->addr))
-			goto found;
-	}
+	spin_lock_bh(&ns->lock);
 
-	/* Not yet in address-list */
-	if ((event == NETDEV_UP || event == NETDEV_CHANGE) && netif_running(ifa->idev->dev)) {
-		i = __mptcp_find_free_index(mpcb->loc6_bits, 0, mpcb->next_v6_index);
+	i = mptcp_v6_find_address(addrs->locaddr6, addrs->loc6_bits,
+				  &ifa->addr);
+
+	/* The interface may also have become NOMULTIPATH */
+	if (event == NETDEV_DOWN || !netif_running(dev) ||
+	    (dev->flags & IFF_NOMULTIPATH)) {
+		if (i < 0)
+			goto out;
+
+		addrs->loc6_bits &= ~(1U << i);
+	} else if (i < 0) {
+		i = mptcp_find_free_index(addrs->loc6_bits);
 		if (i < 0) {
 			mptcp_debug("MPTCP_PM: NETDEV_UP Reached max "
 				    "number of local IPv6 addresses: %d\n",
 				    MPTCP_MAX_ADDR);
-			return;
+			goto out;
 		}
 
-		/* update this mpcb */
-		ipv6_addr_copy(&mpcb->addr6[i].addr, &ifa->addr);
-		mpcb->addr6[i].id = i + MPTCP_MAX_ADDR;
-		mpcb->loc6_bits |= (1 << i);
-		mpcb->next_v6_index = i + 1;
-		/* re-send addresses */
-		mptcp_v6_send_add_addr(i, mpcb);
-		/* re-evaluate paths */
-		mptcp_create_subflows(mpcb->meta_sk);
+		ipv6_addr_copy(&addrs->locaddr6[i].addr, &ifa->addr);
+		addrs->locaddr6[i].port = 0;
+		addrs->locaddr6[i].id = i + MPTCP_MAX_ADDR;
+		addrs->locaddr6[i].low_prio = low_prio;
+		addrs->loc6_bits |= (1U << i);
+	} else if (addrs->locaddr6[i].low_prio != low_prio) {
+		addrs->locaddr6[i].low_prio = low_prio;
+	} else {
+		goto out;
 	}
-	return;
-found:
-	/* Address already in list. Reactivate/Deactivate the
-	 * concerned paths. */
+
+	mptcp_pm_addr_changed(ns);
+out:
+	spin_unlock_bh(&ns->lock);
+}
+
+static void mptcp_v6_add_loc_addr(struct mptcp_cb *mpcb,
+				  const struct mptcp_loc6 *loc)
+{
+	int i;
+
+	i = __mptcp_find_free_index(mpcb->loc6_bits, 0, mpcb->next_v6_index);
+	if (i < 0) {
+		mptcp_debug("%s: At max num of local addresses: %d --- not "
+			    "adding address: %pI6\n", __func__, MPTCP_MAX_ADDR,
+			    &loc->addr);
+		return;
+	}
+
+	if (mptcp_addr_table_grow(mpcb->addr6, mpcb->addr6_size, i))
+		return;
+
+	ipv6_addr_copy(&mpcb->addr6[i].addr, &loc->addr);
+	mpcb->addr6[i].port = 0;
+	mpcb->addr6[i].id = i + MPTCP_MAX_ADDR;
+	mpcb->addr6[i].low_prio = loc->low_prio;
+	mpcb->loc6_bits |= (1U << i);
+	mpcb->next_v6_index = i + 1;
+	/* re-send addresses */
+	mptcp_v6_send_add_addr(i, mpcb);
+	/* re-evaluate paths */
+	mptcp_create_subflows(mpcb->meta_sk);
+}
+
+static void mptcp_v6_rem_loc_addr(struct mptcp_cb *mpcb, int i)
+{
+	struct sock *sk, *tmpsk;
+
+	/* Look for the sockets and remove them */
 	mptcp_for_each_sk_safe(mpcb, sk, tmpsk) {
-		struct tcp_sock *tp = tcp_sk(sk);
 		if (sk->sk_family != AF_INET6 ||
-		    !ipv6_addr_equal(&inet6_sk(sk)->saddr, &ifa->addr))
+		    !ipv6_addr_equal(&inet6_sk(sk)->saddr,
+				     &mpcb->addr6[i].addr))
 			continue;
 
-		if (event == NETDEV_DOWN) {
-			mptcp_reinject_data(sk, 0);
-			mptcp_sub_force_close(sk);
-		} else if (event == NETDEV_CHANGE) {
-			int new_low_prio = (ifa->idev->dev->flags & IFF_MPBACKUP) ?
-						1 : 0;
-			if (new_low_prio != tp->mptcp->low_prio)
-				tp->mptcp->send_mp_prio = 1;
-			tp->mptcp->low_prio = new_low_prio;
-		}
+		mptcp_reinject_data(sk, 0);
+		mptcp_sub_force_close(sk);
+	}
+
+	mpcb->loc6_bits &= ~(1U << i);
+
+	/* Force sending directly the REMOVE_ADDR option */
+	mpcb->remove_addrs |= (1ULL << mpcb->addr6[i].id);
+	sk = mptcp_select_ack_sock(mpcb->meta_sk, 0);
+	if (sk)
+		tcp_send_ack(sk);
+
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, i)
+		mpcb->rx_opt.addr6[i].bitfield &= mpcb->loc6_bits;
+}
+
+/* Bring the local IPv6 addresses of @mpcb in line with @addrs.
+ *
+ * Must be called with the meta locked and bh disabled.
+ */
+void mptcp_v6_update_loc_addrs(struct mptcp_cb *mpcb,
+			       const struct mptcp_loc_addr *addrs)
+{
+	struct sock *sk;
+	int i, j;
+
+	/* Addresses that disappeared from the table */
+	mptcp_for_each_bit_set(mpcb->loc6_bits, i) {
+		if (mptcp_v6_find_address(addrs->locaddr6, addrs->loc6_bits,
+					  &mpcb->addr6[i].addr) < 0)
+			mptcp_v6_rem_loc_addr(mpcb, i);
 	}
 
-	if (event == NETDEV_DOWN) {
-		mpcb->loc6_bits &= ~(1 << i);
+	/* New addresses, or a changed backup-flag */
+	mptcp_for_each_bit_set(addrs->loc6_bits, j) {
+		const struct mptcp_loc6 *loc = &addrs->locaddr6[j];
 
-		/* Force sending directly the REMOVE_ADDR option */
-		mpcb->remove_addrs |= (1 << mpcb->addr6[i].id);
-		sk = mptcp_select_ack_sock(mpcb->meta_sk, 0);
-		if (sk)
-			tcp_send_ack(sk);
+		i = mptcp_v6_find_address(mpcb->addr6, mpcb->loc6_bits,
+					  &loc->addr);
+		if (i < 0) {
+			mptcp_v6_add_loc_addr(mpcb, loc);
+			continue;
+		}
+
+		if (mpcb->addr6[i].low_prio == loc->low_prio)
+			continue;
+		mpcb->addr6[i].low_prio = loc->low_prio;
 
-		mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, i)
-			mpcb->rx_opt.addr6[i].bitfield &= mpcb->loc6_bits;
+		mptcp_for_each_sk(mpcb, sk) {
+			struct tcp_sock *tp = tcp_sk(sk);
+
+			if (sk->sk_family != AF_INET6 ||
+			    !ipv6_addr_equal(&inet6_sk(sk)->saddr, &loc->addr))
+				continue;
+
+			if (loc->low_prio != tp->mptcp->low_prio)
+				tp->mptcp->send_mp_prio = 1;
+			tp->mptcp->low_prio = loc->low_prio;
+		}
 	}
 }
 
@@ -932,7 +1055,7 @@ void mptcp_v6_send_add_addr(int loc_id, struct mptcp_cb *mpcb)
 	struct tcp_sock *tp;
 
 	mptcp_for_each_tp(mpcb, tp)
-		tp->mptcp->add_addr6 |= (1 << loc_id);
+		tp->mptcp->add_addr6 |= (1U << loc_id);
 }
 
 
@@ -958,7 +1081,8 @@ int mptcp_pm_v6_init(void)
 	}
 
 	ops->slab = kmem_cache_create(ops->slab_name, ops->obj_size, 0,
-				      SLAB_HWCACHE_ALIGN, NULL);
+				      SLAB_HWCACHE_ALIGN | SLAB_DESTROY_BY_RCU,
+				      NULL);
 
 	if (ops->slab == NULL) {
 		ret =  -ENOMEM;
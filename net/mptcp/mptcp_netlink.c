@@ -0,0 +1,495 @@
+/*
+ *	MPTCP implementation - Generic netlink path-manager interface
+ *
+ *	Announces the creation, establishment and destruction of the MPTCP
+ *	connections, as well as the addresses added and removed by the peer,
+ *	on the "mptcp_events" multicast group. A userspace daemon may then
+ *	create, destroy and change the priority of the subflows. Setting
+ *	net.mptcp.mptcp_userspace_pm stops the in-kernel full-mesh/ndiffports
+ *	subflow creation, leaving the policy to the daemon.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/err.h>
+#include <linux/kconfig.h>
+#include <linux/mptcp.h>
+#include <net/genetlink.h>
+#include <net/mptcp.h>
+#include <net/mptcp_v4.h>
+#include <net/mptcp_pm.h>
+#include <net/tcp.h>
+#if IS_ENABLED(CONFIG_IPV6)
+#include <net/ipv6.h>
+#include <net/mptcp_v6.h>
+#endif
+
+static struct genl_family mptcp_genl_family = {
+	.id		= GENL_ID_GENERATE,
+	.hdrsize	= 0,
+	.name		= MPTCP_GENL_NAME,
+	.version	= MPTCP_GENL_VERSION,
+	.maxattr	= MPTCP_ATTR_MAX,
+	.netnsok	= true,
+};
+
+static struct genl_multicast_group mptcp_genl_event_mcgrp = {
+	.name = MPTCP_GENL_MCAST_EVENT_NAME,
+};
+
+static const struct nla_policy mptcp_genl_policy[MPTCP_ATTR_MAX + 1] = {
+	[MPTCP_ATTR_TOKEN]	= { .type = NLA_U32 },
+	[MPTCP_ATTR_FAMILY]	= { .type = NLA_U16 },
+	[MPTCP_ATTR_SADDR4]	= { .type = NLA_U32 },
+	[MPTCP_ATTR_SADDR6]	= { .len = sizeof(struct in6_addr) },
+	[MPTCP_ATTR_DADDR4]	= { .type = NLA_U32 },
+	[MPTCP_ATTR_DADDR6]	= { .len = sizeof(struct in6_addr) },
+	[MPTCP_ATTR_SPORT]	= { .type = NLA_U16 },
+	[MPTCP_ATTR_DPORT]	= { .type = NLA_U16 },
+	[MPTCP_ATTR_REM_ID]	= { .type = NLA_U8 },
+	[MPTCP_ATTR_PATH_INDEX]	= { .type = NLA_U8 },
+	[MPTCP_ATTR_BACKUP]	= { .type = NLA_FLAG },
+};
+
+/****** Events ******/
+
+/* Events are generated from softirq-context, with the subflow or the meta
+ * locked. Don't even allocate the message if nobody is listening.
+ */
+static struct sk_buff *mptcp_nl_event_new(struct net *net, u8 event,
+					  void **hdr)
+{
+	struct sk_buff *msg;
+
+	if (!netlink_has_listeners(net->genl_sock, mptcp_genl_event_mcgrp.id))
+		return NULL;
+
+	msg = nlmsg_new(NLMSG_DEFAULT_SIZE, GFP_ATOMIC);
+	if (!msg)
+		return NULL;
+
+	*hdr = genlmsg_put(msg, 0, 0, &mptcp_genl_family, 0, event);
+	if (!*hdr) {
+		nlmsg_free(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+static void mptcp_nl_event_send(struct net *net, struct sk_buff *msg,
+				void *hdr)
+{
+	genlmsg_end(msg, hdr);
+	genlmsg_multicast_netns(net, msg, 0, mptcp_genl_event_mcgrp.id,
+				GFP_ATOMIC);
+}
+
+static int mptcp_nl_put_addrs(struct sk_buff *msg, struct sock *sk)
+{
+	struct inet_sock *inet = inet_sk(sk);
+
+	if (sk->sk_family == AF_INET || mptcp_v6_is_v4_mapped(sk)) {
+		NLA_PUT_U16(msg, MPTCP_ATTR_FAMILY, AF_INET);
+		NLA_PUT_BE32(msg, MPTCP_ATTR_SADDR4, inet->inet_saddr);
+		NLA_PUT_BE32(msg, MPTCP_ATTR_DADDR4, inet->inet_daddr);
+	}
+#if IS_ENABLED(CONFIG_IPV6)
+	else {
+		NLA_PUT_U16(msg, MPTCP_ATTR_FAMILY, AF_INET6);
+		NLA_PUT(msg, MPTCP_ATTR_SADDR6, sizeof(struct in6_addr),
+			&inet6_sk(sk)->saddr);
+		NLA_PUT(msg, MPTCP_ATTR_DADDR6, sizeof(struct in6_addr),
+			&inet6_sk(sk)->daddr);
+	}
+#endif
+	NLA_PUT_BE16(msg, MPTCP_ATTR_SPORT, inet->inet_sport);
+	NLA_PUT_BE16(msg, MPTCP_ATTR_DPORT, inet->inet_dport);
+
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+/* @sk is the meta-sk, except for MPTCP_EVENT_ESTABLISHED where it is the
+ * initial subflow.
+ */
+void mptcp_nl_conn_event(struct sock *sk, u8 event)
+{
+	struct net *net = sock_net(sk);
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = mptcp_nl_event_new(net, event, &hdr);
+	if (!msg)
+		return;
+
+	NLA_PUT_U32(msg, MPTCP_ATTR_TOKEN, tcp_sk(sk)->mpcb->mptcp_loc_token);
+	if (mptcp_nl_put_addrs(msg, sk))
+		goto nla_put_failure;
+	if (event == MPTCP_EVENT_ESTABLISHED)
+		NLA_PUT_U8(msg, MPTCP_ATTR_PATH_INDEX,
+			   tcp_sk(sk)->mptcp->path_index);
+
+	mptcp_nl_event_send(net, msg, hdr);
+	return;
+
+nla_put_failure:
+	nlmsg_free(msg);
+}
+
+/* @addr is NULL for MPTCP_EVENT_REMOVED */
+void mptcp_nl_addr_event(const struct mptcp_cb *mpcb, u8 event, u8 rem_id,
+			 sa_family_t family, const void *addr, __be16 port)
+{
+	struct net *net = sock_net(mpcb->meta_sk);
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = mptcp_nl_event_new(net, event, &hdr);
+	if (!msg)
+		return;
+
+	NLA_PUT_U32(msg, MPTCP_ATTR_TOKEN, mpcb->mptcp_loc_token);
+	NLA_PUT_U8(msg, MPTCP_ATTR_REM_ID, rem_id);
+	if (addr) {
+		NLA_PUT_U16(msg, MPTCP_ATTR_FAMILY, family);
+		if (family == AF_INET)
+			NLA_PUT(msg, MPTCP_ATTR_DADDR4, sizeof(struct in_addr),
+				addr);
+		else
+			NLA_PUT(msg, MPTCP_ATTR_DADDR6, sizeof(struct in6_addr),
+				addr);
+		if (port)
+			NLA_PUT_BE16(msg, MPTCP_ATTR_DPORT, port);
+	}
+
+	mptcp_nl_event_send(net, msg, hdr);
+	return;
+
+nla_put_failure:
+	nlmsg_free(msg);
+}
+
+/****** Commands ******/
+
+/* Returns the meta-sk (with a reference held) of the connection given by
+ * MPTCP_ATTR_TOKEN, if it belongs to the netns of the requester.
+ */
+static struct sock *mptcp_nl_get_meta(struct genl_info *info)
+{
+	struct sock *meta_sk;
+
+	if (!info->attrs[MPTCP_ATTR_TOKEN])
+		return ERR_PTR(-EINVAL);
+
+	meta_sk = mptcp_hash_find(nla_get_u32(info->attrs[MPTCP_ATTR_TOKEN]));
+	if (!meta_sk)
+		return ERR_PTR(-ENOENT);
+
+	if (!net_eq(sock_net(meta_sk), genl_info_net(info))) {
+		sock_put(meta_sk);
+		return ERR_PTR(-ENOENT);
+	}
+
+	return meta_sk;
+}
+
+/* Same locking as the subflow-workers of the in-kernel path-manager */
+static int mptcp_nl_lock(struct sock *meta_sk)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+
+	mutex_lock(&mpcb->mutex);
+	lock_sock_nested(meta_sk, SINGLE_DEPTH_NESTING);
+
+	if (sock_flag(meta_sk, SOCK_DEAD) || !tcp_sk(meta_sk)->mpc)
+		return -ENOTCONN;
+
+	return 0;
+}
+
+static void mptcp_nl_unlock(struct sock *meta_sk)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+
+	release_sock(meta_sk);
+	mutex_unlock(&mpcb->mutex);
+	sock_put(meta_sk);
+}
+
+static struct sock *mptcp_nl_get_sub(struct mptcp_cb *mpcb,
+				     struct genl_info *info)
+{
+	struct sock *sk;
+	u8 pi;
+
+	if (!info->attrs[MPTCP_ATTR_PATH_INDEX])
+		return ERR_PTR(-EINVAL);
+
+	pi = nla_get_u8(info->attrs[MPTCP_ATTR_PATH_INDEX]);
+	mptcp_for_each_sk(mpcb, sk) {
+		if (tcp_sk(sk)->mptcp->path_index != pi)
+			continue;
+
+		/* A subflow that is already closing is as good as gone */
+		if ((1 << sk->sk_state) & (TCPF_FIN_WAIT1 | TCPF_FIN_WAIT2 |
+					   TCPF_CLOSING | TCPF_LAST_ACK |
+					   TCPF_CLOSE))
+			break;
+
+		return sk;
+	}
+
+	return ERR_PTR(-ENOENT);
+}
+
+static int mptcp_nl_sub_create4(struct sock *meta_sk, struct genl_info *info)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	__be32 saddr = nla_get_be32(info->attrs[MPTCP_ATTR_SADDR4]);
+	__be32 daddr = nla_get_be32(info->attrs[MPTCP_ATTR_DADDR4]);
+	struct mptcp_loc4 loc;
+	int i, j;
+
+	mptcp_for_each_bit_set(mpcb->loc4_bits, i) {
+		if (mpcb->addr4[i].addr.s_addr == saddr)
+			goto found_loc;
+	}
+	return -EADDRNOTAVAIL;
+
+found_loc:
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, j) {
+		if (mpcb->rx_opt.addr4[j].addr.s_addr == daddr)
+			goto found_rem;
+	}
+	return -EHOSTUNREACH;
+
+found_rem:
+	loc = mpcb->addr4[i];
+	if (info->attrs[MPTCP_ATTR_BACKUP])
+		loc.low_prio = 1;
+
+	return mptcp_init4_subsockets(meta_sk, &loc, &mpcb->rx_opt.addr4[j]);
+}
+
+#if IS_ENABLED(CONFIG_IPV6)
+static int mptcp_nl_sub_create6(struct sock *meta_sk, struct genl_info *info)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	const struct in6_addr *saddr, *daddr;
+	struct mptcp_loc6 loc;
+	int i, j;
+
+	saddr = nla_data(info->attrs[MPTCP_ATTR_SADDR6]);
+	daddr = nla_data(info->attrs[MPTCP_ATTR_DADDR6]);
+
+	mptcp_for_each_bit_set(mpcb->loc6_bits, i) {
+		if (ipv6_addr_equal(&mpcb->addr6[i].addr, saddr))
+			goto found_loc;
+	}
+	return -EADDRNOTAVAIL;
+
+found_loc:
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, j) {
+		if (ipv6_addr_equal(&mpcb->rx_opt.addr6[j].addr, daddr))
+			goto found_rem;
+	}
+	return -EHOSTUNREACH;
+
+found_rem:
+	loc = mpcb->addr6[i];
+	if (info->attrs[MPTCP_ATTR_BACKUP])
+		loc.low_prio = 1;
+
+	return mptcp_init6_subsockets(meta_sk, &loc, &mpcb->rx_opt.addr6[j]);
+}
+#endif
+
+static int mptcp_nl_sub_create(struct sk_buff *skb, struct genl_info *info)
+{
+	struct sock *meta_sk;
+	struct mptcp_cb *mpcb;
+	struct sk_buff *msg;
+	void *hdr;
+	u8 pi = 0;
+	int ret;
+
+	meta_sk = mptcp_nl_get_meta(info);
+	if (IS_ERR(meta_sk))
+		return PTR_ERR(meta_sk);
+	mpcb = tcp_sk(meta_sk)->mpcb;
+
+	msg = nlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg) {
+		sock_put(meta_sk);
+		return -ENOMEM;
+	}
+
+	ret = mptcp_nl_lock(meta_sk);
+	if (ret)
+		goto out_unlock;
+
+	/* In fallback-mode, only one subflow may be used */
+	if (mpcb->infinite_mapping || mpcb->send_infinite_mapping) {
+		ret = -EPERM;
+		goto out_unlock;
+	}
+
+	if (info->attrs[MPTCP_ATTR_SADDR4] && info->attrs[MPTCP_ATTR_DADDR4])
+		ret = mptcp_nl_sub_create4(meta_sk, info);
+#if IS_ENABLED(CONFIG_IPV6)
+	else if (info->attrs[MPTCP_ATTR_SADDR6] &&
+		 info->attrs[MPTCP_ATTR_DADDR6])
+		ret = mptcp_nl_sub_create6(meta_sk, info);
+#endif
+	else
+		ret = -EINVAL;
+
+	/* mptcp_add_sock() put the new subflow at the head of the list */
+	if (!ret)
+		pi = mpcb->connection_list->mptcp->path_index;
+
+out_unlock:
+	mptcp_nl_unlock(meta_sk);
+
+	if (ret)
+		goto out_free;
+
+	hdr = genlmsg_put_reply(msg, info, &mptcp_genl_family, 0,
+				MPTCP_CMD_SUB_CREATE);
+	if (!hdr)
+		goto nla_put_failure;
+
+	NLA_PUT_U8(msg, MPTCP_ATTR_PATH_INDEX, pi);
+	genlmsg_end(msg, hdr);
+
+	return genlmsg_reply(msg, info);
+
+nla_put_failure:
+	ret = -EMSGSIZE;
+out_free:
+	nlmsg_free(msg);
+	return ret;
+}
+
+static int mptcp_nl_sub_destroy(struct sk_buff *skb, struct genl_info *info)
+{
+	struct sock *meta_sk, *sk;
+	int ret;
+
+	meta_sk = mptcp_nl_get_meta(info);
+	if (IS_ERR(meta_sk))
+		return PTR_ERR(meta_sk);
+
+	ret = mptcp_nl_lock(meta_sk);
+	if (ret)
+		goto out_unlock;
+
+	sk = mptcp_nl_get_sub(tcp_sk(meta_sk)->mpcb, info);
+	if (IS_ERR(sk)) {
+		ret = PTR_ERR(sk);
+		goto out_unlock;
+	}
+
+	/* Like a REMOVE_ADDR from the peer - see mptcp_send_reset_rem_id */
+	local_bh_disable();
+	mptcp_reinject_data(sk, 0);
+	sk->sk_err = ECONNRESET;
+	tcp_send_active_reset(sk, GFP_ATOMIC);
+	mptcp_sub_force_close(sk);
+	local_bh_enable();
+
+out_unlock:
+	mptcp_nl_unlock(meta_sk);
+	return ret;
+}
+
+static int mptcp_nl_sub_priority(struct sk_buff *skb, struct genl_info *info)
+{
+	struct sock *meta_sk, *sk;
+	struct tcp_sock *tp;
+	int ret, low_prio;
+
+	meta_sk = mptcp_nl_get_meta(info);
+	if (IS_ERR(meta_sk))
+		return PTR_ERR(meta_sk);
+
+	ret = mptcp_nl_lock(meta_sk);
+	if (ret)
+		goto out_unlock;
+
+	sk = mptcp_nl_get_sub(tcp_sk(meta_sk)->mpcb, info);
+	if (IS_ERR(sk)) {
+		ret = PTR_ERR(sk);
+		goto out_unlock;
+	}
+	tp = tcp_sk(sk);
+
+	low_prio = info->attrs[MPTCP_ATTR_BACKUP] ? 1 : 0;
+	if (low_prio != tp->mptcp->low_prio) {
+		tp->mptcp->low_prio = low_prio;
+		tp->mptcp->send_mp_prio = 1;
+
+		/* Announce it right away with an MP_PRIO. Otherwise, it goes
+		 * out with the first ACK once the subflow is established.
+		 */
+		if (sk->sk_state == TCP_ESTABLISHED) {
+			local_bh_disable();
+			tcp_send_ack(sk);
+			local_bh_enable();
+		}
+	}
+
+out_unlock:
+	mptcp_nl_unlock(meta_sk);
+	return ret;
+}
+
+static struct genl_ops mptcp_genl_ops[] = {
+	{
+		.cmd = MPTCP_CMD_SUB_CREATE,
+		.doit = mptcp_nl_sub_create,
+		.policy = mptcp_genl_policy,
+		.flags = GENL_ADMIN_PERM,
+	},
+	{
+		.cmd = MPTCP_CMD_SUB_DESTROY,
+		.doit = mptcp_nl_sub_destroy,
+		.policy = mptcp_genl_policy,
+		.flags = GENL_ADMIN_PERM,
+	},
+	{
+		.cmd = MPTCP_CMD_SUB_PRIORITY,
+		.doit = mptcp_nl_sub_priority,
+		.policy = mptcp_genl_policy,
+		.flags = GENL_ADMIN_PERM,
+	},
+};
+
+int mptcp_nl_init(void)
+{
+	int ret;
+
+	ret = genl_register_family_with_ops(&mptcp_genl_family, mptcp_genl_ops,
+					    ARRAY_SIZE(mptcp_genl_ops));
+	if (ret)
+		return ret;
+
+	ret = genl_register_mc_group(&mptcp_genl_family,
+				     &mptcp_genl_event_mcgrp);
+	if (ret)
+		genl_unregister_family(&mptcp_genl_family);
+
+	return ret;
+}
+
+void mptcp_nl_undo(void)
+{
+	/* Also unregisters the multicast group */
+	genl_unregister_family(&mptcp_genl_family);
+}
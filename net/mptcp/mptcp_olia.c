@@ -35,150 +35,99 @@ struct mptcp_olia {
 	int	mptcp_snd_cwnd_cnt;
 	u32	mptcp_previous_cwnd;
 	u32	mptcp_ssthresh;
+	u32	epsilon_gen;	/* cc_agg.gen the epsilon is based on */
 };
 
-static inline int mptcp_olia_sk_can_send(const struct sock *sk)
-{
-	return mptcp_sk_can_send(sk) && tcp_sk(sk)->srtt;
-}
-
 static inline u64 mptcp_olia_scale(u32 val, int scale)
 {
 	return (u64) val << scale;
 }
 
-/* take care of artificially inflate (see RFC5681)
- * of cwnd during fast-retransmit phase
- */
-static u32 mptcp_get_crt_cwnd(struct sock *sk)
-{
-	struct inet_connection_sock *icsk = inet_csk(sk);
-
-	if (icsk->icsk_ca_state == TCP_CA_Recovery)
-		return tcp_sk(sk)->snd_ssthresh;
-	else
-		return tcp_sk(sk)->snd_cwnd;
-}
-
 /* return the dominator of the first term of  the increasing term */
-static u64 mptcp_get_rate(struct mptcp_cb* mpcb , u32 path_rtt)
+static u64 mptcp_get_rate(struct mptcp_cb *mpcb, u32 path_rtt)
 {
-	struct sock *sk;
-	u64 rate = 1; /* We have to avoid a zero-rate because it is used as a divisor */
+	/* We have to avoid a zero-rate because it is used as a divisor */
+	u64 rate = 1 + ((mpcb->cc_agg.sum_rate * path_rtt) >>
+			(MPTCP_CC_AGG_SCALE - scale));
 
-	mptcp_for_each_sk(mpcb, sk) {
-		struct tcp_sock *tp = tcp_sk(sk);
-		u64 scaled_num;
-		u32 tmp_cwnd;
-
-		if (!mptcp_olia_sk_can_send(sk))
-			continue;
-
-		tmp_cwnd = mptcp_get_crt_cwnd(sk);
-		scaled_num = mptcp_olia_scale(tmp_cwnd, scale) * path_rtt;
-		rate += div_u64(scaled_num , tp->srtt);
-	}
 	rate *= rate;
 	return rate;
 }
 
-/* find the maximum cwnd, used to find set M */
-static u32 mptcp_get_max_cwnd(struct mptcp_cb* mpcb)
-{
-	struct sock *sk;
-	u32 best_cwnd = 0;
-
-	mptcp_for_each_sk(mpcb, sk) {
-		u32 tmp_cwnd;
-
-		if (!mptcp_olia_sk_can_send(sk))
-			continue;
-
-		tmp_cwnd = mptcp_get_crt_cwnd(sk);
-		if (tmp_cwnd > best_cwnd)
-			best_cwnd = tmp_cwnd;
-	}
-	return best_cwnd;
-}
-
-static void mptcp_get_epsilon(struct mptcp_cb* mpcb)
+/* The loss-intervals of the subflows only change in mptcp_olia_set_state,
+ * which forces the recalculation. Otherwise, epsilon depends on the set M
+ * of the paths with the largest cwnd and on the set B of the best paths,
+ * which depends on the srtt of every subflow. cc_agg.gen changes with any
+ * of these, thus epsilon is recalculated when it does. The cwnd and srtt
+ * are the snapshots of cc_agg.
+ */
+static void mptcp_get_epsilon(struct mptcp_cb *mpcb)
 {
 	struct mptcp_olia *ca;
-	struct tcp_sock *tp;
+	struct mptcp_tcp_sock *mptcp;
 	struct sock *sk;
 	u64 tmp_int, tmp_rtt, best_int = 0, best_rtt = 1;
-	u32 max_cwnd = 1, best_cwnd = 1, tmp_cwnd;
-	u8 M = 0, B_not_M = 0;
-
-	/* TODO - integrate this in the following loop - we just want to iterate once */
-
-	max_cwnd = mptcp_get_max_cwnd(mpcb);
+	u32 max_cwnd = mpcb->cc_agg.max_cwnd;
+	u8 M = mpcb->cc_agg.cnt_max, B_not_M = 0;
 
 	/* find the best path */
 	mptcp_for_each_sk(mpcb, sk) {
-		tp = tcp_sk(sk);
+		mptcp = tcp_sk(sk)->mptcp;
 		ca = inet_csk_ca(sk);
 
-		if (!mptcp_olia_sk_can_send(sk))
+		if (!mptcp->cc_counted)
 			continue;
 
-		tmp_rtt = tp->srtt * tp->srtt;
+		tmp_rtt = (u64)mptcp->cc_srtt * mptcp->cc_srtt;
 		/* TODO - check here and rename variables */
 		tmp_int = max(ca->mptcp_loss3 - ca->mptcp_loss2,
 			      ca->mptcp_loss2 - ca->mptcp_loss1);
 
-		tmp_cwnd = mptcp_get_crt_cwnd(sk);
 		if (tmp_int * best_rtt >= best_int * tmp_rtt){
 			best_rtt = tmp_rtt;
 			best_int = tmp_int;
-			best_cwnd = tmp_cwnd;
 		}
 	}
 
-	/* TODO - integrate this here in mptcp_get_max_cwnd and in the previous loop */
-	/* find the size of M and B_not_M */
+	/* find the size of B_not_M */
 	mptcp_for_each_sk(mpcb, sk) {
-		tp = tcp_sk(sk);
+		mptcp = tcp_sk(sk)->mptcp;
 		ca = inet_csk_ca(sk);
 
-		if (!mptcp_olia_sk_can_send(sk))
+		if (!mptcp->cc_counted || mptcp->cc_cwnd == max_cwnd)
 			continue;
 
-		tmp_cwnd = mptcp_get_crt_cwnd(sk);
-		if (tmp_cwnd == max_cwnd){
-			M++;
-		} else {
-			tmp_rtt = tp->srtt * tp->srtt;
-			tmp_int = max(ca->mptcp_loss3 - ca->mptcp_loss2,
-				      ca->mptcp_loss2 - ca->mptcp_loss1);
+		tmp_rtt = (u64)mptcp->cc_srtt * mptcp->cc_srtt;
+		tmp_int = max(ca->mptcp_loss3 - ca->mptcp_loss2,
+			      ca->mptcp_loss2 - ca->mptcp_loss1);
 
-			if (tmp_int * best_rtt == best_int * tmp_rtt)
-				B_not_M++;
-		}
+		if (tmp_int * best_rtt == best_int * tmp_rtt)
+			B_not_M++;
 	}
 
 	/* check if the path is in M or B_not_M and set the value of epsilon accordingly */
 	mptcp_for_each_sk(mpcb, sk) {
-		tp = tcp_sk(sk);
+		mptcp = tcp_sk(sk)->mptcp;
 		ca = inet_csk_ca(sk);
 
-		if (!mptcp_olia_sk_can_send(sk))
+		if (!mptcp->cc_counted)
 			continue;
 
+		ca->epsilon_gen = mpcb->cc_agg.gen;
+
 		if (B_not_M == 0){
 			ca->epsilon_num = 0;
 			ca->epsilon_den = 1;
 		} else {
-			tmp_rtt = tp->srtt * tp->srtt;
+			tmp_rtt = (u64)mptcp->cc_srtt * mptcp->cc_srtt;
 			tmp_int = max(ca->mptcp_loss3 - ca->mptcp_loss2,
 				      ca->mptcp_loss2 - ca->mptcp_loss1);
-			tmp_cwnd = mptcp_get_crt_cwnd(sk);
 
-			if (tmp_cwnd < max_cwnd &&
+			if (mptcp->cc_cwnd < max_cwnd &&
 			    tmp_int * best_rtt == best_int * tmp_rtt){
 				ca->epsilon_num = 1;
 				ca->epsilon_den = mpcb->cnt_established * B_not_M;
-			} else if (tmp_cwnd == max_cwnd){
+			} else if (mptcp->cc_cwnd == max_cwnd){
 				ca->epsilon_num = -1;
 				ca->epsilon_den = mpcb->cnt_established  * M;
 			} else {
@@ -205,6 +154,7 @@ static void mptcp_olia_init(struct sock *sk)
 		ca->mptcp_snd_cwnd_cnt = 0;
 		ca->epsilon_num = 0;
 		ca->epsilon_den = 1;
+		ca->epsilon_gen = tp->mpcb->cc_agg.gen - 1;
 	}
 }
 
@@ -231,6 +181,9 @@ static void mptcp_olia_set_state(struct sock *sk, u8 new_state)
 			else
 				ca->mptcp_ssthresh =
 				    max(ca->mptcp_previous_cwnd >> 1U, 1U);
+
+			/* The loss-intervals changed */
+			mpcb->cc_agg.gen++;
 		}
 	}
 
@@ -269,7 +222,9 @@ static void mptcp_olia_cong_avoid(struct sock *sk, u32 ack, u32 in_flight)
 		return;
 	}
 
-	mptcp_get_epsilon(mpcb);
+	mptcp_cc_agg_update(sk);
+	if (ca->epsilon_gen != mpcb->cc_agg.gen)
+		mptcp_get_epsilon(mpcb);
 	rate = mptcp_get_rate(mpcb, tp->srtt);
 	cwnd_scaled = mptcp_olia_scale(tp->snd_cwnd, scale);
 	inc_den = ca->epsilon_den * tp->snd_cwnd * rate;
@@ -34,149 +34,83 @@
 #include <net/mptcp.h>
 #include <net/sock.h>
 
-/* If the sub-socket sk available to send the skb? */
-static int mptcp_is_available(struct sock *sk, struct sk_buff *skb)
+/* Get the data-sequence range covered by the segment @skb of the subflow @sk,
+ * out of its DSS-mapping.
+ */
+int mptcp_skb_data_seq(const struct sk_buff *skb, const struct sock *sk,
+		       u32 *seq, u32 *end_seq)
 {
-	struct tcp_sock *tp = tcp_sk(sk);
+	const struct tcp_skb_cb *tcb = TCP_SKB_CB(skb);
+	u32 data_seq, sub_seq;
 
-	/* Set of states for which we are allowed to send data */
-	if (!mptcp_sk_can_send(sk))
-		return 0;
-
-	/* We do not send data on this subflow unless it is
-	 * fully established, i.e. the 4th ack has been received.
-	 */
-	if (tp->mptcp->pre_established)
-		return 0;
+	if (!mptcp_is_data_seq(skb))
+		return -1;
 
-	if (tp->pf || (tp->mpcb->noneligible & mptcp_pi_to_flag(tp->mptcp->path_index)) ||
-	    inet_csk(sk)->icsk_ca_state == TCP_CA_Loss)
-		return 0;
+	data_seq = tcb->dss_map.data_seq;
+	sub_seq = tcb->dss_map.subseq + tcp_sk(sk)->mptcp->snt_isn;
 
-	/* Don't send on this subflow if we bypass the allowed send-window at
-	 * the per-subflow level. Similar to tcp_snd_wnd_test, but manually
-	 * calculated end_seq (because here at this point end_seq is still at
-	 * the meta-level).
+	/* The mapping covers the whole segment as it was entailed on
+	 * the subflow. Since then, the segment may have been split
+	 * or its head may have been trimmed. Thus, we derive the
+	 * data-seq from the offset of the segment within the mapping.
+	 *
+	 * An empty DATA_FIN has its subseq set to 0 (see
+	 * mptcp_skb_entail).
 	 */
-	if (skb && after(tp->write_seq + skb->len, tcp_wnd_end(tp)))
-		return 0;
-
-	return tcp_cwnd_test(tp, skb);
-}
+	if (skb->len)
+		*seq = data_seq + (tcb->seq - sub_seq);
+	else
+		*seq = data_seq;
+	*end_seq = *seq + skb->len + (mptcp_is_data_fin(skb) ? 1 : 0);
 
-/* Are we not allowed to reinject this skb on tp? */
-static int mptcp_dont_reinject_skb(struct tcp_sock *tp, struct sk_buff *skb)
-{
-	/* If the skb has already been enqueued in this sk, try to find
-	 * another one.
-	 * An exception is a DATA_FIN without data. These ones are not
-	 * reinjected at the subflow-level as they do not consume
-	 * subflow-sequence-number space.
-	 */
-	return skb &&
-		/* We either have a data_fin with data or not a data_fin */
-		((mptcp_is_data_fin(skb) && TCP_SKB_CB(skb)->end_seq - TCP_SKB_CB(skb)->seq  > 1) ||
-		!mptcp_is_data_fin(skb)) &&
-		/* Has the skb already been enqueued into this subsocket? */
-		mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask;
+	return 0;
 }
 
-/**
- * This is the scheduler. This function decides on which flow to send
- * a given MSS. If all subflows are found to be busy, NULL is returned
- * The flow is selected based on the shortest RTT.
- * If all paths have full cong windows, we simply return NULL.
- *
- * Additionally, this function is aware of the backup-subflows.
+/* The first segment of the meta-send-queue that has been sent and ends after
+ * seq - or NULL. The send-queue of a subflow is mostly sorted by data-seq as
+ * well. Thus, while walking it, the walk over the meta-send-queue resumes at
+ * *hint rather than at its head.
  */
-static struct sock *get_available_subflow(struct sock *meta_sk,
-					  struct sk_buff *skb)
+static struct sk_buff *mptcp_meta_skb_find(struct sock *meta_sk, u32 seq,
+					   struct sk_buff **hint)
 {
-	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
-	struct sock *sk, *bestsk = NULL, *lowpriosk = NULL, *backupsk = NULL;
-	u32 min_time_to_peer = 0xffffffff, lowprio_min_time_to_peer = 0xffffffff;
-	int cnt_backups = 0;
-
-	/* if there is only one subflow, bypass the scheduling function */
-	if (mpcb->cnt_subflows == 1) {
-		bestsk = (struct sock *) mpcb->connection_list;
-		if (!mptcp_is_available(bestsk, skb))
-			bestsk = NULL;
-		return bestsk;
-	}
-
-	/* Answer data_fin on same subflow!!! */
-	if (meta_sk->sk_shutdown & RCV_SHUTDOWN &&
-	    skb && mptcp_is_data_fin(skb)) {
-		mptcp_for_each_sk(mpcb, sk) {
-			if (tcp_sk(sk)->mptcp->path_index == mpcb->dfin_path_index &&
-			    mptcp_is_available(sk, skb))
-				return sk;
-		}
-	}
-
-	/* First, find the best subflow */
-	mptcp_for_each_sk(mpcb, sk) {
-		struct tcp_sock *tp = tcp_sk(sk);
-		if (tp->rx_opt.low_prio || tp->mptcp->low_prio)
-			cnt_backups++;
+	struct sk_buff *skb = *hint;
 
-		if (mptcp_dont_reinject_skb(tp, skb))
-			continue;
+	if (!skb || after(TCP_SKB_CB(skb)->seq, seq))
+		skb = tcp_write_queue_head(meta_sk);
+	if (!skb)
+		return NULL;
 
-		if (!mptcp_is_available(sk, skb))
-			continue;
+	tcp_for_write_queue_from(skb, meta_sk) {
+		if (skb == tcp_send_head(meta_sk))
+			break;
 
-		if ((tp->rx_opt.low_prio || tp->mptcp->low_prio) &&
-		    tp->srtt < lowprio_min_time_to_peer &&
-		    !(skb && mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask)) {
-			lowprio_min_time_to_peer = tp->srtt;
-			lowpriosk = sk;
-		} else if (!(tp->rx_opt.low_prio || tp->mptcp->low_prio) &&
-		    tp->srtt < min_time_to_peer &&
-		    !(skb && mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask)) {
-			min_time_to_peer = tp->srtt;
-			bestsk = sk;
+		if (after(TCP_SKB_CB(skb)->end_seq, seq)) {
+			*hint = skb;
+			return skb;
 		}
-
-		if (skb && mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask)
-			backupsk = sk;
 	}
 
-	if (mpcb->cnt_subflows == cnt_backups && lowpriosk)
-		return lowpriosk;
-	if (bestsk)
-		return bestsk;
-	return backupsk;
-}
-
-static struct mp_dss *mptcp_skb_find_dss(const struct sk_buff *skb)
-{
-	if (!mptcp_is_data_seq(skb))
-		return NULL;
-
-	return (struct mp_dss *)(skb->data - (MPTCP_SUB_LEN_DSS_ALIGN +
-			      	      	      MPTCP_SUB_LEN_ACK_ALIGN +
-			      	      	      MPTCP_SUB_LEN_SEQ_ALIGN));
+	return NULL;
 }
 
 /* Reinject data from one TCP subflow to the meta_sk. If sk == NULL, we are
  * coming from the meta-retransmit-timer
  */
 static int __mptcp_reinject_data(struct sk_buff *orig_skb, struct sock *meta_sk,
-				 struct sock *sk, int clone_it)
+				 struct sock *sk, int clone_it,
+				 struct sk_buff **hint)
 {
-	struct sk_buff *skb, *skb1;
+	struct sk_buff *skb;
 	struct tcp_sock *meta_tp = tcp_sk(meta_sk);
 	struct mptcp_cb *mpcb = meta_tp->mpcb;
-	u32 seq, end_seq;
 
 	if (clone_it) {
-		/* pskb_copy is necessary here, because the TCP/IP-headers
-		 * will be changed when it's going to be reinjected on another
-		 * subflow.
+		/* The DSS-mapping is built at transmit-time out of the
+		 * tcp_skb_cb. Thus, a clone is enough - the payload stays
+		 * shared with the original segment.
 		 */
-		skb = pskb_copy(orig_skb, GFP_ATOMIC);
+		skb = skb_clone(orig_skb, GFP_ATOMIC);
 	} else {
 		__skb_unlink(orig_skb, &sk->sk_write_queue);
 		sock_set_flag(sk, SOCK_QUEUE_SHRUNK);
@@ -190,32 +124,25 @@ static int __mptcp_reinject_data(struct sk_buff *orig_skb, struct sock *meta_sk,
 	/* get the data-seq and end-data-seq and store them again in the
 	 * tcp_skb_cb
 	 */
-	if (sk) {
-		struct mp_dss *mpdss = mptcp_skb_find_dss(orig_skb);
-		u32 *p32;
-		u16 *p16;
-
-		if (!mpdss || !mpdss->M) {
-			__kfree_skb(skb);
-			return -1;
-		}
-
-		/* Move the pointer to the data-seq */
-		p32 = (u32 *)mpdss;
-		p32++;
-		if (mpdss->A) {
-			p32++;
-			if (mpdss->a)
-				p32++;
-		}
+	if (sk && mptcp_skb_data_seq(orig_skb, sk, &TCP_SKB_CB(skb)->seq,
+				     &TCP_SKB_CB(skb)->end_seq)) {
+		__kfree_skb(skb);
+		return -1;
+	}
 
-		TCP_SKB_CB(skb)->seq = ntohl(*p32);
+	/* The DSS-mapping is a union with the path-mask. A reinjection coming
+	 * from a subflow gets its path-mask from the meta-send-queue.
+	 */
+	if (sk) {
+		struct sk_buff *meta_skb;
 
-		/* Get the data_len to calculate the end_data_seq */
-		p32++;
-		p32++;
-		p16 = (u16 *)p32;
-		TCP_SKB_CB(skb)->end_seq = ntohs(*p16) + TCP_SKB_CB(skb)->seq;
+		meta_skb = mptcp_meta_skb_find(meta_sk, TCP_SKB_CB(skb)->seq,
+					       hint);
+		if (meta_skb && TCP_SKB_CB(meta_skb)->seq == TCP_SKB_CB(skb)->seq)
+			TCP_SKB_CB(skb)->path_mask = TCP_SKB_CB(meta_skb)->path_mask;
+		else
+			TCP_SKB_CB(skb)->path_mask = 0;
+		TCP_SKB_CB(skb)->acked_pi = 0;
 	}
 
 	skb->sk = meta_sk;
@@ -226,67 +153,13 @@ static int __mptcp_reinject_data(struct sk_buff *orig_skb, struct sock *meta_sk,
 		return -1;
 	}
 
-	/* If it's empty, just add */
-	if (skb_queue_empty(&mpcb->reinject_queue)) {
-		skb_queue_head(&mpcb->reinject_queue, skb);
-		return 0;
-	}
-
-	/* Find place to insert skb - or even we can 'drop' it, as the
-	 * data is already covered by other skb's in the reinject-queue.
-	 *
-	 * This is inspired by code from tcp_data_queue.
-	 */
-
-	skb1 = skb_peek_tail(&mpcb->reinject_queue);
-	seq = TCP_SKB_CB(skb)->seq;
-	while (1) {
-		if (!after(TCP_SKB_CB(skb1)->seq, seq))
-			break;
-		if (skb_queue_is_first(&mpcb->reinject_queue, skb1)) {
-			skb1 = NULL;
-			break;
-		}
-		skb1 = skb_queue_prev(&mpcb->reinject_queue, skb1);
-	}
-
-	/* Do skb overlap to previous one? */
-	end_seq = TCP_SKB_CB(skb)->end_seq;
-	if (skb1 && before(seq, TCP_SKB_CB(skb1)->end_seq)) {
-		if (!after(end_seq, TCP_SKB_CB(skb1)->end_seq)) {
-			/* All the bits are present. Don't reinject */
-			__kfree_skb(skb);
-			return 0;
-		}
-		if (seq == TCP_SKB_CB(skb1)->seq) {
-			if (skb_queue_is_first(&mpcb->reinject_queue, skb1))
-				skb1 = NULL;
-			else
-				skb1 = skb_queue_prev(&mpcb->reinject_queue, skb1);
-		}
-	}
-	if (!skb1)
-		__skb_queue_head(&mpcb->reinject_queue, skb);
-	else
-		__skb_queue_after(&mpcb->reinject_queue, skb1, skb);
-
-	/* And clean segments covered by new one as whole. */
-	while (!skb_queue_is_last(&mpcb->reinject_queue, skb)) {
-		skb1 = skb_queue_next(&mpcb->reinject_queue, skb);
-
-		if (!after(end_seq, TCP_SKB_CB(skb1)->seq))
-			break;
-
-		__skb_unlink(skb1, &mpcb->reinject_queue);
-		__kfree_skb(skb1);
-	}
-	return 0;
+	return mptcp_reinject_queue_add(mpcb, skb);
 }
 
 /* Inserts data into the reinject queue */
 void mptcp_reinject_data(struct sock *sk, int clone_it)
 {
-	struct sk_buff *skb_it, *tmp;
+	struct sk_buff *skb_it, *tmp, *hint = NULL;
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sock *meta_sk = tp->meta_sk;
 
@@ -299,15 +172,17 @@ void mptcp_reinject_data(struct sock *sk, int clone_it)
 			continue;
 
 		/* Go to next segment, if it failed */
-		if (__mptcp_reinject_data(skb_it, meta_sk, sk, clone_it))
+		if (__mptcp_reinject_data(skb_it, meta_sk, sk, clone_it, &hint))
 			continue;
+
+		NET_INC_STATS(sock_net(meta_sk), LINUX_MIB_MPTCPREINJECTQUEUE);
 	}
 
 	skb_it = tcp_write_queue_tail(meta_sk);
 	/* If sk has sent the empty data-fin, we have to reinject it too. */
 	if (skb_it && mptcp_is_data_fin(skb_it) && skb_it->len == 0 &&
 	    TCP_SKB_CB(skb_it)->path_mask & mptcp_pi_to_flag(tp->mptcp->path_index)) {
-		__mptcp_reinject_data(skb_it, meta_sk, NULL, 1);
+		__mptcp_reinject_data(skb_it, meta_sk, NULL, 1, NULL);
 	}
 
 	mptcp_push_pending_frames(meta_sk);
@@ -360,9 +235,7 @@ static void mptcp_combine_dfin(struct sk_buff *skb, struct sock *meta_sk,
 static struct sk_buff *mptcp_skb_entail(struct sock *sk, struct sk_buff *skb,
 					int reinject)
 {
-	__be32 *ptr;
 	__u16 data_len;
-	struct mp_dss *mdss;
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sock *meta_sk = mptcp_meta_sk(sk);
 	struct mptcp_cb *mpcb = tp->mpcb;
@@ -376,16 +249,20 @@ static struct sk_buff *mptcp_skb_entail(struct sock *sk, struct sk_buff *skb,
 					(mpcb->snd_hiseq_index ?
 					 MPTCPHDR_SEQ64_INDEX : 0);
 		}
-		/* The segment may be a meta-level
-		 * retransmission. In this case, we also have to
-		 * copy the TCP/IP-headers. (pskb_copy)
+		/* The DSS-mapping is not written into the segment (see
+		 * mptcp_options_write). Thus, even a meta-level
+		 * retransmission can share the payload with the meta-segment.
+		 *
+		 * A GSO-segment needs its own skb_shared_info, as the subflow
+		 * may later change its gso-settings (e.g., when splitting it
+		 * upon a retransmission).
 		 */
-		if (reinject == -1)
+		if (tcp_skb_pcount(skb) > 1)
 			subskb = pskb_copy(skb, GFP_ATOMIC);
 		else
 			subskb = skb_clone(skb, GFP_ATOMIC);
 	} else {
-		__skb_unlink(skb, &mpcb->reinject_queue);
+		mptcp_reinject_queue_unlink(mpcb, skb);
 		subskb = skb;
 	}
 	if (!subskb)
@@ -393,44 +270,29 @@ static struct sk_buff *mptcp_skb_entail(struct sock *sk, struct sk_buff *skb,
 
 	TCP_SKB_CB(skb)->path_mask |= mptcp_pi_to_flag(tp->mptcp->path_index);
 
-	if (!(sk->sk_route_caps & NETIF_F_ALL_CSUM) &&
-	      skb->ip_summed == CHECKSUM_PARTIAL) {
+	/* The DSS-checksum needs the checksum of the payload in skb->csum.
+	 * E.g., do_tcp_sendpages does not compute it.
+	 */
+	if ((!(sk->sk_route_caps & NETIF_F_ALL_CSUM) ||
+	     mpcb->rx_opt.dss_csum) &&
+	    skb->ip_summed == CHECKSUM_PARTIAL) {
 		subskb->csum = skb->csum = skb_checksum(skb, 0, skb->len, 0);
 		subskb->ip_summed = skb->ip_summed = CHECKSUM_NONE;
 	}
 
-	/* The subskb is going in the subflow send-queue. Its path-mask
-	 * is not needed anymore and MUST be set to 0, as the path-mask
-	 * is a union with inet_skb_param.
+	/* The subskb is going in the subflow send-queue. Its path-mask is
+	 * not needed anymore and makes room for the DSS-mapping.
 	 */
 	tcb = TCP_SKB_CB(subskb);
-	tcb->path_mask = 0;
 
 	if (mptcp_is_data_fin(subskb))
 		mptcp_combine_dfin(subskb, meta_sk, sk);
 
-
-	/**** Write MPTCP DSS-option to the packet. ****/
-	ptr = (__be32 *)(subskb->data - (MPTCP_SUB_LEN_DSS_ALIGN +
-				      MPTCP_SUB_LEN_ACK_ALIGN +
-				      MPTCP_SUB_LEN_SEQ_ALIGN));
-
-	/* Then we start writing it from the start */
-	mdss = (struct mp_dss *) ptr;
-
-	mdss->kind = TCPOPT_MPTCP;
-	mdss->sub = MPTCP_SUB_DSS;
-	mdss->rsv1 = 0;
-	mdss->rsv2 = 0;
-	mdss->F = (mptcp_is_data_fin(subskb) ? 1 : 0);
-	mdss->m = 0;
-	mdss->M = 1;
-	mdss->a = 0;
-	mdss->A = 1;
-	mdss->len = mptcp_sub_len_dss(mdss, tp->mpcb->rx_opt.dss_csum);
-
 	if (tp->mpcb->send_infinite_mapping &&
 	    tcb->seq >= mptcp_meta_tp(tp)->snd_nxt) {
+		if (!tp->mpcb->infinite_mapping)
+			NET_INC_STATS(sock_net(meta_sk),
+				      LINUX_MIB_MPTCPINFINITEMAPTX);
 		tp->mptcp->fully_established = 1;
 		tp->mpcb->infinite_mapping = 1;
 		tp->mptcp->infinite_cutoff_seq = tp->write_seq;
@@ -440,31 +302,32 @@ static struct sk_buff *mptcp_skb_entail(struct sock *sk, struct sk_buff *skb,
 		data_len = tcb->end_seq - tcb->seq;
 	}
 
-	ptr++;
-	ptr++; /* data_ack will be set in mptcp_options_write */
-	*ptr++ = htonl(tcb->seq); /* data_seq */
+	/**** Store the DSS-mapping, written by mptcp_options_write ****/
+	tcb->dss_map.data_seq = tcb->seq;
+	tcb->dss_map.data_len = data_len;
+	tcb->dss_map.data_fin = mptcp_is_data_fin(subskb);
+	tcb->dss_map.csum = 0;
 
 	/* If it's a non-data DATA_FIN, we set subseq to 0 (draft v7) */
 	if (mptcp_is_data_fin(subskb) && subskb->len == 0)
-		*ptr++ = 0; /* subseq */
+		tcb->dss_map.subseq = 0;
 	else
-		*ptr++ = htonl(tp->write_seq - tp->mptcp->snt_isn); /* subseq */
+		tcb->dss_map.subseq = tp->write_seq - tp->mptcp->snt_isn;
 
 	if (tp->mpcb->rx_opt.dss_csum && data_len) {
-		__be16 *p16 = (__be16 *)ptr;
 		__be32 hdseq = mptcp_get_highorder_sndbits(subskb, tp->mpcb);
+		__be32 hdr[3];
 		__wsum csum;
-		*ptr = htonl(((data_len) << 16) |
-				(TCPOPT_EOL << 8) |
-				(TCPOPT_EOL));
 
-		csum = csum_partial(ptr - 2, 12, subskb->csum);
-		p16++;
-		*p16++ = csum_fold(csum_partial(&hdseq, sizeof(hdseq), csum));
-	} else {
-		*ptr++ = htonl(((data_len) << 16) |
-				(TCPOPT_NOP << 8) |
-				(TCPOPT_NOP));
+		/* The mapping, as it appears in the option */
+		hdr[0] = htonl(tcb->dss_map.data_seq);
+		hdr[1] = htonl(tcb->dss_map.subseq);
+		hdr[2] = htonl(data_len << 16);
+
+		csum = csum_partial(hdr, sizeof(hdr), subskb->csum);
+		tcb->dss_map.csum = csum_fold(csum_partial(&hdseq,
+							   sizeof(hdseq),
+							   csum));
 	}
 
 	tcb->seq = tp->write_seq;
@@ -542,12 +405,18 @@ static void mptcp_transmit_skb_failed(struct sock *sk, struct sk_buff *skb,
 			sk_wmem_free_skb(sk, subskb);
 		} else {
 			/* Reinjections have not been cloned,
-			 * we have to put them back on the queue.
+			 * we have to put them back on the queue - with
+			 * their data-seq, out of the DSS-mapping.
 			 */
+			struct tcp_skb_cb *tcb = TCP_SKB_CB(subskb);
+
 			sock_set_flag(sk, SOCK_QUEUE_SHRUNK);
 			sk->sk_wmem_queued -= subskb->truesize;
 			sk_mem_uncharge(sk, subskb->truesize);
-			__skb_queue_head(&mpcb->reinject_queue, subskb);
+			mptcp_skb_data_seq(subskb, sk, &tcb->seq, &tcb->end_seq);
+			tcb->path_mask = 0;
+			tcb->acked_pi = 0;
+			mptcp_reinject_queue_add(mpcb, subskb);
 		}
 	}
 }
@@ -561,13 +430,18 @@ int mptcp_write_wakeup(struct sock *meta_sk)
 	if ((skb = tcp_send_head(meta_sk)) != NULL &&
 	    before(TCP_SKB_CB(skb)->seq, tcp_wnd_end(meta_tp))) {
 		int err;
-		unsigned int mss = tcp_current_mss(meta_sk);
+		unsigned int mss;
 		unsigned int seg_size = tcp_wnd_end(meta_tp) - TCP_SKB_CB(skb)->seq;
 		struct sock *subsk;
 
 		if (before(meta_tp->pushed_seq, TCP_SKB_CB(skb)->end_seq))
 			meta_tp->pushed_seq = TCP_SKB_CB(skb)->end_seq;
 
+		subsk = meta_tp->mpcb->sched_ops->get_subflow(meta_sk, skb);
+		if (!subsk)
+			return -1;
+		mss = tcp_current_mss(subsk);
+
 		/* We are probing the opening of a window
 		 * but the window size is != 0
 		 * must have been a result SWS avoidance ( sender )
@@ -578,14 +452,8 @@ int mptcp_write_wakeup(struct sock *meta_sk)
 			TCP_SKB_CB(skb)->flags |= TCPHDR_PSH;
 			if (tcp_fragment(meta_sk, skb, seg_size, mss))
 				return -1;
-		} else if (!tcp_skb_pcount(skb)) {
-			printk(KERN_ERR"%s should not happen with MPTCP!\n", __func__);
-			BUG();
 		}
-
-		subsk = get_available_subflow(meta_sk, skb);
-		if (!subsk)
-			return -1;
+		tcp_set_skb_tso_segs(subsk, skb, mss);
 
 		TCP_SKB_CB(skb)->flags |= TCPHDR_PSH;
 
@@ -664,13 +532,87 @@ static void mptcp_find_and_set_pathmask(struct sock *meta_sk, struct sk_buff *sk
 	}
 }
 
-static struct sk_buff *mptcp_rcv_buf_optimization(struct sock *sk, int penal)
+/* Is the peer's receive-window about to be exhausted? Everything beyond the
+ * DATA_ACK sits in its reorder-buffer, until the gap at the DATA_ACK is
+ * filled. Once there is no room left for a window's worth of data of tp,
+ * the gap costs us throughput.
+ */
+static int mptcp_rbuf_window_limited(const struct tcp_sock *meta_tp,
+				     const struct tcp_sock *tp)
+{
+	return after(meta_tp->snd_nxt + tp->snd_cwnd * tp->mss_cache,
+		     tcp_wnd_end(meta_tp));
+}
+
+/* Does skb, not yet sent on tp, hold up the DATA_ACK? It does, unless one of
+ * the subflows it is in flight on is in good shape and has an RTT comparable
+ * to the one of tp.
+ */
+static int mptcp_rbuf_is_blocking(const struct tcp_sock *tp,
+				  const struct sk_buff *skb)
+{
+	struct tcp_sock *tp_it;
+	int found = 0;
+
+	/* It already reached the peer - the DATA_ACK is on its way */
+	if (TCP_SKB_CB(skb)->acked_pi)
+		return 0;
+
+	mptcp_for_each_tp(tp->mpcb, tp_it) {
+		if (tp_it == tp ||
+		    !(TCP_SKB_CB(skb)->path_mask & mptcp_pi_to_flag(tp_it->mptcp->path_index)))
+			continue;
+
+		if (tp_it->snd_cwnd > 4 &&
+		    inet_csk((struct sock *)tp_it)->icsk_ca_state < TCP_CA_Recovery &&
+		    (u64)tp_it->srtt < (u64)sysctl_mptcp_rbuf_rtt_ratio * tp->srtt)
+			return 0;
+
+		found = 1;
+	}
+
+	return found;
+}
+
+/* Slow down tp_it, which holds up the DATA_ACK, in proportion to the ratio of
+ * the RTTs: it keeps the share srtt / srtt_it of its window, but at least
+ * half of it. Only if its rate is lower than the one of tp, and only once
+ * per RTT of tp_it.
+ */
+static void mptcp_rbuf_penalize(struct sock *meta_sk, const struct tcp_sock *tp,
+				struct tcp_sock *tp_it)
+{
+	u32 cwnd;
+
+	if (tcp_time_stamp - tp_it->mptcp->last_rbuf_opti < tp_it->srtt >> 3)
+		return;
+
+	if (tp_it->srtt <= tp->srtt ||
+	    (u64)tp_it->snd_cwnd * tp->srtt >= (u64)tp->snd_cwnd * tp_it->srtt)
+		return;
+
+	cwnd = div_u64((u64)tp_it->snd_cwnd * tp->srtt, tp_it->srtt);
+	tp_it->snd_cwnd = max3(cwnd, tp_it->snd_cwnd >> 1U, 1U);
+	tp_it->snd_ssthresh = max(tp_it->snd_cwnd, 2U);
+	tp_it->mptcp->last_rbuf_opti = tcp_time_stamp;
+
+	NET_INC_STATS(sock_net(meta_sk), LINUX_MIB_MPTCPRBUFPENAL);
+}
+
+/* Receive-buffer optimization: if the segments at the head of the meta-level
+ * are held up by slow subflows, penalize those and retransmit the segments on
+ * sk. Returns the segment to retransmit - or NULL.
+ *
+ * @penal is set if we are limited by the meta-level send-window.
+ */
+struct sk_buff *mptcp_rcv_buf_optimization(struct sock *sk, int penal)
 {
 	struct sock *meta_sk;
 	struct tcp_sock *tp = tcp_sk(sk), *tp_it;
-	struct sk_buff *skb_head;
+	struct sk_buff *skb_head, *skb;
+	int depth = sysctl_mptcp_rbuf_depth;
 
-	if (tp->mpcb->cnt_subflows == 1)
+	if (!sysctl_mptcp_rbuf_opti || tp->mpcb->cnt_subflows == 1)
 		return NULL;
 
 	meta_sk = mptcp_meta_sk(sk);
@@ -679,98 +621,296 @@ static struct sk_buff *mptcp_rcv_buf_optimization(struct sock *sk, int penal)
 	if (!skb_head || skb_head == tcp_send_head(meta_sk))
 		return NULL;
 
-	/* If penalization is optional (coming from mptcp_next_segment() and
-	 * We are not send-buffer-limited we do not penalize. The retransmission
-	 * is just an optimization to fix the idle-time due to the delay before
-	 * we wake up the application.
+	/* If penalization is optional (coming from mptcp_next_segment()), we
+	 * are neither send-buffer- nor about to be receive-window-limited, we
+	 * do not penalize. The retransmission is just an optimization to fix
+	 * the idle-time due to the delay before we wake up the application.
 	 */
-	if (!penal && sk_stream_memory_free(meta_sk))
+	if (!penal && sk_stream_memory_free(meta_sk) &&
+	    !mptcp_rbuf_window_limited(tcp_sk(meta_sk), tp))
 		goto retrans;
 
-	/* Half the cwnd of the slow flow */
+	/* Slow down the subflows holding the DATA_ACK */
 	mptcp_for_each_tp(tp->mpcb, tp_it) {
 		if (tp_it != tp &&
-		    TCP_SKB_CB(skb_head)->path_mask & mptcp_pi_to_flag(tp_it->mptcp->path_index)) {
-			/* Only update every subflow rtt */
-			if (tcp_time_stamp - tp_it->mptcp->last_rbuf_opti < tp_it->srtt >> 3)
-				break;
+		    TCP_SKB_CB(skb_head)->path_mask & mptcp_pi_to_flag(tp_it->mptcp->path_index))
+			mptcp_rbuf_penalize(meta_sk, tp, tp_it);
+	}
 
-			if ((u64)tp_it->snd_cwnd * tp->srtt <
-			    (u64) tp->snd_cwnd * tp_it->srtt) {
-				tp_it->snd_cwnd = max(tp_it->snd_cwnd >> 1U, 1U);
-				tp_it->snd_ssthresh = max(tp_it->snd_cwnd, 2U);
-				tp_it->mptcp->last_rbuf_opti = tcp_time_stamp;
-			}
+retrans:
+	/* Take the first segment among the head of the meta-level, that is not
+	 * yet injected into this path and is held up on another one.
+	 */
+	skb = skb_head;
+	tcp_for_write_queue_from(skb, meta_sk) {
+		if (skb == tcp_send_head(meta_sk) || depth-- <= 0)
 			break;
+
+		if (TCP_SKB_CB(skb)->path_mask & mptcp_pi_to_flag(tp->mptcp->path_index))
+			continue;
+
+		if (mptcp_rbuf_is_blocking(tp, skb)) {
+			NET_INC_STATS(sock_net(meta_sk),
+				      LINUX_MIB_MPTCPRBUFRETRANS);
+			return skb;
 		}
 	}
 
-retrans:
+	return NULL;
+}
 
-	/* Segment not yet injected into this path? Take it!!! */
-	if (!(TCP_SKB_CB(skb_head)->path_mask & mptcp_pi_to_flag(tp->mptcp->path_index))) {
-		int do_retrans = 0;
-		mptcp_for_each_tp(tp->mpcb, tp_it) {
-			if (tp_it != tp &&
-			    TCP_SKB_CB(skb_head)->path_mask & mptcp_pi_to_flag(tp_it->mptcp->path_index)) {
-				if (tp_it->snd_cwnd <= 4) {
-					do_retrans = 1;
-					break;
-				}
-
-				if (4 * tp->srtt >= tp_it->srtt) {
-					do_retrans = 0;
-					break;
-				} else {
-					do_retrans = 1;
-				}
-			}
-		}
+/* Similar to tcp_mss_split_point, but the send-window is the one of the
+ * meta-level and the one of the subflow @sk. The congestion-window is the
+ * one of the subflow.
+ */
+static unsigned int mptcp_mss_split_point(struct sock *meta_sk,
+					  struct sock *sk, struct sk_buff *skb,
+					  unsigned int mss_now,
+					  unsigned int cwnd)
+{
+	struct tcp_sock *meta_tp = tcp_sk(meta_sk), *tp = tcp_sk(sk);
+	u32 needed, window, cwnd_len, max_len;
+
+	window = min(tcp_wnd_end(meta_tp) - TCP_SKB_CB(skb)->seq,
+		     tcp_wnd_end(tp) - tp->write_seq);
+	cwnd_len = mss_now * cwnd;
+
+	/* Don't build bigger segments than the device accepts */
+	max_len = sk->sk_gso_max_size - 1 - MAX_TCP_HEADER;
+	max_len -= max_len % mss_now;
+	cwnd_len = min(cwnd_len, max_len);
 
-		if (do_retrans)
-			return skb_head;
+	if (likely(cwnd_len <= window && skb != tcp_write_queue_tail(meta_sk)))
+		return cwnd_len;
+
+	needed = min(skb->len, window);
+
+	if (cwnd_len <= needed)
+		return cwnd_len;
+
+	/* mptcp_is_available guaranteed us at least one segment */
+	return max(needed - needed % mss_now, mss_now);
+}
+
+/* Split a segment of the reinject-queue. Inspired by tcp_fragment, but
+ * without any accounting, as the segments of the reinject-queue are not
+ * charged to a socket.
+ */
+static int mptcp_reinject_fragment(struct mptcp_cb *mpcb, struct sk_buff *skb,
+				   u32 len, gfp_t gfp)
+{
+	struct sk_buff *buff;
+	int nsize, nlen;
+	u8 flags;
+
+	if (WARN_ON(len > skb->len))
+		return -EINVAL;
+
+	nsize = skb_headlen(skb) - len;
+	if (nsize < 0)
+		nsize = 0;
+
+	if (skb_cloned(skb) &&
+	    skb_is_nonlinear(skb) &&
+	    pskb_expand_head(skb, 0, 0, gfp))
+		return -ENOMEM;
+
+	buff = alloc_skb(nsize + MAX_TCP_HEADER, gfp);
+	if (!buff)
+		return -ENOMEM;
+	skb_reserve(buff, MAX_TCP_HEADER);
+
+	nlen = skb->len - len - nsize;
+	buff->truesize += nlen;
+	skb->truesize -= nlen;
+
+	/* Correct the sequence numbers. */
+	TCP_SKB_CB(buff)->seq = TCP_SKB_CB(skb)->seq + len;
+	TCP_SKB_CB(buff)->end_seq = TCP_SKB_CB(skb)->end_seq;
+	TCP_SKB_CB(skb)->end_seq = TCP_SKB_CB(buff)->seq;
+
+	/* PSH and FIN should only be set in the second packet. */
+	flags = TCP_SKB_CB(skb)->flags;
+	TCP_SKB_CB(skb)->flags = flags & ~(TCPHDR_FIN | TCPHDR_PSH);
+	TCP_SKB_CB(buff)->flags = flags;
+	TCP_SKB_CB(buff)->sacked = 0;
+	TCP_SKB_CB(buff)->path_mask = TCP_SKB_CB(skb)->path_mask;
+	flags = TCP_SKB_CB(skb)->mptcp_flags;
+	TCP_SKB_CB(skb)->mptcp_flags = flags & ~(MPTCPHDR_FIN);
+	TCP_SKB_CB(buff)->mptcp_flags = flags;
+
+	if (!skb_shinfo(skb)->nr_frags && skb->ip_summed != CHECKSUM_PARTIAL) {
+		/* Copy and checksum data tail into the new buffer. */
+		buff->csum = csum_partial_copy_nocheck(skb->data + len,
+						       skb_put(buff, nsize),
+						       nsize, 0);
+
+		skb_trim(skb, len);
+
+		skb->csum = csum_block_sub(skb->csum, buff->csum, len);
+		buff->ip_summed = skb->ip_summed;
+	} else {
+		skb_split(skb, buff, len);
+
+		/* The DSS-checksum relies on skb->csum */
+		if (skb->ip_summed == CHECKSUM_NONE)
+			mptcp_split_csum(skb, buff, len);
+		buff->ip_summed = skb->ip_summed;
 	}
-	return NULL;
+
+	buff->sk = skb->sk;
+	mptcp_reinject_queue_after(mpcb, skb, buff);
+
+	return 0;
+}
+
+/* tcp_set_skb_tso_segs for a segment that may be a clone (see
+ * __mptcp_reinject_data and mptcp_skb_entail). The gso-settings live in the
+ * skb_shared_info, shared with the segment it has been cloned from. Thus,
+ * before changing them, the segment gets its own one. pskb_expand_head only
+ * copies the linear part, the paged payload remains shared.
+ */
+static int mptcp_set_skb_tso_segs(struct sock *sk, struct sk_buff *skb,
+				  unsigned int mss_now, gfp_t gfp)
+{
+	if (skb_cloned(skb) &&
+	    (skb->len > mss_now || tcp_skb_pcount(skb) > 1) &&
+	    pskb_expand_head(skb, 0, 0, gfp))
+		return -ENOMEM;
+
+	tcp_set_skb_tso_segs(sk, skb, mss_now);
+	return 0;
+}
+
+/* Split @skb at @len, wherever it is coming from */
+static int mptcp_fragment_skb(struct sock *meta_sk, struct sk_buff *skb,
+			      int reinject, u32 len, unsigned int mss_now,
+			      gfp_t gfp)
+{
+	if (!reinject)
+		return tso_fragment(meta_sk, skb, len, mss_now, gfp);
+	else if (reinject == -1)
+		return tcp_fragment(meta_sk, skb, len, mss_now);
+	else
+		return mptcp_reinject_fragment(tcp_sk(meta_sk)->mpcb, skb, len,
+					       gfp);
+}
+
+/* MTU-probing on the subflow @sk. Inspired by tcp_mtu_probe, but rather than
+ * building a probe out of the subflow's send-queue, the next segment of the
+ * meta-level is sized to the probe.
+ *
+ * Returns the size of the probe's payload and sets @probe_mtu, or returns 0
+ * if the subflow does not probe right now.
+ */
+static unsigned int mptcp_mtu_probe_size(struct sock *meta_sk, struct sock *sk,
+					 struct sk_buff *skb,
+					 unsigned int mss_now, int *probe_mtu)
+{
+	struct tcp_sock *meta_tp = tcp_sk(meta_sk), *tp = tcp_sk(sk);
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	unsigned int probe_size, size_needed;
+
+	/* Not currently probing/verifying,
+	 * not in recovery,
+	 * have enough cwnd, and
+	 * not SACKing (the variable headers throw things off) */
+	if (!icsk->icsk_mtup.enabled ||
+	    icsk->icsk_mtup.probe_size ||
+	    icsk->icsk_ca_state != TCP_CA_Open ||
+	    tp->snd_cwnd < 11 ||
+	    tp->rx_opt.num_sacks || tp->rx_opt.dsack)
+		return 0;
+
+	/* Very simple search strategy: just double the MSS. The MTU of the
+	 * probe includes the MPTCP-options, which are not part of mss_cache.
+	 */
+	probe_size = 2 * mss_now;
+	*probe_mtu = tcp_mss_to_mtu(sk, probe_size) + tp->mss_cache - mss_now;
+	if (*probe_mtu > icsk->icsk_mtup.search_high)
+		return 0;
+
+	/* The DATA_FIN must be in the last segment of a mapping */
+	if (skb->len < probe_size || mptcp_is_data_fin(skb))
+		return 0;
+
+	/* Have enough data in the send queue to probe? */
+	size_needed = probe_size + (tp->reordering + 1) * mss_now;
+	if (meta_tp->write_seq - TCP_SKB_CB(skb)->seq < size_needed)
+		return 0;
+
+	if (after(TCP_SKB_CB(skb)->seq + size_needed, tcp_wnd_end(meta_tp)) ||
+	    after(tp->write_seq + size_needed, tcp_wnd_end(tp)))
+		return 0;
+
+	/* Don't wait for the cwnd to drain, other subflows may send */
+	if (tcp_packets_in_flight(tp) + 2 > tp->snd_cwnd)
+		return 0;
+
+	return probe_size;
+}
+
+/* The MSS of the meta-socket is the largest one among the subflows. The
+ * segments of the meta-level are split at the MSS of the subflow they are
+ * sent on (see mptcp_write_xmit).
+ */
+unsigned int mptcp_current_mss(struct sock *meta_sk)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct sock *sk;
+	unsigned int mss = 0;
+
+	mptcp_for_each_sk(mpcb, sk) {
+		if (!mptcp_sk_can_send(sk))
+			continue;
+
+		mss = max(mss, tcp_current_mss(sk));
+	}
+
+	return mss ? : tcp_sk(meta_sk)->mss_cache;
+}
+
+/* The number of segments the subflow may still send in this round, out of
+ * its congestion- and send-window. The subflow has already been selected by
+ * the scheduler for @skb.
+ */
+static int mptcp_sub_quota(struct sock *sk, struct sk_buff *skb,
+			   unsigned int mss_now)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int wnd_quota = (tcp_wnd_end(tp) - tp->write_seq) / mss_now;
+
+	return min_t(int, tcp_cwnd_test(tp, skb), max(wnd_quota, 1));
 }
 
 int mptcp_write_xmit(struct sock *meta_sk, unsigned int mss_now, int nonagle,
 		     int push_one, gfp_t gfp)
 {
 	struct tcp_sock *meta_tp = tcp_sk(meta_sk), *subtp;
-	struct sock *subsk;
+	struct sock *subsk, *batch_sk = NULL;
 	struct mptcp_cb *mpcb = meta_tp->mpcb;
 	struct sk_buff *skb;
 	unsigned int tso_segs, sent_pkts;
-	int cwnd_quota;
-	int result;
+	int cwnd_quota, batch_quota = 0;
 	int reinject = 0;
 
 	sent_pkts = 0;
 
-	/* Currently mtu-probing is not done in MPTCP */
-	if (!push_one && 0) {
-		/* Do MTU probing. */
-		result = tcp_mtu_probe(meta_sk);
-		if (!result) {
-			return 0;
-		} else if (result > 0) {
-			sent_pkts = 1;
-		}
-	}
-
 	while ((skb = mptcp_next_segment(meta_sk, &reinject))) {
-		unsigned int limit;
+		unsigned int limit, sub_mss, probe_size = 0;
+		int probe_mtu;
 		struct sk_buff *subskb = NULL;
 
 		if (reinject == 1) {
 			if (!after(TCP_SKB_CB(skb)->end_seq, meta_tp->snd_una)) {
 				/* Segment already reached the peer, take the next one */
-				__skb_unlink(skb, &mpcb->reinject_queue);
+				mptcp_reinject_queue_unlink(mpcb, skb);
 				__kfree_skb(skb);
 				continue;
 			}
 
-			/* Reinjection and it is coming from a subflow? We need
+			/* Reinjection whose path-mask could not be found when
+			 * it got queued (see __mptcp_reinject_data)? We need
 			 * to find out the path-mask from the meta-write-queue
 			 * to properly select a subflow.
 			 */
@@ -778,21 +918,36 @@ int mptcp_write_xmit(struct sock *meta_sk, unsigned int mss_now, int nonagle,
 				mptcp_find_and_set_pathmask(meta_sk, skb);
 		}
 
-		/* This must be invoked even if we don't want
-		 * to support TSO at the moment
+		/* Segments that have already been sent keep their tso-factor,
+		 * because it is accounted in the meta's packets_out.
 		 */
-		tso_segs = tcp_init_tso_segs(meta_sk, skb, mss_now);
-		BUG_ON(!tso_segs);
-		/* At the moment we do not support tso, hence
-		 * tso_segs must be 1
-		 */
-		BUG_ON(tso_segs != 1);
+		if (!reinject) {
+			tso_segs = tcp_init_tso_segs(meta_sk, skb, mss_now);
+			BUG_ON(!tso_segs);
+		}
 
-		subsk = get_available_subflow(meta_sk, skb);
-		if (!subsk)
-			break;
+		/* The scheduler's choice holds for a run of new segments, as
+		 * long as the subflow has some quota left in this round.
+		 * Reinjections and the DATA_FIN need a decision of their own.
+		 */
+		if (batch_quota > 0 && !reinject && !mptcp_is_data_fin(skb)) {
+			subsk = batch_sk;
+		} else {
+			subsk = mpcb->sched_ops->get_subflow(meta_sk, skb);
+			if (!subsk)
+				break;
+			batch_sk = subsk;
+			batch_quota = 0;
+		}
 		subtp = tcp_sk(subsk);
 
+		/* The segment is sent with the MSS of the subflow */
+		sub_mss = tcp_current_mss(subsk);
+
+		if (!batch_quota && !reinject &&
+		    (mpcb->sched_ops->flags & MPTCP_SCHED_BATCH))
+			batch_quota = mptcp_sub_quota(subsk, skb, sub_mss);
+
 		/* Since all subsocks are locked before calling the scheduler,
 		 * the tcp_send_head should not change.
 		 */
@@ -809,7 +964,7 @@ retry:
 			break;
 		}
 
-		if (!reinject && unlikely(!tcp_snd_wnd_test(meta_tp, skb, mss_now))) {
+		if (!reinject && unlikely(!tcp_snd_wnd_test(meta_tp, skb, sub_mss))) {
 			skb = mptcp_rcv_buf_optimization(subsk, 1);
 			if (skb) {
 				reinject = -1;
@@ -818,34 +973,67 @@ retry:
 			break;
 		}
 
-		if (tso_segs == 1) {
-			if (unlikely(!tcp_nagle_test(meta_tp, skb, mss_now,
-						     (tcp_skb_is_last(meta_sk, skb) ?
-						      nonagle : TCP_NAGLE_PUSH))))
-				break;
-		} else {
-			if (!push_one && tcp_tso_should_defer(meta_sk, skb))
-				break;
-		}
+		/* The meta-level has no congestion-window, thus
+		 * tcp_tso_should_defer makes no sense here. The segment is
+		 * rather split at the subflow's congestion-window below.
+		 */
+		if (unlikely(!tcp_nagle_test(meta_tp, skb, mss_now,
+					     (tcp_skb_is_last(meta_sk, skb) ?
+					      nonagle : TCP_NAGLE_PUSH))))
+			break;
+
+		if (!push_one && !reinject)
+			probe_size = mptcp_mtu_probe_size(meta_sk, subsk, skb,
+							  sub_mss, &probe_mtu);
 
-		limit = mss_now;
-		if (!meta_tp->mpc && tso_segs > 1 && !tcp_urg_mode(meta_tp))
-			limit = tcp_mss_split_point(meta_sk, skb, mss_now,
-						    cwnd_quota);
+		/* The DSS-checksum is incompatible with GSO, as it needs
+		 * skb->csum.
+		 */
+		limit = sub_mss;
+		if (probe_size)
+			limit = probe_size;
+		else if (skb->len > sub_mss && sk_can_gso(subsk) &&
+			 skb->ip_summed != CHECKSUM_NONE &&
+			 !mpcb->rx_opt.dss_csum && !tcp_urg_mode(meta_tp))
+			limit = mptcp_mss_split_point(meta_sk, subsk, skb,
+						      sub_mss, cwnd_quota);
+
+		/* The DATA_FIN must be signaled in the last segment of the
+		 * mapping only - thus send it in a segment on its own.
+		 */
+		if (mptcp_is_data_fin(skb) && skb->len > sub_mss &&
+		    limit >= skb->len)
+			limit = rounddown(skb->len - 1, sub_mss);
 
 		if (skb->len > limit &&
-		    unlikely(tso_fragment(meta_sk, skb, limit, mss_now, gfp)))
+		    unlikely(mptcp_fragment_skb(meta_sk, skb, reinject, limit,
+						sub_mss, gfp)))
+			break;
+
+		/* The gso-settings depend on the subflow. A probe is sent as
+		 * a single segment.
+		 */
+		if (reinject >= 0 &&
+		    mptcp_set_skb_tso_segs(subsk, skb, probe_size ? : sub_mss,
+					   gfp))
 			break;
 
 		subskb = mptcp_skb_entail(subsk, skb, reinject);
 		if (!subskb)
 			break;
 
+		if (reinject < 0 &&
+		    mptcp_set_skb_tso_segs(subsk, subskb, sub_mss, gfp)) {
+			mptcp_transmit_skb_failed(subsk, skb, subskb, reinject);
+			break;
+		}
+
 		TCP_SKB_CB(subskb)->when = tcp_time_stamp;
 
 		if (unlikely(tcp_transmit_skb(subsk, subskb, 1, gfp))) {
 			mptcp_transmit_skb_failed(subsk, skb, subskb, reinject);
 			mpcb->noneligible |= mptcp_pi_to_flag(subtp->mptcp->path_index);
+			batch_quota = 0;
 			continue;
 		}
 
@@ -858,9 +1046,32 @@ retry:
 		if (reinject > 0)
 			mptcp_mark_reinjected(subsk, skb);
 
+		subtp->mptcp->bytes_sched += subskb->len;
+		if (reinject) {
+			subtp->mptcp->bytes_reinjected += subskb->len;
+			NET_INC_STATS(sock_net(meta_sk),
+				      LINUX_MIB_MPTCPREINJECTSENT);
+		}
+
+		if (probe_size) {
+			/* Decrement cwnd here because we are sending
+			 * effectively two packets.
+			 */
+			subtp->snd_cwnd--;
+
+			inet_csk(subsk)->icsk_mtup.probe_size = probe_mtu;
+			subtp->mtu_probe.probe_seq_start = TCP_SKB_CB(subskb)->seq;
+			subtp->mtu_probe.probe_seq_end = TCP_SKB_CB(subskb)->end_seq;
+
+			batch_quota = 0;
+		}
+
+		if (subsk == batch_sk)
+			batch_quota -= tcp_skb_pcount(subskb);
+
 		tcp_minshall_update(meta_tp, mss_now, skb);
-		sent_pkts += tcp_skb_pcount(skb);
-		tcp_sk(subsk)->mptcp->sent_pkts += tcp_skb_pcount(skb);
+		sent_pkts += tcp_skb_pcount(subskb);
+		subtp->mptcp->sent_pkts += tcp_skb_pcount(subskb);
 
 		mptcp_sub_event_new_data_sent(subsk, subskb);
 
@@ -1117,7 +1328,10 @@ void mptcp_established_options(struct sock *sk, struct sk_buff *skb,
 	if (!tp->mptcp_add_addr_ack && !tp->mptcp->include_mpc) {
 		opts->options |= OPTION_MPTCP;
 		opts->mptcp_options |= OPTION_DATA_ACK;
-		if (!skb || (skb && !mptcp_is_data_seq(skb))) {
+		/* Without skb, we are called by tcp_current_mss. The MSS must
+		 * leave room for the mapping of a data-segment.
+		 */
+		if (skb && !mptcp_is_data_seq(skb)) {
 			opts->data_ack = meta_tp->rcv_nxt;
 
 			*size += MPTCP_SUB_LEN_ACK_ALIGN;
@@ -1141,7 +1355,7 @@ void mptcp_established_options(struct sock *sk, struct sk_buff *skb,
 		opts->mptcp_options |= OPTION_ADD_ADDR;
 		opts->addr4 = &mpcb->addr4[ind];
 		if (skb)
-			tp->mptcp->add_addr4 &= ~(1 << ind);
+			tp->mptcp->add_addr4 &= ~(1U << ind);
 		*size += MPTCP_SUB_LEN_ADD_ADDR4_ALIGN;
 	} else if (unlikely(tp->mptcp->add_addr6) &&
 		 MAX_TCP_OPTION_SPACE - *size >=
@@ -1151,7 +1365,7 @@ void mptcp_established_options(struct sock *sk, struct sk_buff *skb,
 		opts->mptcp_options |= OPTION_ADD_ADDR;
 		opts->addr6 = &mpcb->addr6[ind];
 		if (skb)
-			tp->mptcp->add_addr6 &= ~(1 << ind);
+			tp->mptcp->add_addr6 &= ~(1U << ind);
 		*size += MPTCP_SUB_LEN_ADD_ADDR6_ALIGN;
 	} else if (unlikely(mpcb->remove_addrs) &&
 		   MAX_TCP_OPTION_SPACE - *size >=
@@ -1284,8 +1498,11 @@ void mptcp_options_write(__be32 *ptr, struct tcp_sock *tp,
 		mprem->rsv = 0;
 		addrs_id = &mprem->addrs_id;
 
-		mptcp_for_each_bit_set(opts->remove_addrs, id)
-			*(addrs_id++) = id;
+		/* The v6 address-ids go beyond 32 bits */
+		for (id = 0; id < 2 * MPTCP_MAX_ADDR; id++) {
+			if (opts->remove_addrs & (1ULL << id))
+				*(addrs_id++) = id;
+		}
 
 		/* Fill the rest with NOP's */
 		if (len_align > len) {
@@ -1339,15 +1556,37 @@ void mptcp_options_write(__be32 *ptr, struct tcp_sock *tp,
 			ptr++;
 			*ptr++ = htonl(opts->data_ack);
 		} else {
-			/**** Just update the data_ack ****/
+			/**** DSS-mapping, stored by mptcp_skb_entail ****/
+			struct tcp_skb_cb *tcb = TCP_SKB_CB(skb);
+			struct mp_dss *mdss = (struct mp_dss *)ptr;
 
-			/* Get pointer to data_ack-field. MPTCP is always at
-			 * the end of the TCP-options.
-			 */
-			/* TODO if we allow sending 64-bit dseq's we have to change "16" */
-			__be32 *dack = (__be32 *)(skb->data + (tcp_hdr(skb)->doff << 2) - 16);
+			mdss->kind = TCPOPT_MPTCP;
+			mdss->sub = MPTCP_SUB_DSS;
+			mdss->rsv1 = 0;
+			mdss->rsv2 = 0;
+			mdss->F = tcb->dss_map.data_fin;
+			mdss->m = 0;
+			mdss->M = 1;
+			mdss->a = 0;
+			mdss->A = 1;
+			mdss->len = mptcp_sub_len_dss(mdss, tp->mpcb->rx_opt.dss_csum);
 
-			*dack = htonl(opts->data_ack);
+			ptr++;
+			*ptr++ = htonl(opts->data_ack);
+			*ptr++ = htonl(tcb->dss_map.data_seq);
+			*ptr++ = htonl(tcb->dss_map.subseq);
+
+			if (tp->mpcb->rx_opt.dss_csum && tcb->dss_map.data_len) {
+				__be16 *p16 = (__be16 *)ptr;
+
+				*p16++ = htons(tcb->dss_map.data_len);
+				*p16 = tcb->dss_map.csum;
+				ptr++;
+			} else {
+				*ptr++ = htonl((tcb->dss_map.data_len << 16) |
+					       (TCPOPT_NOP << 8) |
+					       (TCPOPT_NOP));
+			}
 		}
 	}
 	if (unlikely(OPTION_MP_PRIO & opts->mptcp_options)) {
@@ -1364,48 +1603,6 @@ void mptcp_options_write(__be32 *ptr, struct tcp_sock *tp,
 	}
 }
 
-/**
- * Returns the next segment to be sent from the mptcp meta-queue.
- * (chooses the reinject queue if any segment is waiting in it, otherwise,
- * chooses the normal write queue).
- * Sets *@reinject to 1 if the returned segment comes from the
- * reinject queue. Sets it to 0 if it is the regular send-head of the meta-sk,
- * and sets it to -1 if it is a meta-level retransmission to optimize the
- * receive-buffer.
- */
-struct sk_buff *mptcp_next_segment(struct sock *meta_sk, int *reinject)
-{
-	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
-	struct sk_buff *skb = NULL;
-	if (reinject)
-		*reinject = 0;
-
-	/* If we are in fallback-mode, just take from the meta-send-queue */
-	if (mpcb->infinite_mapping || mpcb->send_infinite_mapping)
-		return tcp_send_head(meta_sk);
-
-	skb = skb_peek(&mpcb->reinject_queue);
-
-	if (skb) {
-		if (reinject)
-			*reinject = 1;
-	} else {
-		skb = tcp_send_head(meta_sk);
-
-		if (!skb && meta_sk->sk_write_pending &&
-		    sk_stream_wspace(meta_sk) < sk_stream_min_wspace(meta_sk)) {
-			struct sock *subsk = get_available_subflow(meta_sk, NULL);
-			if (!subsk)
-				return NULL;
-
-			skb = mptcp_rcv_buf_optimization(subsk, 0);
-			if (skb && reinject)
-				*reinject = -1;
-		}
-	}
-	return skb;
-}
-
 /* Sends the datafin */
 void mptcp_send_fin(struct sock *meta_sk)
 {
@@ -1438,7 +1635,8 @@ void mptcp_send_fin(struct sock *meta_sk)
 		 */
 		tcp_queue_skb(meta_sk, skb);
 	}
-	__tcp_push_pending_frames(meta_sk, mptcp_sysctl_mss(), TCP_NAGLE_OFF);
+	__tcp_push_pending_frames(meta_sk, tcp_current_mss(meta_sk),
+				  TCP_NAGLE_OFF);
 }
 
 void mptcp_send_active_reset(struct sock *meta_sk, gfp_t priority)
@@ -1699,7 +1897,12 @@ void mptcp_retransmit_timer(struct sock *meta_sk)
 	    mpcb->infinite_mapping || mpcb->send_infinite_mapping)
 		return;
 
-	sk = get_available_subflow(meta_sk, tcp_write_queue_head(meta_sk));
+	/* The head may lose its acked_pi, the schedulers have to look at the
+	 * write-queue again.
+	 */
+	mptcp_sched_hint_reset(mpcb);
+
+	sk = mpcb->sched_ops->get_subflow(meta_sk, tcp_write_queue_head(meta_sk));
 	if (!sk)
 		goto out_reset_timer;
 
@@ -1746,6 +1949,15 @@ void mptcp_retransmit_timer(struct sock *meta_sk)
 	if (tcp_write_timeout(meta_sk))
 		return;
 
+	/* A copy of the head has already been acked on one of the subflows,
+	 * the DATA_ACK may still be on its way. Wait for one more RTO - the
+	 * peer may as well have dropped the data at the meta-level.
+	 */
+	if (TCP_SKB_CB(tcp_write_queue_head(meta_sk))->acked_pi) {
+		TCP_SKB_CB(tcp_write_queue_head(meta_sk))->acked_pi = 0;
+		goto out_reset_timer;
+	}
+
 	if (meta_icsk->icsk_retransmits == 0)
 		NET_INC_STATS_BH(sock_net(meta_sk), LINUX_MIB_TCPTIMEOUTS);
 
@@ -0,0 +1,423 @@
+/*
+ *	MPTCP implementation - Per-peer cache
+ *
+ *	Remembers, per network namespace and per remote host, the addresses
+ *	the peer announced and what we learned about each local/remote
+ *	address-pair (smoothed RTT, RTT-variance and congestion window, or
+ *	that the handshake did not succeed). A new connection to the same
+ *	peer then opens its subflows without waiting for ADD_ADDR, skips the
+ *	paths known to be broken and starts with realistic RTT-estimates.
+ *
+ *	Only the client-side uses the cache. The hash-table has
+ *	MPTCP_PEER_HSIZE buckets, each holding at most MPTCP_PEER_DEPTH
+ *	peers - the oldest one is recycled. Entries are forgotten after
+ *	MPTCP_PEER_TIMEOUT.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/jhash.h>
+#include <linux/kconfig.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <net/mptcp.h>
+#include <net/mptcp_v4.h>
+#include <net/mptcp_pm.h>
+#include <net/tcp.h>
+#if IS_ENABLED(CONFIG_IPV6)
+#include <net/ipv6.h>
+#include <net/mptcp_v6.h>
+#endif
+
+/* v4-mapped addresses are stored as AF_INET. Always memset before being
+ * filled, so that they can be compared with memcmp.
+ */
+struct mptcp_peer_addr {
+	__be32		addr[4];
+	sa_family_t	family;
+};
+
+struct mptcp_peer_path {
+	struct mptcp_peer_addr	loc;
+	struct mptcp_peer_addr	rem;
+	unsigned long		stamp;
+	u32			srtt;	/* Same units as tp->srtt/mdev */
+	u32			rttvar;
+	u32			cwnd;
+	u8			failed:1;
+};
+
+struct mptcp_peer_rem {
+	struct mptcp_peer_addr	addr;
+	__be16			port;
+	u8			id;
+};
+
+struct mptcp_peer {
+	struct hlist_node	hash_node;
+	struct mptcp_peer_addr	key;
+	unsigned long		stamp;
+	u8			cnt_addrs;
+	u8			cnt_paths;
+	struct mptcp_peer_rem	addrs[MPTCP_PEER_ADDRS];
+	struct mptcp_peer_path	paths[MPTCP_PEER_PATHS];
+};
+
+static void mptcp_peer_set_addr(struct mptcp_peer_addr *a,
+				sa_family_t family, const void *addr)
+{
+	memset(a, 0, sizeof(*a));
+	a->family = family;
+	if (family == AF_INET)
+		memcpy(a->addr, addr, sizeof(struct in_addr));
+	else
+		memcpy(a->addr, addr, sizeof(struct in6_addr));
+}
+
+/* Fills loc/rem (either may be NULL) with the addresses of sk */
+static void mptcp_peer_sk_addrs(struct sock *sk, struct mptcp_peer_addr *loc,
+				struct mptcp_peer_addr *rem)
+{
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6 && !mptcp_v6_is_v4_mapped(sk)) {
+		if (loc)
+			mptcp_peer_set_addr(loc, AF_INET6,
+					    &inet6_sk(sk)->saddr);
+		if (rem)
+			mptcp_peer_set_addr(rem, AF_INET6,
+					    &inet6_sk(sk)->daddr);
+		return;
+	}
+#endif
+	if (loc)
+		mptcp_peer_set_addr(loc, AF_INET, &inet_sk(sk)->inet_saddr);
+	if (rem)
+		mptcp_peer_set_addr(rem, AF_INET, &inet_sk(sk)->inet_daddr);
+}
+
+static inline u32 mptcp_peer_hash(const struct mptcp_pm_ns *ns,
+				  const struct mptcp_peer_addr *key)
+{
+	return jhash2((__force const u32 *)key->addr, 4,
+		      ns->peer_rnd ^ key->family) & (MPTCP_PEER_HSIZE - 1);
+}
+
+/* Must be called with ns->peer_lock held. If create is set, a missing or
+ * expired entry is (re-)initialized and the entry is marked as used.
+ */
+static struct mptcp_peer *__mptcp_peer_lookup(struct mptcp_pm_ns *ns,
+					      const struct mptcp_peer_addr *key,
+					      int create)
+{
+	struct hlist_head *head = &ns->peer_hash[mptcp_peer_hash(ns, key)];
+	struct mptcp_peer *peer, *oldest = NULL;
+	struct hlist_node *node;
+	int depth = 0;
+
+	hlist_for_each_entry(peer, node, head, hash_node) {
+		if (!memcmp(&peer->key, key, sizeof(*key))) {
+			if (time_before(jiffies,
+					peer->stamp + MPTCP_PEER_TIMEOUT))
+				goto out;
+			if (!create)
+				return NULL;
+			goto reset;
+		}
+
+		if (!oldest || time_before(peer->stamp, oldest->stamp))
+			oldest = peer;
+		depth++;
+	}
+
+	if (!create)
+		return NULL;
+
+	if (depth >= MPTCP_PEER_DEPTH) {
+		peer = oldest;
+	} else {
+		peer = kmalloc(sizeof(*peer), GFP_ATOMIC);
+		if (!peer)
+			return NULL;
+		hlist_add_head(&peer->hash_node, head);
+	}
+
+reset:
+	peer->key = *key;
+	peer->cnt_addrs = 0;
+	peer->cnt_paths = 0;
+out:
+	if (create)
+		peer->stamp = jiffies;
+	return peer;
+}
+
+static struct mptcp_peer_path *mptcp_peer_find_path(struct mptcp_peer *peer,
+						    const struct mptcp_peer_addr *loc,
+						    const struct mptcp_peer_addr *rem)
+{
+	int i;
+
+	for (i = 0; i < peer->cnt_paths; i++) {
+		struct mptcp_peer_path *path = &peer->paths[i];
+
+		if (!memcmp(&path->loc, loc, sizeof(*loc)) &&
+		    !memcmp(&path->rem, rem, sizeof(*rem)))
+			return path;
+	}
+
+	return NULL;
+}
+
+/* The errors telling that the handshake of a path did not succeed */
+static inline int mptcp_peer_path_error(int err)
+{
+	return err == ETIMEDOUT || err == ECONNREFUSED ||
+	       err == EHOSTUNREACH || err == ENETUNREACH;
+}
+
+/* Called when the subflow sk is removed from the connection */
+void mptcp_peer_save_path(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(sk));
+	struct mptcp_peer_addr key, loc, rem;
+	struct mptcp_peer_path *path;
+	struct mptcp_peer *peer;
+	int failed;
+
+	if (tp->srtt)
+		failed = 0;
+	else if (mptcp_peer_path_error(sk->sk_err))
+		failed = 1;
+	else
+		return; /* Nothing learned */
+
+	mptcp_peer_sk_addrs(mptcp_meta_sk(sk), NULL, &key);
+	mptcp_peer_sk_addrs(sk, &loc, &rem);
+
+	spin_lock_bh(&ns->peer_lock);
+	peer = __mptcp_peer_lookup(ns, &key, 1);
+	if (!peer)
+		goto out;
+
+	path = mptcp_peer_find_path(peer, &loc, &rem);
+	if (!path) {
+		if (peer->cnt_paths < MPTCP_PEER_PATHS)
+			path = &peer->paths[peer->cnt_paths++];
+		else
+			path = &peer->paths[net_random() % MPTCP_PEER_PATHS];
+		path->loc = loc;
+		path->rem = rem;
+	}
+
+	path->stamp = jiffies;
+	path->failed = failed;
+	if (!failed) {
+		path->srtt = tp->srtt;
+		path->rttvar = tp->mdev;
+		path->cwnd = tp->snd_cwnd;
+	}
+out:
+	spin_unlock_bh(&ns->peer_lock);
+}
+
+/* Called when the meta-sk is destroyed - remembers the addresses that have
+ * been announced by the peer.
+ */
+void mptcp_peer_save_addrs(struct sock *meta_sk)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(meta_sk));
+	struct mptcp_peer_addr key;
+	struct mptcp_peer_rem *rem;
+	struct mptcp_peer *peer;
+	int i;
+
+	mptcp_peer_sk_addrs(meta_sk, NULL, &key);
+
+	spin_lock_bh(&ns->peer_lock);
+	peer = __mptcp_peer_lookup(ns, &key, 1);
+	if (!peer)
+		goto out;
+
+	peer->cnt_addrs = 0;
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, i) {
+		if (peer->cnt_addrs == MPTCP_PEER_ADDRS)
+			goto out;
+
+		rem = &peer->addrs[peer->cnt_addrs];
+		mptcp_peer_set_addr(&rem->addr, AF_INET,
+				    &mpcb->rx_opt.addr4[i].addr);
+		if (!memcmp(&rem->addr, &key, sizeof(key)))
+			continue;
+
+		rem->port = mpcb->rx_opt.addr4[i].port;
+		rem->id = mpcb->rx_opt.addr4[i].id;
+		peer->cnt_addrs++;
+	}
+
+#if IS_ENABLED(CONFIG_IPV6)
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, i) {
+		if (peer->cnt_addrs == MPTCP_PEER_ADDRS)
+			goto out;
+
+		rem = &peer->addrs[peer->cnt_addrs];
+		mptcp_peer_set_addr(&rem->addr, AF_INET6,
+				    &mpcb->rx_opt.addr6[i].addr);
+		if (!memcmp(&rem->addr, &key, sizeof(key)))
+			continue;
+
+		rem->port = mpcb->rx_opt.addr6[i].port;
+		rem->id = mpcb->rx_opt.addr6[i].id;
+		peer->cnt_addrs++;
+	}
+#endif
+out:
+	spin_unlock_bh(&ns->peer_lock);
+}
+
+/* Adds the cached addresses of the peer to the new connection, as if they
+ * had been announced with ADD_ADDR.
+ */
+void mptcp_peer_seed_addrs(struct sock *meta_sk)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(meta_sk));
+	struct mptcp_peer_addr key;
+	struct mptcp_peer *peer;
+	int i;
+
+	mptcp_peer_sk_addrs(meta_sk, NULL, &key);
+
+	spin_lock_bh(&ns->peer_lock);
+	peer = __mptcp_peer_lookup(ns, &key, 0);
+	if (!peer)
+		goto out;
+
+	for (i = 0; i < peer->cnt_addrs; i++) {
+		struct mptcp_peer_rem *rem = &peer->addrs[i];
+
+		if (rem->addr.family == AF_INET)
+			mptcp_v4_add_raddress(&mpcb->rx_opt,
+					      (struct in_addr *)rem->addr.addr,
+					      rem->port, rem->id);
+#if IS_ENABLED(CONFIG_IPV6)
+		else
+			mptcp_v6_add_raddress(&mpcb->rx_opt,
+					      (struct in6_addr *)rem->addr.addr,
+					      rem->port, rem->id);
+#endif
+	}
+out:
+	spin_unlock_bh(&ns->peer_lock);
+}
+
+/* Did the last handshake between loc and rem fail? Such a path is not
+ * tried again before MPTCP_PEER_TIMEOUT.
+ */
+int mptcp_peer_path_failed(struct sock *meta_sk, sa_family_t family,
+			   const void *loc, const void *rem)
+{
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(meta_sk));
+	struct mptcp_peer_addr key, loc_addr, rem_addr;
+	struct mptcp_peer_path *path;
+	struct mptcp_peer *peer;
+	int failed = 0;
+
+	mptcp_peer_sk_addrs(meta_sk, NULL, &key);
+	mptcp_peer_set_addr(&loc_addr, family, loc);
+	mptcp_peer_set_addr(&rem_addr, family, rem);
+
+	spin_lock_bh(&ns->peer_lock);
+	peer = __mptcp_peer_lookup(ns, &key, 0);
+	if (!peer)
+		goto out;
+
+	path = mptcp_peer_find_path(peer, &loc_addr, &rem_addr);
+	if (path && path->failed &&
+	    time_before(jiffies, path->stamp + MPTCP_PEER_TIMEOUT))
+		failed = 1;
+out:
+	spin_unlock_bh(&ns->peer_lock);
+	return failed;
+}
+
+/* Called from tcp_init_metrics. Like the dst-metrics, the cached RTT only
+ * raises the estimates of the handshake. The initial window is set to half
+ * of the last congestion window of the path, if larger.
+ */
+void mptcp_peer_init_metrics(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(sk));
+	struct mptcp_peer_addr key, loc, rem;
+	struct mptcp_peer_path *path;
+	struct mptcp_peer *peer;
+	u32 srtt, rttvar, cwnd;
+
+	if (tp->mpcb->server_side)
+		return;
+
+	mptcp_peer_sk_addrs(mptcp_meta_sk(sk), NULL, &key);
+	mptcp_peer_sk_addrs(sk, &loc, &rem);
+
+	spin_lock_bh(&ns->peer_lock);
+	peer = __mptcp_peer_lookup(ns, &key, 0);
+	path = peer ? mptcp_peer_find_path(peer, &loc, &rem) : NULL;
+	if (!path || path->failed) {
+		spin_unlock_bh(&ns->peer_lock);
+		return;
+	}
+	srtt = path->srtt;
+	rttvar = path->rttvar;
+	cwnd = path->cwnd;
+	spin_unlock_bh(&ns->peer_lock);
+
+	/* No RTT-sample from the handshake - keep the fallback RTO */
+	if (tp->srtt) {
+		if (srtt > tp->srtt) {
+			tp->srtt = srtt;
+			tp->rtt_seq = tp->snd_nxt;
+		}
+		if (rttvar > tp->mdev) {
+			tp->mdev = rttvar;
+			tp->mdev_max = tp->rttvar = max(tp->mdev,
+							tcp_rto_min(sk));
+		}
+		inet_csk(sk)->icsk_rto = __tcp_set_rto(tp);
+		tcp_bound_rto(sk);
+		mptcp_set_rto(sk);
+	}
+
+	if (tp->total_retrans <= 1) {
+		cwnd = min(cwnd >> 1, tp->snd_cwnd_clamp);
+		if (cwnd > tp->snd_cwnd)
+			tp->snd_cwnd = cwnd;
+	}
+}
+
+void mptcp_peer_init_ns(struct mptcp_pm_ns *ns)
+{
+	spin_lock_init(&ns->peer_lock);
+	get_random_bytes(&ns->peer_rnd, sizeof(ns->peer_rnd));
+}
+
+void mptcp_peer_flush_ns(struct mptcp_pm_ns *ns)
+{
+	struct hlist_node *node, *tmp;
+	struct mptcp_peer *peer;
+	int i;
+
+	spin_lock_bh(&ns->peer_lock);
+	for (i = 0; i < MPTCP_PEER_HSIZE; i++) {
+		hlist_for_each_entry_safe(peer, node, tmp, &ns->peer_hash[i],
+					  hash_node) {
+			hlist_del(&peer->hash_node);
+			kfree(peer);
+		}
+	}
+	spin_unlock_bh(&ns->peer_lock);
+}
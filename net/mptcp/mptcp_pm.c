@@ -32,10 +32,14 @@
 #include <linux/netdevice.h>
 #include <linux/inetdevice.h>
 #include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/percpu_counter.h>
 #include <linux/tcp.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 #include <linux/proc_fs.h>	/* Needed by proc_net_fops_create */
 #include <net/inet_sock.h>
+#include <net/netns/generic.h>
 #include <net/tcp.h>
 #include <net/mptcp.h>
 #include <net/mptcp_v4.h>
@@ -49,74 +53,314 @@
 #include <net/addrconf.h>
 #endif
 
-static inline u32 mptcp_hash_tk(u32 token)
-{
-	return token % MPTCP_HASH_SIZE;
-}
-
-struct hlist_nulls_head tk_hashtable[MPTCP_HASH_SIZE];
-
 /* This second hashtable is needed to retrieve request socks
  * created as a result of a join request. While the SYN contains
  * the token, the final ack does not, so we need a separate hashtable
  * to retrieve the mpcb.
  */
-struct list_head mptcp_reqsk_htb[MPTCP_HASH_SIZE];
-spinlock_t mptcp_reqsk_hlock;	/* hashtable protection */
+struct mptcp_reqsk_bucket mptcp_reqsk_htb[MPTCP_HASH_SIZE];
+
+/* The token hashtable. A bucket holds the meta-sockets and the request-socks
+ * (that did not yet create their meta-sk) using a token, so that a new token
+ * is checked for uniqueness and inserted under a single bucket-lock.
+ *
+ * The table grows with the number of connections. While resizing, the new
+ * table is linked in ->future and the buckets below ->rehash have been copied
+ * into it - writers on these buckets update both tables. Lookups only walk
+ * the published table. Thus, the hashed sockets carry one node per table and
+ * each table tells with ->idx which node it uses.
+ */
+struct mptcp_tk_bucket {
+	spinlock_t		lock;
+	struct hlist_nulls_head	meta;	/* Meta-sockets */
+	struct hlist_nulls_head	reqsk;	/* Request-socks of new connections */
+};
+
+struct mptcp_tk_table {
+	struct mptcp_tk_table	*future;
+	unsigned int		mask;
+	unsigned int		rehash;	/* Buckets copied into future */
+	int			idx;	/* Node of the sockets used by the table */
+	struct mptcp_tk_bucket	buckets[0];
+};
+
+#define MPTCP_TK_MIN_SIZE	1024
+#define MPTCP_TK_MAX_SIZE	(1 << 20)
+
+static struct mptcp_tk_table __rcu *mptcp_tk_tbl;
+static unsigned int mptcp_tk_max_size;
+static struct percpu_counter mptcp_tk_count;	/* Hashed meta-sockets */
+static DEFINE_MUTEX(mptcp_tk_resize_mutex);
+
+static unsigned long mptcp_thash_entries;
+static int __init set_mptcp_thash_entries(char *str)
+{
+	if (!str)
+		return 0;
+	mptcp_thash_entries = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("mptcp_thash_entries=", set_mptcp_thash_entries);
+
+static void mptcp_tk_resize(struct work_struct *work);
+static DECLARE_WORK(mptcp_tk_resize_work, mptcp_tk_resize);
+
+#define mptcp_tk_for_each_entry_rcu(tpos, pos, head, member, idx)		\
+	for (pos = rcu_dereference_raw(hlist_nulls_first_rcu(head));		\
+		(!is_a_nulls(pos)) &&						\
+		({ tpos = hlist_nulls_entry(pos - (idx), typeof(*tpos),		\
+					    member[0]); 1; });			\
+		pos = rcu_dereference_raw(hlist_nulls_next_rcu(pos)))
+
+static inline struct mptcp_tk_table *mptcp_tk_table_get(void)
+{
+	return rcu_dereference_check(mptcp_tk_tbl, rcu_read_lock_held() ||
+						   rcu_read_lock_bh_held() ||
+				     lockdep_is_held(&mptcp_tk_resize_mutex));
+}
+
+static inline struct mptcp_tk_bucket *mptcp_tk_bucket(const struct mptcp_tk_table *tbl,
+						      u32 token)
+{
+	return (struct mptcp_tk_bucket *)&tbl->buckets[token & tbl->mask];
+}
+
+/* Has the bucket of @token already been copied in the table being built? */
+static inline int mptcp_tk_copied(const struct mptcp_tk_table *tbl, u32 token)
+{
+	return (token & tbl->mask) < tbl->rehash;
+}
+
+/* Locks the bucket of @token - and the one in the future table, if needed.
+ * Must be called with BH disabled, inside an rcu read-side section.
+ */
+static struct mptcp_tk_table *mptcp_tk_lock(u32 token)
+{
+	struct mptcp_tk_table *tbl = mptcp_tk_table_get();
+
+	spin_lock(&mptcp_tk_bucket(tbl, token)->lock);
+	if (mptcp_tk_copied(tbl, token))
+		spin_lock_nested(&mptcp_tk_bucket(tbl->future, token)->lock,
+				 SINGLE_DEPTH_NESTING);
+
+	return tbl;
+}
+
+static void mptcp_tk_unlock(struct mptcp_tk_table *tbl, u32 token)
+{
+	if (mptcp_tk_copied(tbl, token))
+		spin_unlock(&mptcp_tk_bucket(tbl->future, token)->lock);
+	spin_unlock(&mptcp_tk_bucket(tbl, token)->lock);
+}
+
+static struct mptcp_tk_table *mptcp_tk_alloc(unsigned int size, int idx)
+{
+	size_t len = sizeof(struct mptcp_tk_table) +
+		     size * sizeof(struct mptcp_tk_bucket);
+	struct mptcp_tk_table *tbl;
+	unsigned int i;
+
+	if (len <= PAGE_SIZE)
+		tbl = kzalloc(len, GFP_KERNEL);
+	else
+		tbl = vzalloc(len);
+	if (!tbl)
+		return NULL;
+
+	tbl->mask = size - 1;
+	tbl->idx = idx;
+	for (i = 0; i < size; i++) {
+		spin_lock_init(&tbl->buckets[i].lock);
+		INIT_HLIST_NULLS_HEAD(&tbl->buckets[i].meta, i);
+		INIT_HLIST_NULLS_HEAD(&tbl->buckets[i].reqsk, i);
+	}
+
+	return tbl;
+}
+
+static void mptcp_tk_free(struct mptcp_tk_table *tbl)
+{
+	if (is_vmalloc_addr(tbl))
+		vfree(tbl);
+	else
+		kfree(tbl);
+}
+
+/* Doubles the size of the token-table. The entries are copied bucket by
+ * bucket, holding the lock of the old one.
+ */
+static void mptcp_tk_resize(struct work_struct *work)
+{
+	struct mptcp_tk_table *tbl, *future;
+	unsigned int i;
+
+	mutex_lock(&mptcp_tk_resize_mutex);
+	tbl = mptcp_tk_table_get();
+
+	if (tbl->mask + 1 >= mptcp_tk_max_size ||
+	    percpu_counter_read_positive(&mptcp_tk_count) <= tbl->mask + 1)
+		goto out;
+
+	future = mptcp_tk_alloc((tbl->mask + 1) << 1, !tbl->idx);
+	if (!future)
+		goto out;
+	tbl->future = future;
+
+	for (i = 0; i <= tbl->mask; i++) {
+		struct mptcp_tk_bucket *b = &tbl->buckets[i];
+		struct mptcp_request_sock *mtreq;
+		struct hlist_nulls_node *node;
+		struct tcp_sock *meta_tp;
+
+		spin_lock_bh(&b->lock);
+		mptcp_tk_for_each_entry_rcu(meta_tp, node, &b->meta, tk_table,
+					    tbl->idx) {
+			struct mptcp_tk_bucket *fb;
+
+			fb = mptcp_tk_bucket(future, meta_tp->mptcp_loc_token);
+			spin_lock_nested(&fb->lock, SINGLE_DEPTH_NESTING);
+			hlist_nulls_add_head_rcu(&meta_tp->tk_table[future->idx],
+						 &fb->meta);
+			spin_unlock(&fb->lock);
+		}
+		mptcp_tk_for_each_entry_rcu(mtreq, node, &b->reqsk, collide_tk,
+					    tbl->idx) {
+			struct mptcp_tk_bucket *fb;
+
+			fb = mptcp_tk_bucket(future, mtreq->mptcp_loc_token);
+			spin_lock_nested(&fb->lock, SINGLE_DEPTH_NESTING);
+			hlist_nulls_add_head_rcu(&mtreq->collide_tk[future->idx],
+						 &fb->reqsk);
+			spin_unlock(&fb->lock);
+		}
+		tbl->rehash = i + 1;
+		spin_unlock_bh(&b->lock);
 
-/* The following hash table is used to avoid collision of token */
-static struct hlist_nulls_head mptcp_reqsk_tk_htb[MPTCP_HASH_SIZE];
-spinlock_t mptcp_tk_hashlock;	/* hashtable protection */
+		cond_resched();
+	}
+
+	rcu_assign_pointer(mptcp_tk_tbl, future);
+
+	/* Lookups are done with rcu_read_lock, writers disable BH */
+	synchronize_rcu();
+	synchronize_rcu_bh();
+	mptcp_tk_free(tbl);
+out:
+	mutex_unlock(&mptcp_tk_resize_mutex);
+}
 
-static int mptcp_reqsk_find_tk(u32 token)
+/* Called with the bucket of token locked */
+static int mptcp_reqsk_find_tk(const struct mptcp_tk_table *tbl, u32 token)
 {
-	u32 hash = mptcp_hash_tk(token);
 	struct mptcp_request_sock *mtreqsk;
 	const struct hlist_nulls_node *node;
 
-	hlist_nulls_for_each_entry_rcu(mtreqsk, node,
-				       &mptcp_reqsk_tk_htb[hash], collide_tk) {
+	mptcp_tk_for_each_entry_rcu(mtreqsk, node,
+				    &mptcp_tk_bucket(tbl, token)->reqsk,
+				    collide_tk, tbl->idx) {
 		if (token == mtreqsk->mptcp_loc_token)
 			return 1;
 	}
 	return 0;
 }
 
-static void mptcp_reqsk_insert_tk(struct request_sock *reqsk, u32 token)
+/* Called with the bucket of token locked */
+static int mptcp_find_token(const struct mptcp_tk_table *tbl, u32 token)
 {
-	u32 hash = mptcp_hash_tk(token);
+	struct tcp_sock *meta_tp;
+	const struct hlist_nulls_node *node;
 
-	hlist_nulls_add_head_rcu(&mptcp_rsk(reqsk)->collide_tk,
-				 &mptcp_reqsk_tk_htb[hash]);
+	mptcp_tk_for_each_entry_rcu(meta_tp, node,
+				    &mptcp_tk_bucket(tbl, token)->meta,
+				    tk_table, tbl->idx) {
+		if (token == meta_tp->mptcp_loc_token)
+			return 1;
+	}
+	return 0;
+}
+
+/* If the bucket has been copied, the future table is the one that is
+ * up-to-date with the writers that already use it.
+ */
+static int mptcp_token_used(const struct mptcp_tk_table *tbl, u32 token)
+{
+	if (mptcp_tk_copied(tbl, token))
+		tbl = tbl->future;
+
+	return mptcp_reqsk_find_tk(tbl, token) || mptcp_find_token(tbl, token);
+}
+
+/* Generates a new key whose token is neither used by an established
+ * connection nor by a pending request-sock. Returns with the token's bucket
+ * locked.
+ */
+static struct mptcp_tk_table *mptcp_new_key(u64 *key, u32 *token, u64 *idsn)
+{
+	struct mptcp_tk_table *tbl;
+
+	for (;;) {
+		get_random_bytes(key, sizeof(*key));
+		mptcp_key_sha1(*key, token, idsn);
+
+		tbl = mptcp_tk_lock(*token);
+		if (!mptcp_token_used(tbl, *token))
+			return tbl;
+		mptcp_tk_unlock(tbl, *token);
+	}
+}
+
+static void mptcp_reqsk_insert_tk(const struct mptcp_tk_table *tbl,
+				  struct request_sock *reqsk, u32 token)
+{
+	struct mptcp_request_sock *mtreq = mptcp_rsk(reqsk);
+
+	hlist_nulls_add_head_rcu(&mtreq->collide_tk[tbl->idx],
+				 &mptcp_tk_bucket(tbl, token)->reqsk);
+	if (mptcp_tk_copied(tbl, token))
+		hlist_nulls_add_head_rcu(&mtreq->collide_tk[tbl->future->idx],
+					 &mptcp_tk_bucket(tbl->future, token)->reqsk);
 }
 
 void mptcp_reqsk_remove_tk(struct request_sock *reqsk)
 {
-	rcu_read_lock();
-	spin_lock(&mptcp_tk_hashlock);
-	hlist_nulls_del_rcu(&mptcp_rsk(reqsk)->collide_tk);
-	spin_unlock(&mptcp_tk_hashlock);
-	rcu_read_unlock();
+	struct mptcp_request_sock *mtreq = mptcp_rsk(reqsk);
+	u32 token = mtreq->mptcp_loc_token;
+	struct mptcp_tk_table *tbl;
+
+	rcu_read_lock_bh();
+	tbl = mptcp_tk_lock(token);
+	hlist_nulls_del_rcu(&mtreq->collide_tk[tbl->idx]);
+	if (mptcp_tk_copied(tbl, token))
+		hlist_nulls_del_rcu(&mtreq->collide_tk[tbl->future->idx]);
+	mptcp_tk_unlock(tbl, token);
+	rcu_read_unlock_bh();
 }
 
-void __mptcp_hash_insert(struct tcp_sock *meta_tp, u32 token)
+static void __mptcp_hash_insert(struct mptcp_tk_table *tbl,
+				struct tcp_sock *meta_tp, u32 token)
 {
-	u32 hash = mptcp_hash_tk(token);
-	hlist_nulls_add_head_rcu(&meta_tp->tk_table, &tk_hashtable[hash]);
+	hlist_nulls_add_head_rcu(&meta_tp->tk_table[tbl->idx],
+				 &mptcp_tk_bucket(tbl, token)->meta);
+	if (mptcp_tk_copied(tbl, token))
+		hlist_nulls_add_head_rcu(&meta_tp->tk_table[tbl->future->idx],
+					 &mptcp_tk_bucket(tbl->future, token)->meta);
 	meta_tp->inside_tk_table = 1;
+
+	percpu_counter_inc(&mptcp_tk_count);
+	if (unlikely(percpu_counter_read_positive(&mptcp_tk_count) > tbl->mask + 1 &&
+		     tbl->mask + 1 < mptcp_tk_max_size))
+		schedule_work(&mptcp_tk_resize_work);
 }
 
-static int mptcp_find_token(u32 token)
+void mptcp_hash_insert(struct tcp_sock *meta_tp, u32 token)
 {
-	u32 hash = mptcp_hash_tk(token);
-	struct tcp_sock *meta_tp;
-	const struct hlist_nulls_node *node;
+	struct mptcp_tk_table *tbl;
 
-	hlist_nulls_for_each_entry_rcu(meta_tp, node, &tk_hashtable[hash], tk_table) {
-		if (token == meta_tp->mptcp_loc_token)
-			return 1;
-	}
-	return 0;
+	rcu_read_lock_bh();
+	tbl = mptcp_tk_lock(token);
+	__mptcp_hash_insert(tbl, meta_tp, token);
+	mptcp_tk_unlock(tbl, token);
+	rcu_read_unlock_bh();
 }
 
 /* New MPTCP-connection request, prepare a new token for the meta-socket that
@@ -127,40 +371,27 @@ void mptcp_reqsk_new_mptcp(struct request_sock *req,
 			   const struct multipath_options *mopt)
 {
 	struct mptcp_request_sock *mtreq;
+	struct mptcp_tk_table *tbl;
 	mtreq = mptcp_rsk(req);
 
-	rcu_read_lock();
-	spin_lock(&mptcp_tk_hashlock);
-	do {
-		get_random_bytes(&mtreq->mptcp_loc_key,
-				 sizeof(mtreq->mptcp_loc_key));
-		mptcp_key_sha1(mtreq->mptcp_loc_key,
-			       &mtreq->mptcp_loc_token, NULL);
-	} while (mptcp_reqsk_find_tk(mtreq->mptcp_loc_token) ||
-		 mptcp_find_token(mtreq->mptcp_loc_token));
-
-	mptcp_reqsk_insert_tk(req, mtreq->mptcp_loc_token);
-	spin_unlock(&mptcp_tk_hashlock);
-	rcu_read_unlock();
+	rcu_read_lock_bh();
+	tbl = mptcp_new_key(&mtreq->mptcp_loc_key, &mtreq->mptcp_loc_token,
+			    NULL);
+	mptcp_reqsk_insert_tk(tbl, req, mtreq->mptcp_loc_token);
+	mptcp_tk_unlock(tbl, mtreq->mptcp_loc_token);
+	rcu_read_unlock_bh();
 	mtreq->mptcp_rem_key = mopt->mptcp_rem_key;
 }
 
 void mptcp_connect_init(struct tcp_sock *tp)
 {
+	struct mptcp_tk_table *tbl;
 	u64 idsn;
 
 	rcu_read_lock_bh();
-	spin_lock(&mptcp_tk_hashlock);
-	do {
-		get_random_bytes(&tp->mptcp_loc_key,
-				 sizeof(tp->mptcp_loc_key));
-		mptcp_key_sha1(tp->mptcp_loc_key,
-			       &tp->mptcp_loc_token, &idsn);
-	} while (mptcp_reqsk_find_tk(tp->mptcp_loc_token) ||
-		 mptcp_find_token(tp->mptcp_loc_token));
-
-	__mptcp_hash_insert(tp, tp->mptcp_loc_token);
-	spin_unlock(&mptcp_tk_hashlock);
+	tbl = mptcp_new_key(&tp->mptcp_loc_key, &tp->mptcp_loc_token, &idsn);
+	__mptcp_hash_insert(tbl, tp, tp->mptcp_loc_token);
+	mptcp_tk_unlock(tbl, tp->mptcp_loc_token);
 	rcu_read_unlock_bh();
 }
 
@@ -171,41 +402,70 @@ void mptcp_connect_init(struct tcp_sock *tp)
  */
 struct sock *mptcp_hash_find(u32 token)
 {
-	u32 hash = mptcp_hash_tk(token);
+	struct mptcp_tk_table *tbl;
 	struct tcp_sock *meta_tp;
 	struct hlist_nulls_node *node;
+	struct sock *meta_sk = NULL;
+	u32 hash;
 
 	rcu_read_lock();
-	hlist_nulls_for_each_entry_rcu(meta_tp, node, &tk_hashtable[hash], tk_table) {
-		if (token == meta_tp->mptcp_loc_token) {
-			struct sock *meta_sk = (struct sock *)meta_tp;
-			sock_hold(meta_sk);
-			rcu_read_unlock();
-			return meta_sk;
+	tbl = mptcp_tk_table_get();
+	hash = token & tbl->mask;
+begin:
+	mptcp_tk_for_each_entry_rcu(meta_tp, node, &tbl->buckets[hash].meta,
+				    tk_table, tbl->idx) {
+		if (token != meta_tp->mptcp_loc_token)
+			continue;
+
+		meta_sk = (struct sock *)meta_tp;
+		/* The meta-sk may be freed and reused meanwhile - see
+		 * SLAB_DESTROY_BY_RCU in __inet_lookup_established().
+		 */
+		if (unlikely(!atomic_inc_not_zero(&meta_sk->sk_refcnt)))
+			goto begin;
+		if (unlikely(token != meta_tp->mptcp_loc_token ||
+			     !meta_tp->inside_tk_table)) {
+			sock_put(meta_sk);
+			goto begin;
 		}
+		goto out;
 	}
+	/* The last node may have moved to another chain - restart */
+	if (get_nulls_value(node) != hash)
+		goto begin;
+	meta_sk = NULL;
+out:
 	rcu_read_unlock();
-	return NULL;
+	return meta_sk;
+}
+
+static void __mptcp_hash_remove(struct tcp_sock *meta_tp)
+{
+	u32 token = meta_tp->mptcp_loc_token;
+	struct mptcp_tk_table *tbl;
+
+	tbl = mptcp_tk_lock(token);
+	hlist_nulls_del_rcu(&meta_tp->tk_table[tbl->idx]);
+	if (mptcp_tk_copied(tbl, token))
+		hlist_nulls_del_rcu(&meta_tp->tk_table[tbl->future->idx]);
+	meta_tp->inside_tk_table = 0;
+	mptcp_tk_unlock(tbl, token);
+
+	percpu_counter_dec(&mptcp_tk_count);
 }
 
 void mptcp_hash_remove_bh(struct tcp_sock *meta_tp)
 {
 	/* remove from the token hashtable */
 	rcu_read_lock_bh();
-	spin_lock(&mptcp_tk_hashlock);
-	hlist_nulls_del_rcu(&meta_tp->tk_table);
-	meta_tp->inside_tk_table = 0;
-	spin_unlock(&mptcp_tk_hashlock);
+	__mptcp_hash_remove(meta_tp);
 	rcu_read_unlock_bh();
 }
 
 void mptcp_hash_remove(struct tcp_sock *meta_tp)
 {
 	rcu_read_lock();
-	spin_lock(&mptcp_tk_hashlock);
-	hlist_nulls_del_rcu(&meta_tp->tk_table);
-	meta_tp->inside_tk_table = 0;
-	spin_unlock(&mptcp_tk_hashlock);
+	__mptcp_hash_remove(meta_tp);
 	rcu_read_unlock();
 }
 
@@ -241,11 +501,22 @@ u8 mptcp_get_loc_addrid(struct mptcp_cb *mpcb, struct sock* sk)
 	BUG();
 }
 
+static int mptcp_pm_net_id __read_mostly;
+
+struct mptcp_pm_ns *mptcp_pm_get_ns(const struct net *net)
+{
+	return net_generic(net, mptcp_pm_net_id);
+}
+
+/* The address-table is too big to be copied on the stack. Thus, it is
+ * used with ns->lock held, which nests inside the meta-lock.
+ */
 void mptcp_set_addresses(struct sock *meta_sk)
 {
 	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
-	struct net *netns = sock_net(meta_sk);
-	struct net_device *dev;
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(meta_sk));
+	const struct mptcp_loc_addr *addrs = &ns->addrs;
+	int i, j;
 
 	/* if multiports is requested, we work with the main address
 	 * and play only with the ports
@@ -253,109 +524,73 @@ void mptcp_set_addresses(struct sock *meta_sk)
 	if (sysctl_mptcp_ndiffports > 1)
 		return;
 
-	rcu_read_lock();
-	read_lock_bh(&dev_base_lock);
+	spin_lock_bh(&ns->lock);
+	mpcb->addr_gen = addrs->generation;
 
-	for_each_netdev(netns, dev) {
-		if (netif_running(dev)) {
-			struct in_device *in_dev = __in_dev_get_rcu(dev);
-			struct in_ifaddr *ifa;
-			__be32 ifa_address;
-#if IS_ENABLED(CONFIG_IPV6)
-			struct inet6_dev *in6_dev = __in6_dev_get(dev);
-			struct inet6_ifaddr *ifa6;
-#endif
+	mptcp_for_each_bit_set(addrs->loc4_bits, j) {
+		const struct mptcp_loc4 *loc = &addrs->locaddr4[j];
 
-			if (dev->flags & (IFF_LOOPBACK | IFF_NOMULTIPATH))
-				continue;
+		if ((meta_sk->sk_family == AF_INET ||
+		     mptcp_v6_is_v4_mapped(meta_sk)) &&
+		    inet_sk(meta_sk)->inet_saddr == loc->addr.s_addr) {
+			if (mpcb->loc4_bits & 1)
+				mpcb->addr4[0].low_prio = loc->low_prio;
+			continue;
+		}
 
-			if (!in_dev)
-				goto cont_ipv6;
-
-			for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next) {
-				int i;
-				ifa_address = ifa->ifa_local;
-
-				if (ifa->ifa_scope == RT_SCOPE_HOST)
-					continue;
-
-				if ((meta_sk->sk_family == AF_INET ||
-				     mptcp_v6_is_v4_mapped(meta_sk)) &&
-				    inet_sk(meta_sk)->inet_saddr == ifa_address) {
-					mpcb->addr4[0].low_prio = dev->flags &
-								IFF_MPBACKUP ? 1 : 0;
-					continue;
-				}
-
-				i = __mptcp_find_free_index(mpcb->loc4_bits, -1,
-							    mpcb->next_v4_index);
-				if (i < 0) {
-					mptcp_debug("%s: At max num of local "
-						"addresses: %d --- not adding "
-						"address: %pI4\n", __func__,
-						MPTCP_MAX_ADDR, &ifa_address);
-					goto out;
-				}
-				mpcb->addr4[i].addr.s_addr = ifa_address;
-				mpcb->addr4[i].port = 0;
-				mpcb->addr4[i].id = i;
-				mpcb->addr4[i].low_prio = (dev->flags & IFF_MPBACKUP) ?
-								1 : 0;
-				mpcb->loc4_bits |= (1 << i);
-				mpcb->next_v4_index = i + 1;
-				mptcp_v4_send_add_addr(i, mpcb);
-			}
+		i = __mptcp_find_free_index(mpcb->loc4_bits, -1,
+					    mpcb->next_v4_index);
+		if (i < 0) {
+			mptcp_debug("%s: At max num of local addresses: %d --- "
+				    "not adding address: %pI4\n", __func__,
+				    MPTCP_MAX_ADDR, &loc->addr.s_addr);
+			break;
+		}
+		if (mptcp_addr_table_grow(mpcb->addr4, mpcb->addr4_size, i))
+			break;
+
+		mpcb->addr4[i].addr.s_addr = loc->addr.s_addr;
+		mpcb->addr4[i].port = 0;
+		mpcb->addr4[i].id = i;
+		mpcb->addr4[i].low_prio = loc->low_prio;
+		mpcb->loc4_bits |= (1U << i);
+		mpcb->next_v4_index = i + 1;
+		mptcp_v4_send_add_addr(i, mpcb);
+	}
 
-cont_ipv6:
-; /* This ; is necessary to fix build-errors when IPv6 is disabled */
 #if IS_ENABLED(CONFIG_IPV6)
-			if (!in6_dev)
-				continue;
+	mptcp_for_each_bit_set(addrs->loc6_bits, j) {
+		const struct mptcp_loc6 *loc = &addrs->locaddr6[j];
 
-			list_for_each_entry(ifa6, &in6_dev->addr_list, if_list) {
-				int addr_type = ipv6_addr_type(&ifa6->addr);
-				int i;
-
-				if (addr_type == IPV6_ADDR_ANY ||
-				    addr_type & IPV6_ADDR_LOOPBACK ||
-				    addr_type & IPV6_ADDR_LINKLOCAL)
-					continue;
-
-				if (meta_sk->sk_family == AF_INET6 &&
-				    ipv6_addr_equal(&inet6_sk(meta_sk)->saddr,
-						    &(ifa6->addr))) {
-					mpcb->addr6[0].low_prio = dev->flags &
-								IFF_MPBACKUP ? 1 : 0;
-					continue;
-				}
-
-				i = __mptcp_find_free_index(mpcb->loc6_bits, -1,
-							    mpcb->next_v6_index);
-				if (i < 0) {
-					mptcp_debug("%s: At max num of local"
-						"addresses: %d --- not adding"
-						"address: %pI6\n", __func__,
-						MPTCP_MAX_ADDR, &ifa6->addr);
-					goto out;
-				}
-
-				ipv6_addr_copy(&(mpcb->addr6[i].addr),
-					&(ifa6->addr));
-				mpcb->addr6[i].port = 0;
-				mpcb->addr6[i].id = i + MPTCP_MAX_ADDR;
-				mpcb->addr6[i].low_prio = (dev->flags & IFF_MPBACKUP) ?
-								1 : 0;
-				mpcb->loc6_bits |= (1 << i);
-				mpcb->next_v6_index = i + 1;
-				mptcp_v6_send_add_addr(i, mpcb);
-			}
-#endif
+		if (meta_sk->sk_family == AF_INET6 &&
+		    ipv6_addr_equal(&inet6_sk(meta_sk)->saddr, &loc->addr)) {
+			if (mpcb->loc6_bits & 1)
+				mpcb->addr6[0].low_prio = loc->low_prio;
+			continue;
+		}
+
+		i = __mptcp_find_free_index(mpcb->loc6_bits, -1,
+					    mpcb->next_v6_index);
+		if (i < 0) {
+			mptcp_debug("%s: At max num of local addresses: %d --- "
+				    "not adding address: %pI6\n", __func__,
+				    MPTCP_MAX_ADDR, &loc->addr);
+			break;
 		}
+		if (mptcp_addr_table_grow(mpcb->addr6, mpcb->addr6_size, i))
+			break;
+
+		ipv6_addr_copy(&mpcb->addr6[i].addr, &loc->addr);
+		mpcb->addr6[i].port = 0;
+		mpcb->addr6[i].id = i + MPTCP_MAX_ADDR;
+		mpcb->addr6[i].low_prio = loc->low_prio;
+		mpcb->loc6_bits |= (1U << i);
+		mpcb->next_v6_index = i + 1;
+		mptcp_v6_send_add_addr(i, mpcb);
 	}
+#endif
 
-out:
-	read_unlock_bh(&dev_base_lock);
-	rcu_read_unlock();
+	spin_unlock_bh(&ns->lock);
 }
 
 int mptcp_check_req(struct sk_buff *skb)
@@ -447,12 +682,16 @@ int mptcp_lookup_join(struct sk_buff *skb)
 	meta_sk = mptcp_hash_find(token);
 	if (!meta_sk) {
 		mptcp_debug("%s:mpcb not found:%x\n", __func__, token);
+		NET_INC_STATS_BH(dev_net(skb->dev),
+				 LINUX_MIB_MPTCPJOINNOTOKEN);
 		return -1;
 	}
 
 	mpcb = tcp_sk(meta_sk)->mpcb;
 	if (mpcb->infinite_mapping) {
 		/* We are in fallback-mode - thus no new subflows!!! */
+		NET_INC_STATS_BH(sock_net(meta_sk),
+				 LINUX_MIB_MPTCPJOININFINITE);
 		sock_put(meta_sk); /* Taken by mptcp_hash_find */
 		return -1;
 	}
@@ -493,11 +732,15 @@ int mptcp_do_join_short(struct sk_buff *skb, struct multipath_options *mopt,
 	meta_sk = mptcp_hash_find(token);
 	if (!meta_sk) {
 		mptcp_debug("%s:mpcb not found:%x\n", __func__, token);
+		NET_INC_STATS_BH(dev_net(skb->dev),
+				 LINUX_MIB_MPTCPJOINNOTOKEN);
 		return -1;
 	}
 
 	if ( tcp_sk(meta_sk)->mpcb->infinite_mapping) {
 		/* We are in fallback-mode - thus no new subflows!!! */
+		NET_INC_STATS_BH(sock_net(meta_sk),
+				 LINUX_MIB_MPTCPJOININFINITE);
 		sock_put(meta_sk); /* Taken by mptcp_hash_find */
 		return -1;
 	}
@@ -536,52 +779,348 @@ int mptcp_do_join_short(struct sk_buff *skb, struct multipath_options *mopt,
 	return 0;
 }
 
-void mptcp_retry_subflow_worker(struct work_struct *work)
+/****** ECMP-aware ndiffports ******/
+
+static int mptcp_ecmp_enabled(void)
+{
+	return sysctl_mptcp_ndiffports > 1 && sysctl_mptcp_ecmp_paths > 1;
+}
+
+/* The ECMP-path, out of @paths, a flow is hashed on by the fabric, according
+ * to the model configured by sysctl_mptcp_ecmp_hash. The addresses are in
+ * host-order, IPv6-addresses being folded to 32 bits.
+ *
+ * @paths is a snapshot of sysctl_mptcp_ecmp_paths, taken by the caller -
+ * the sysctl may become 0 at any time.
+ */
+static u32 mptcp_ecmp_bucket(u32 paths, u32 saddr, u32 daddr, __be16 sport,
+			     __be16 dport)
+{
+	u32 ports = ((u32)ntohs(sport) << 16) | ntohs(dport);
+	u32 h;
+
+	switch (sysctl_mptcp_ecmp_hash) {
+	case MPTCP_ECMP_HASH_JHASH:
+		h = jhash_3words(saddr, daddr, ports, sysctl_mptcp_ecmp_seed);
+		break;
+	default: /* MPTCP_ECMP_HASH_XOR */
+		h = saddr ^ daddr ^ ports ^ IPPROTO_TCP ^ sysctl_mptcp_ecmp_seed;
+		h ^= h >> 16;
+		h ^= h >> 8;
+	}
+
+	return h % paths;
+}
+
+#if IS_ENABLED(CONFIG_IPV6)
+static u32 mptcp_ecmp_fold6(const struct in6_addr *addr)
+{
+	return ntohl(addr->s6_addr32[0] ^ addr->s6_addr32[1] ^
+		     addr->s6_addr32[2] ^ addr->s6_addr32[3]);
+}
+#endif
+
+static u32 mptcp_ecmp_sk_bucket(struct sock *sk, u32 paths)
+{
+	const struct inet_sock *inet = inet_sk(sk);
+
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6 && !mptcp_v6_is_v4_mapped(sk))
+		return mptcp_ecmp_bucket(paths,
+					 mptcp_ecmp_fold6(&inet6_sk(sk)->saddr),
+					 mptcp_ecmp_fold6(&inet6_sk(sk)->daddr),
+					 inet->inet_sport, inet->inet_dport);
+#endif
+	return mptcp_ecmp_bucket(paths, ntohl(inet->inet_saddr),
+				 ntohl(inet->inet_daddr),
+				 inet->inet_sport, inet->inet_dport);
+}
+
+/* Pick a source-port, such that the new subflow is hashed on an ECMP-path
+ * that is neither used by the other subflows, nor part of @avoid. Like
+ * inet_csk_get_port, the ports reserved by the admin are skipped.
+ * Returns 0 (any port) if there is none or ECMP-awareness is disabled.
+ */
+static __be16 mptcp_ecmp_pick_port(struct sock *meta_sk, u32 saddr,
+				   u32 daddr, __be16 dport, u64 avoid)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	u32 paths = ACCESS_ONCE(sysctl_mptcp_ecmp_paths);
+	struct sock *sk;
+	int low, high, i;
+
+	if (sysctl_mptcp_ndiffports <= 1 || (int)paths <= 1)
+		return 0;
+
+	mptcp_for_each_sk(mpcb, sk)
+		avoid |= 1ULL << mptcp_ecmp_sk_bucket(sk, paths);
+
+	inet_get_local_port_range(&low, &high);
+
+	for (i = 0; i < MPTCP_ECMP_PORT_TRIES; i++) {
+		int rover = low + net_random() % (high - low + 1);
+		__be16 port = htons(rover);
+
+		if (inet_is_reserved_local_port(rover))
+			continue;
+
+		if (!(avoid & (1ULL << mptcp_ecmp_bucket(paths, saddr, daddr,
+							  port, dport))))
+			return port;
+	}
+
+	return 0;
+}
+
+static int __mptcp_ndiffports_subflow(struct sock *meta_sk, u64 avoid,
+				      int any_port)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+
+	if (meta_sk->sk_family == AF_INET || mptcp_v6_is_v4_mapped(meta_sk)) {
+		struct mptcp_rem4 *rem = &mpcb->rx_opt.addr4[0];
+		struct mptcp_loc4 loc;
+
+		if (!(mpcb->loc4_bits & 1) || !(mpcb->rx_opt.rem4_bits & 1))
+			return -EADDRNOTAVAIL;
+
+		loc = mpcb->addr4[0];
+		if (!any_port)
+			loc.port = mptcp_ecmp_pick_port(meta_sk,
+					ntohl(loc.addr.s_addr),
+					ntohl(rem->addr.s_addr),
+					rem->port ? : inet_sk(meta_sk)->inet_dport,
+					avoid);
+
+		return mptcp_init4_subsockets(meta_sk, &loc, rem);
+	}
+#if IS_ENABLED(CONFIG_IPV6)
+	else {
+		struct mptcp_rem6 *rem = &mpcb->rx_opt.addr6[0];
+		struct mptcp_loc6 loc;
+
+		if (!(mpcb->loc6_bits & 1) || !(mpcb->rx_opt.rem6_bits & 1))
+			return -EADDRNOTAVAIL;
+
+		loc = mpcb->addr6[0];
+		if (!any_port)
+			loc.port = mptcp_ecmp_pick_port(meta_sk,
+					mptcp_ecmp_fold6(&loc.addr),
+					mptcp_ecmp_fold6(&rem->addr),
+					rem->port ? : inet_sk(meta_sk)->inet_dport,
+					avoid);
+
+		return mptcp_init6_subsockets(meta_sk, &loc, rem);
+	}
+#endif
+
+	return -EADDRNOTAVAIL;
+}
+
+/* Open an additional ndiffports-subflow between the initial addresses. The
+ * port picked for ECMP may already be in use, then bind() fails and another
+ * one is picked. The last try lets bind() choose any free port.
+ */
+static int mptcp_ndiffports_subflow(struct sock *meta_sk, u64 avoid)
+{
+	int i, ret;
+
+	for (i = 1; i <= MPTCP_ECMP_BIND_TRIES; i++) {
+		ret = __mptcp_ndiffports_subflow(meta_sk, avoid,
+						 i == MPTCP_ECMP_BIND_TRIES);
+		if (ret != -EADDRINUSE)
+			break;
+	}
+
+	return ret;
+}
+
+/* Called with the meta-lock held */
+static void mptcp_ecmp_start(struct sock *meta_sk)
+{
+	struct mptcp_pm_work *pm_work = tcp_sk(meta_sk)->mpcb->pm_work;
+
+	if (!mptcp_ecmp_enabled())
+		return;
+
+	pm_work->ecmp_stable = 0;
+	if (delayed_work_pending(&pm_work->ecmp_work))
+		return;
+
+	sock_hold(meta_sk);
+	if (!queue_delayed_work(mptcp_wq, &pm_work->ecmp_work,
+				msecs_to_jiffies(MPTCP_ECMP_INTERVAL)))
+		sock_put(meta_sk);
+}
+
+/* Two subflows that both lost packets during the last interval and whose
+ * RTTs are within 1/2^MPTCP_ECMP_RTT_SHIFT of each other, are assumed to
+ * share a bottleneck - the hash-model did not match the fabric.
+ */
+static int mptcp_ecmp_shared(const struct tcp_sock *tp1,
+			     const struct tcp_sock *tp2)
+{
+	u32 rtt_max = max(tp1->srtt, tp2->srtt);
+
+	return tp1->total_retrans != tp1->mptcp->ecmp_retrans &&
+	       tp2->total_retrans != tp2->mptcp->ecmp_retrans &&
+	       abs((int)tp1->srtt - (int)tp2->srtt) <=
+	       (rtt_max >> MPTCP_ECMP_RTT_SHIFT);
+}
+
+/* The subflow tp seems to share a bottleneck with - preferably the same one
+ * as during the previous checks. NULL if there is none.
+ */
+static struct tcp_sock *mptcp_ecmp_peer(struct mptcp_cb *mpcb,
+					struct tcp_sock *tp)
+{
+	struct tcp_sock *tp_it, *peer = NULL;
+
+	if (((struct sock *)tp)->sk_state != TCP_ESTABLISHED)
+		return NULL;
+
+	mptcp_for_each_tp(mpcb, tp_it) {
+		if (tp_it == tp ||
+		    ((struct sock *)tp_it)->sk_state != TCP_ESTABLISHED ||
+		    !mptcp_ecmp_shared(tp, tp_it))
+			continue;
+
+		if (tp_it->mptcp->path_index == tp->mptcp->ecmp_peer)
+			return tp_it;
+		if (!peer)
+			peer = tp_it;
+	}
+
+	return peer;
+}
+
+/* Periodically looks for ndiffports-subflows sharing a bottleneck. A single
+ * interval with losses on two subflows may be a coincidence, thus a pair
+ * has to look shared during MPTCP_ECMP_HITS checks in a row. At most one
+ * subflow is then closed per interval and re-opened with a source-port that
+ * hashes on another ECMP-path. The initial subflow is never re-rolled.
+ *
+ * Once no pair looked shared during MPTCP_ECMP_STABLE intervals, the checks
+ * stop until a new ndiffports-subflow is opened (see mptcp_ecmp_start).
+ */
+void mptcp_ecmp_worker(struct work_struct *work)
 {
 	struct delayed_work *delayed_work =
 		container_of(work, struct delayed_work, work);
-	struct mptcp_cb *mpcb =
-		container_of(delayed_work, struct mptcp_cb, subflow_retry_work);
+	struct mptcp_cb *mpcb = container_of(delayed_work, struct mptcp_pm_work,
+					     ecmp_work)->mpcb;
 	struct sock *meta_sk = mpcb->meta_sk;
-	int iter = 0, i;
+	struct tcp_sock *tp;
+	struct sock *victim = NULL;
+	u32 paths = ACCESS_ONCE(sysctl_mptcp_ecmp_paths);
+	int put = 1, suspects = 0;
+
+	mutex_lock(&mpcb->mutex);
+	lock_sock_nested(meta_sk, SINGLE_DEPTH_NESTING);
+
+	if (sock_flag(meta_sk, SOCK_DEAD) || sysctl_mptcp_ndiffports <= 1 ||
+	    (int)paths <= 1 || mpcb->infinite_mapping)
+		goto exit;
 
-next_subflow:
-	if (iter) {
-		release_sock(meta_sk);
-		mutex_unlock(&mpcb->mutex);
+	mptcp_for_each_tp(mpcb, tp) {
+		struct tcp_sock *peer = mptcp_ecmp_peer(mpcb, tp);
 
-		yield();
+		if (!peer) {
+			tp->mptcp->ecmp_peer = 0;
+			tp->mptcp->ecmp_hits = 0;
+			continue;
+		}
+
+		suspects = 1;
+		if (peer->mptcp->path_index == tp->mptcp->ecmp_peer) {
+			if (tp->mptcp->ecmp_hits < MPTCP_ECMP_HITS)
+				tp->mptcp->ecmp_hits++;
+		} else {
+			tp->mptcp->ecmp_peer = peer->mptcp->path_index;
+			tp->mptcp->ecmp_hits = 1;
+		}
+
+		if (!victim && !is_master_tp(tp) &&
+		    tp->mptcp->ecmp_hits >= MPTCP_ECMP_HITS)
+			victim = (struct sock *)tp;
 	}
+
+	mptcp_for_each_tp(mpcb, tp) {
+		tp->mptcp->ecmp_retrans = tp->total_retrans;
+		/* A re-roll changes the paths - start counting again */
+		if (victim) {
+			tp->mptcp->ecmp_peer = 0;
+			tp->mptcp->ecmp_hits = 0;
+		}
+	}
+
+	if (victim) {
+		u64 avoid = 1ULL << mptcp_ecmp_sk_bucket(victim, paths);
+
+		mptcp_debug("%s: token %#x re-rolling pi %d\n", __func__,
+			    mpcb->mptcp_loc_token,
+			    tcp_sk(victim)->mptcp->path_index);
+
+		local_bh_disable();
+		mptcp_reinject_data(victim, 0);
+		victim->sk_err = ECONNRESET;
+		tcp_send_active_reset(victim, GFP_ATOMIC);
+		mptcp_sub_force_close(victim);
+		local_bh_enable();
+
+		mptcp_ndiffports_subflow(meta_sk, avoid);
+	}
+
+	if (suspects)
+		mpcb->pm_work->ecmp_stable = 0;
+	else if (++mpcb->pm_work->ecmp_stable >= MPTCP_ECMP_STABLE)
+		goto exit;
+
+	/* The pending work keeps the reference */
+	if (queue_delayed_work(mptcp_wq, &mpcb->pm_work->ecmp_work,
+			       msecs_to_jiffies(MPTCP_ECMP_INTERVAL)))
+		put = 0;
+
+exit:
+	release_sock(meta_sk);
+	mutex_unlock(&mpcb->mutex);
+	if (put)
+		sock_put(meta_sk);
+}
+
+void mptcp_retry_subflow_worker(struct work_struct *work)
+{
+	struct delayed_work *delayed_work =
+		container_of(work, struct delayed_work, work);
+	struct mptcp_cb *mpcb = container_of(delayed_work, struct mptcp_pm_work,
+					     subflow_retry_work)->mpcb;
+	struct sock *meta_sk = mpcb->meta_sk;
+	int i, j;
+
 	mutex_lock(&mpcb->mutex);
 	lock_sock_nested(meta_sk, SINGLE_DEPTH_NESTING);
 
-	iter++;
-
 	if (sock_flag(meta_sk, SOCK_DEAD))
 		goto exit;
 
+	/* Retry all of them at once, see mptcp_create_subflow_worker */
 	mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, i) {
 		struct mptcp_rem4 *rem = &mpcb->rx_opt.addr4[i];
-		/* Do we need to retry establishing a subflow ? */
-		if (rem->retry_bitfield) {
-			int i = mptcp_find_free_index(~rem->retry_bitfield);
-			mptcp_init4_subsockets(meta_sk, &mpcb->addr4[i], rem);
-			rem->retry_bitfield &= ~(1 << mpcb->addr4[i].id);
-			goto next_subflow;
-		}
+		u32 retry_bits = rem->retry_bitfield & mpcb->loc4_bits;
+
+		rem->retry_bitfield = 0;
+		mptcp_for_each_bit_set(retry_bits, j)
+			mptcp_init4_subsockets(meta_sk, &mpcb->addr4[j], rem);
 	}
 
 #if IS_ENABLED(CONFIG_IPV6)
 	mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, i) {
 		struct mptcp_rem6 *rem = &mpcb->rx_opt.addr6[i];
+		u32 retry_bits = rem->retry_bitfield & mpcb->loc6_bits;
 
-		/* Do we need to retry establishing a subflow ? */
-		if (rem->retry_bitfield) {
-			int i = mptcp_find_free_index(~rem->retry_bitfield);
-			mptcp_init6_subsockets(meta_sk, &mpcb->addr6[i], rem);
-			rem->retry_bitfield &= ~(1 << mpcb->addr6[i].id);
-			goto next_subflow;
-		}
+		rem->retry_bitfield = 0;
+		mptcp_for_each_bit_set(retry_bits, j)
+			mptcp_init6_subsockets(meta_sk, &mpcb->addr6[j], rem);
 	}
 #endif
 
@@ -594,93 +1133,79 @@ exit:
 /**
  * Create all new subflows, by doing calls to mptcp_initX_subsockets
  *
- * This function uses a goto next_subflow, to allow releasing the lock between
- * new subflows and giving other processes a chance to do some work on the
- * socket and potentially finishing the communication.
+ * All pending local/remote combinations are started within a single hold
+ * of the meta-lock. The connects are non-blocking, thus this only sends the
+ * SYNs - the handshakes complete asynchronously and all subflows are in
+ * flight within the same RTT.
  **/
 void mptcp_create_subflow_worker(struct work_struct *work)
 {
-	struct mptcp_cb *mpcb = container_of(work, struct mptcp_cb, subflow_work);
+	struct mptcp_cb *mpcb = container_of(work, struct mptcp_pm_work,
+					     subflow_work)->mpcb;
 	struct sock *meta_sk = mpcb->meta_sk;
-	int iter = 0, retry = 0;
-	int i;
-
-next_subflow:
-	if (iter) {
-		release_sock(meta_sk);
-		mutex_unlock(&mpcb->mutex);
+	int iter, retry = 0;
+	int i, j;
 
-		yield();
-	}
 	mutex_lock(&mpcb->mutex);
 	lock_sock_nested(meta_sk, SINGLE_DEPTH_NESTING);
 
-	iter++;
-
 	if (sock_flag(meta_sk, SOCK_DEAD))
 		goto exit;
 
-	if (sysctl_mptcp_ndiffports > iter &&
-	    sysctl_mptcp_ndiffports > mpcb->cnt_subflows) {
-		if (meta_sk->sk_family == AF_INET ||
-		    mptcp_v6_is_v4_mapped(meta_sk)) {
-			mptcp_init4_subsockets(meta_sk, &mpcb->addr4[0],
-					       &mpcb->rx_opt.addr4[0]);
-		} else {
-#if IS_ENABLED(CONFIG_IPV6)
-			mptcp_init6_subsockets(meta_sk, &mpcb->addr6[0],
-					       &mpcb->rx_opt.addr6[0]);
-#endif
-		}
-		goto next_subflow;
+	for (iter = 1; sysctl_mptcp_ndiffports > iter &&
+	     sysctl_mptcp_ndiffports > mpcb->cnt_subflows; iter++) {
+		if (mptcp_ndiffports_subflow(meta_sk, 0) == -EADDRNOTAVAIL)
+			goto exit;
+
+		mptcp_ecmp_start(meta_sk);
 	}
 	if (sysctl_mptcp_ndiffports > 1 &&
 	    sysctl_mptcp_ndiffports == mpcb->cnt_subflows)
 		goto exit;
 
 	mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, i) {
-		struct mptcp_rem4 *rem;
-		u8 remaining_bits;
+		struct mptcp_rem4 *rem = &mpcb->rx_opt.addr4[i];
+		u32 remaining_bits = ~(rem->bitfield) & mpcb->loc4_bits;
 
-		rem = &mpcb->rx_opt.addr4[i];
-		remaining_bits = ~(rem->bitfield) & mpcb->loc4_bits;
+		mptcp_for_each_bit_set(remaining_bits, j) {
+			if (mptcp_peer_path_failed(meta_sk, AF_INET,
+						   &mpcb->addr4[j].addr,
+						   &rem->addr)) {
+				rem->bitfield |= (1U << j);
+				continue;
+			}
 
-		/* Are there still combinations to handle? */
-		if (remaining_bits) {
-			int i = mptcp_find_free_index(~remaining_bits);
 			/* If a route is not yet available then retry once */
-			if (mptcp_init4_subsockets(meta_sk, &mpcb->addr4[i],
+			if (mptcp_init4_subsockets(meta_sk, &mpcb->addr4[j],
 						   rem) == -ENETUNREACH)
-				retry = rem->retry_bitfield |=
-					(1 << mpcb->addr4[i].id);
-			goto next_subflow;
+				retry = rem->retry_bitfield |= (1U << j);
 		}
 	}
 
 #if IS_ENABLED(CONFIG_IPV6)
 	mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, i) {
-		struct mptcp_rem6 *rem;
-		u8 remaining_bits;
+		struct mptcp_rem6 *rem = &mpcb->rx_opt.addr6[i];
+		u32 remaining_bits = ~(rem->bitfield) & mpcb->loc6_bits;
 
-		rem = &mpcb->rx_opt.addr6[i];
-		remaining_bits = ~(rem->bitfield) & mpcb->loc6_bits;
+		mptcp_for_each_bit_set(remaining_bits, j) {
+			if (mptcp_peer_path_failed(meta_sk, AF_INET6,
+						   &mpcb->addr6[j].addr,
+						   &rem->addr)) {
+				rem->bitfield |= (1U << j);
+				continue;
+			}
 
-		/* Are there still combinations to handle? */
-		if (remaining_bits) {
-			int i = mptcp_find_free_index(~remaining_bits);
 			/* If a route is not yet available then retry once */
-			if (mptcp_init6_subsockets(meta_sk, &mpcb->addr6[i],
+			if (mptcp_init6_subsockets(meta_sk, &mpcb->addr6[j],
 						   rem) == -ENETUNREACH)
-				retry = rem->retry_bitfield |=
-					(1 << mpcb->addr6[i].id);
-			goto next_subflow;
+				retry = rem->retry_bitfield |= (1U << j);
 		}
 	}
 #endif
 
-	if (retry && !delayed_work_pending(&mpcb->subflow_retry_work)) {
+	if (retry && !delayed_work_pending(&mpcb->pm_work->subflow_retry_work)) {
 		sock_hold(meta_sk);
-		queue_delayed_work(mptcp_wq, &mpcb->subflow_retry_work,
+		queue_delayed_work(mptcp_wq, &mpcb->pm_work->subflow_retry_work,
 				   msecs_to_jiffies(MPTCP_SUBFLOW_RETRY_DELAY));
 	}
 
@@ -690,216 +1215,204 @@ exit:
 	sock_put(meta_sk);
 }
 
+/* Returns the workers of the connection, allocating them on first use.
+ * Also called without the meta-lock (see mptcp_pm_ns_address_worker), thus
+ * the pointer is published with cmpxchg.
+ */
+struct mptcp_pm_work *mptcp_pm_work_get(struct mptcp_cb *mpcb)
+{
+	struct mptcp_pm_work *pm_work = ACCESS_ONCE(mpcb->pm_work);
+	struct mptcp_pm_work *old;
+
+	if (likely(pm_work))
+		return pm_work;
+
+	pm_work = kmalloc(sizeof(*pm_work), GFP_ATOMIC);
+	if (!pm_work)
+		return NULL;
+
+	pm_work->mpcb = mpcb;
+	INIT_WORK(&pm_work->subflow_work, mptcp_create_subflow_worker);
+	INIT_DELAYED_WORK(&pm_work->subflow_retry_work,
+			  mptcp_retry_subflow_worker);
+	INIT_WORK(&pm_work->address_work, mptcp_address_worker);
+	INIT_DELAYED_WORK(&pm_work->ecmp_work, mptcp_ecmp_worker);
+	pm_work->ecmp_stable = 0;
+
+	old = cmpxchg(&mpcb->pm_work, NULL, pm_work);
+	if (old) {
+		kfree(pm_work);
+		return old;
+	}
+
+	return pm_work;
+}
+
+/* Is there still a combination of local/remote addresses to try? */
+static int mptcp_subflows_pending(const struct mptcp_cb *mpcb)
+{
+	int i;
+
+	if (sysctl_mptcp_ndiffports > mpcb->cnt_subflows)
+		return 1;
+
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, i) {
+		if (~mpcb->rx_opt.addr4[i].bitfield & mpcb->loc4_bits)
+			return 1;
+	}
+#if IS_ENABLED(CONFIG_IPV6)
+	mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, i) {
+		if (~mpcb->rx_opt.addr6[i].bitfield & mpcb->loc6_bits)
+			return 1;
+	}
+#endif
+
+	return 0;
+}
+
 void mptcp_create_subflows(struct sock *meta_sk)
 {
 	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct mptcp_pm_work *pm_work;
 
 	if ((mpcb->master_sk && !tcp_sk(mpcb->master_sk)->mptcp->fully_established) ||
 	    mpcb->infinite_mapping ||
 	    mpcb->server_side ||
+	    sysctl_mptcp_userspace_pm ||
 	    sock_flag(meta_sk, SOCK_DEAD))
 		return;
 
-	if (!work_pending(&mpcb->subflow_work)) {
+	/* Do not allocate the workers of single-path connections */
+	if (!mptcp_subflows_pending(mpcb))
+		return;
+
+	pm_work = mptcp_pm_work_get(mpcb);
+	if (!pm_work)
+		return;
+
+	if (!work_pending(&pm_work->subflow_work)) {
 		sock_hold(meta_sk);
-		queue_work(mptcp_wq, &mpcb->subflow_work);
+		queue_work(mptcp_wq, &pm_work->subflow_work);
 	}
 }
 
+/* Called with ns->lock held, after each change of the address-table.
+ * If the work is already pending, this event will be handled by the same
+ * pass over the connections.
+ */
+void mptcp_pm_addr_changed(struct mptcp_pm_ns *ns)
+{
+	ns->addrs.generation++;
+	queue_delayed_work(mptcp_wq, &ns->address_work,
+			   msecs_to_jiffies(MPTCP_ADDR_EVENT_DELAY));
+}
+
+/* Reconcile the local addresses of the connection with the address-table */
 void mptcp_address_worker(struct work_struct *work)
 {
-	struct mptcp_cb *mpcb = container_of(work, struct mptcp_cb, address_work);
-	struct sock *meta_sk = mpcb->meta_sk, *sk, *tmpsk;
-	struct net *netns = sock_net(meta_sk);
-	struct net_device *dev;
-	int i;
+	struct mptcp_cb *mpcb = container_of(work, struct mptcp_pm_work,
+					     address_work)->mpcb;
+	struct sock *meta_sk = mpcb->meta_sk;
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(sock_net(meta_sk));
 
 	lock_sock(meta_sk);
 
-	if (sock_flag(meta_sk, SOCK_DEAD))
+	if (sock_flag(meta_sk, SOCK_DEAD) || !tcp_sk(meta_sk)->mpc ||
+	    mpcb->infinite_mapping)
 		goto exit;
 
-	/* The following is meant to run with bh disabled */
-	local_bh_disable();
-
-	/* First, we iterate over the interfaces to find addresses not yet
-	 * in our local list.
+	/* The following is meant to run with bh disabled - spin_lock_bh
+	 * takes care of it.
 	 */
+	spin_lock_bh(&ns->lock);
 
-	rcu_read_lock();
-	read_lock_bh(&dev_base_lock);
-
-	for_each_netdev(netns, dev) {
-		struct in_device *in_dev = __in_dev_get_rcu(dev);
-		struct in_ifaddr *ifa;
+	mptcp_v4_update_loc_addrs(mpcb, &ns->addrs);
 #if IS_ENABLED(CONFIG_IPV6)
-		struct inet6_dev *in6_dev = __in6_dev_get(dev);
-		struct inet6_ifaddr *ifa6;
+	mptcp_v6_update_loc_addrs(mpcb, &ns->addrs);
 #endif
 
-		if (dev->flags & (IFF_LOOPBACK | IFF_NOMULTIPATH))
-			continue;
-
-		if (!in_dev)
-			goto cont_ipv6;
+	mpcb->addr_gen = ns->addrs.generation;
+	spin_unlock_bh(&ns->lock);
+exit:
+	release_sock(meta_sk);
+	sock_put(meta_sk);
+}
 
-		for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next) {
-			unsigned long event;
+/* A single pass over the connections of the netns, queueing the
+ * address-worker of those that are not in sync with the table. No lock
+ * is taken on the meta-sockets.
+ *
+ * The token-table may be huge, thus BHs are only disabled while walking a
+ * single bucket. If the table got resized in between, the walk starts over
+ * - queueing a connection twice is harmless.
+ */
+static void mptcp_pm_ns_address_worker(struct work_struct *work)
+{
+	struct mptcp_pm_ns *ns = container_of(work, struct mptcp_pm_ns,
+					      address_work.work);
+	struct mptcp_tk_table *tbl, *prev = NULL;
+	struct tcp_sock *meta_tp;
+	unsigned int i;
+	u32 gen;
 
-			if (!netif_running(in_dev->dev)) {
-				event = NETDEV_DOWN;
-			} else {
-				/* If it's up, it may have been changed or came up.
-				 * We set NETDEV_CHANGE, to take the good
-				 * code-path in mptcp_pm_addr4_event_handler
-				 */
-				event = NETDEV_CHANGE;
-			}
+	/* With ndiffports, we only use the initial address */
+	if (sysctl_mptcp_ndiffports > 1)
+		return;
 
-			mptcp_pm_addr4_event_handler(ifa, event, mpcb);
-		}
-cont_ipv6:
-; /* This ; is necessary to fix build-errors when IPv6 is disabled */
-#if IS_ENABLED(CONFIG_IPV6)
-		if (!in6_dev)
-			continue;
+	gen = ACCESS_ONCE(ns->addrs.generation);
 
-		list_for_each_entry(ifa6, &in6_dev->addr_list, if_list) {
-			unsigned long event;
-
-			if (!netif_running(in_dev->dev)) {
-				event = NETDEV_DOWN;
-			} else {
-				/* If it's up, it may have been changed or came up.
-				 * We set NETDEV_CHANGE, to take the good
-				 * code-path in mptcp_pm_addr4_event_handler
-				 */
-				event = NETDEV_CHANGE;
-			}
+	for (i = 0; ; i++) {
+		struct hlist_nulls_node *node;
 
-			mptcp_pm_addr6_event_handler(ifa6, event, mpcb);
+		rcu_read_lock_bh();
+		tbl = mptcp_tk_table_get();
+		if (tbl != prev) {
+			if (prev)
+				i = 0;
+			prev = tbl;
 		}
-#endif
-	}
-
-	/* Second, we iterate over our local addresses and check if they
-	 * still exist in the interface-list.
-	 */
-
-	/* MPCB-Local IPv4 Addresses */
-	mptcp_for_each_bit_set(mpcb->loc4_bits, i) {
-		int j;
-
-		for_each_netdev(netns, dev) {
-			struct in_device *in_dev = __in_dev_get_rcu(dev);
-			struct in_ifaddr *ifa;
-
-			if (dev->flags & (IFF_LOOPBACK | IFF_NOMULTIPATH) ||
-			    !in_dev)
-				continue;
-
-			for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next) {
-				if (ifa->ifa_address == mpcb->addr4[i].addr.s_addr &&
-				    netif_running(dev))
-					goto next_loc_addr;
-			}
+		if (i > tbl->mask) {
+			rcu_read_unlock_bh();
+			break;
 		}
 
-		/* We did not find the address or the interface became NOMULTIPATH.
-		 * We thus have to remove it.
-		 */
+		mptcp_tk_for_each_entry_rcu(meta_tp, node, &tbl->buckets[i].meta,
+					    tk_table, tbl->idx) {
+			struct sock *meta_sk = (struct sock *)meta_tp;
+			struct mptcp_pm_work *pm_work;
+			struct mptcp_cb *mpcb;
 
-		/* Look for the socket and remove him */
-		mptcp_for_each_sk_safe(mpcb, sk, tmpsk) {
-			if (sk->sk_family != AF_INET ||
-			    inet_sk(sk)->inet_saddr != mpcb->addr4[i].addr.s_addr)
+			/* The meta-sk may be freed and reused meanwhile - see
+			 * mptcp_hash_find(). Its mpcb is only safe to access
+			 * once we hold a reference and the meta-sk is still
+			 * in the token-table. The worker checks its state.
+			 */
+			if (unlikely(!atomic_inc_not_zero(&meta_sk->sk_refcnt)))
 				continue;
-
-			mptcp_reinject_data(sk, 0);
-			mptcp_sub_force_close(sk);
-		}
-
-		/* Now, remove the address from the local ones */
-		mpcb->loc4_bits &= ~(1 << i);
-
-		mpcb->remove_addrs |= (1 << mpcb->addr4[i].id);
-		sk = mptcp_select_ack_sock(meta_sk, 0);
-		if (sk)
-			tcp_send_ack(sk);
-
-		mptcp_for_each_bit_set(mpcb->rx_opt.rem4_bits, j)
-			mpcb->rx_opt.addr4[j].bitfield &= mpcb->loc4_bits;
-
-next_loc_addr:
-		continue; /* necessary here due to the previous label */
-	}
-
-#if IS_ENABLED(CONFIG_IPV6)
-	/* MPCB-Local IPv6 Addresses */
-	mptcp_for_each_bit_set(mpcb->loc6_bits, i) {
-		int j;
-
-		for_each_netdev(netns, dev) {
-			struct inet6_dev *in6_dev = __in6_dev_get(dev);
-			struct inet6_ifaddr *ifa6;
-
-			if (dev->flags & (IFF_LOOPBACK | IFF_NOMULTIPATH) ||
-			    !in6_dev)
+			if (unlikely(!meta_tp->inside_tk_table ||
+				     !is_meta_sk(meta_sk) ||
+				     !net_eq(sock_net(meta_sk), ns->net))) {
+				sock_put(meta_sk);
 				continue;
-
-
-			list_for_each_entry(ifa6, &in6_dev->addr_list, if_list) {
-				if (ipv6_addr_equal(&mpcb->addr6[i].addr, &ifa6->addr) &&
-				    netif_running(dev))
-					goto next_loc6_addr;
 			}
-		}
-
-		/* We did not find the address or the interface became NOMULTIPATH.
-		 * We thus have to remove it.
-		 */
 
-		/* Look for the socket and remove him */
-		mptcp_for_each_sk_safe(mpcb, sk, tmpsk) {
-			if (sk->sk_family != AF_INET6 ||
-			    !ipv6_addr_equal(&inet6_sk(sk)->saddr, &mpcb->addr6[i].addr))
+			mpcb = meta_tp->mpcb;
+			if (mpcb->infinite_mapping || mpcb->addr_gen == gen) {
+				sock_put(meta_sk);
 				continue;
+			}
 
-			mptcp_reinject_data(sk, 0);
-			mptcp_sub_force_close(sk);
+			pm_work = mptcp_pm_work_get(mpcb);
+			/* If the allocation fails, the connection stays out of
+			 * sync and is retried on the next event.
+			 */
+			if (!pm_work ||
+			    !queue_work(mptcp_wq, &pm_work->address_work))
+				sock_put(meta_sk);
 		}
+		rcu_read_unlock_bh();
 
-		/* Now, remove the address from the local ones */
-		mpcb->loc6_bits &= ~(1 << i);
-
-		/* Force sending directly the REMOVE_ADDR option */
-		mpcb->remove_addrs |= (1 << mpcb->addr6[i].id);
-		sk = mptcp_select_ack_sock(meta_sk, 0);
-		if (sk)
-			tcp_send_ack(sk);
-
-		mptcp_for_each_bit_set(mpcb->rx_opt.rem6_bits, j)
-			mpcb->rx_opt.addr6[j].bitfield &= mpcb->loc6_bits;
-
-next_loc6_addr:
-		continue; /* necessary here due to the previous label */
-	}
-#endif
-
-	read_unlock_bh(&dev_base_lock);
-	rcu_read_unlock();
-
-	local_bh_enable();
-exit:
-	release_sock(meta_sk);
-	sock_put(meta_sk);
-}
-
-static void mptcp_address_create_worker(struct mptcp_cb *mpcb)
-{
-	if (!work_pending(&mpcb->address_work)) {
-		sock_hold(mpcb->meta_sk);
-		queue_work(mptcp_wq, &mpcb->address_work);
+		cond_resched();
 	}
 }
 
@@ -908,56 +1421,89 @@ static void mptcp_address_create_worker(struct mptcp_cb *mpcb)
  */
 int mptcp_pm_addr_event_handler(unsigned long event, void *ptr, int family)
 {
-	struct tcp_sock *meta_tp;
-	int i;
-
 	if (!(event == NETDEV_UP || event == NETDEV_DOWN ||
 	      event == NETDEV_CHANGE))
 		return NOTIFY_DONE;
 
-	if (sysctl_mptcp_ndiffports > 1)
-		return NOTIFY_DONE;
+	if (family == AF_INET)
+		mptcp_pm_addr4_event_handler((struct in_ifaddr *)ptr, event);
+#if IS_ENABLED(CONFIG_IPV6)
+	else
+		mptcp_pm_addr6_event_handler((struct inet6_ifaddr *)ptr, event);
+#endif
 
-	/* Now we iterate over the mpcb's */
-	for (i = 0; i < MPTCP_HASH_SIZE; i++) {
-		struct hlist_nulls_node *node;
-		rcu_read_lock_bh();
-		hlist_nulls_for_each_entry_rcu(meta_tp, node, &tk_hashtable[i], tk_table) {
-			struct mptcp_cb *mpcb = meta_tp->mpcb;
-			struct sock *meta_sk = (struct sock *)meta_tp;
+	return NOTIFY_DONE;
+}
 
-			if (!meta_tp->mpc || !is_meta_sk(meta_sk) ||
-			     mpcb->infinite_mapping)
-				continue;
+static int mptcp_pm_init_net(struct net *net)
+{
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(net);
+	struct net_device *dev;
+
+	spin_lock_init(&ns->lock);
+	INIT_DELAYED_WORK(&ns->address_work, mptcp_pm_ns_address_worker);
+	ns->net = net;
+	mptcp_peer_init_ns(ns);
+
+	/* Fill the table with the addresses that are already there */
+	rcu_read_lock();
+	read_lock_bh(&dev_base_lock);
 
-			bh_lock_sock(meta_sk);
-			if (sock_owned_by_user(meta_sk)) {
-				mptcp_address_create_worker(mpcb);
-			} else {
-				if (family == AF_INET)
-					mptcp_pm_addr4_event_handler(
-							(struct in_ifaddr *)ptr, event, mpcb);
+	for_each_netdev(net, dev) {
+		struct in_device *in_dev = __in_dev_get_rcu(dev);
+		struct in_ifaddr *ifa;
 #if IS_ENABLED(CONFIG_IPV6)
-				else
-					mptcp_pm_addr6_event_handler(
-							(struct inet6_ifaddr *)ptr, event, mpcb);
+		struct inet6_dev *in6_dev = __in6_dev_get(dev);
+		struct inet6_ifaddr *ifa6;
 #endif
-			}
 
-			bh_unlock_sock(meta_sk);
+		if (!netif_running(dev))
+			continue;
+
+		if (in_dev) {
+			for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next)
+				mptcp_pm_addr4_event_handler(ifa, NETDEV_UP);
 		}
-		rcu_read_unlock_bh();
+
+#if IS_ENABLED(CONFIG_IPV6)
+		if (!in6_dev)
+			continue;
+
+		list_for_each_entry(ifa6, &in6_dev->addr_list, if_list)
+			mptcp_pm_addr6_event_handler(ifa6, NETDEV_UP);
+#endif
 	}
-	return NOTIFY_DONE;
+
+	read_unlock_bh(&dev_base_lock);
+	rcu_read_unlock();
+
+	return 0;
 }
 
+static void mptcp_pm_exit_net(struct net *net)
+{
+	struct mptcp_pm_ns *ns = mptcp_pm_get_ns(net);
+
+	cancel_delayed_work_sync(&ns->address_work);
+	mptcp_peer_flush_ns(ns);
+}
+
+static struct pernet_operations mptcp_pm_net_ops = {
+	.init = mptcp_pm_init_net,
+	.exit = mptcp_pm_exit_net,
+	.id = &mptcp_pm_net_id,
+	.size = sizeof(struct mptcp_pm_ns),
+};
+
 #ifdef CONFIG_PROC_FS
 
 /* Output /proc/net/mptcp */
 static int mptcp_pm_seq_show(struct seq_file *seq, void *v)
 {
+	struct mptcp_tk_table *tbl;
 	struct tcp_sock *meta_tp;
-	int i, n = 0;
+	unsigned int i;
+	int n = 0;
 
 	seq_printf(seq, "  sl  loc_tok  rem_tok  v6 "
 		   "local_address                         "
@@ -965,10 +1511,12 @@ static int mptcp_pm_seq_show(struct seq_file *seq, void *v)
 		   "st ns tx_queue rx_queue");
 	seq_putc(seq, '\n');
 
-	for (i = 0; i < MPTCP_HASH_SIZE; i++) {
+	rcu_read_lock_bh();
+	tbl = mptcp_tk_table_get();
+	for (i = 0; i <= tbl->mask; i++) {
 		struct hlist_nulls_node *node;
-		rcu_read_lock_bh();
-		hlist_nulls_for_each_entry_rcu(meta_tp, node, &tk_hashtable[i], tk_table) {
+		mptcp_tk_for_each_entry_rcu(meta_tp, node, &tbl->buckets[i].meta,
+					    tk_table, tbl->idx) {
 			struct mptcp_cb *mpcb = meta_tp->mpcb;
 			struct sock *meta_sk = (struct sock *)meta_tp;
 			struct inet_sock *isk = inet_sk(meta_sk);
@@ -1010,8 +1558,8 @@ static int mptcp_pm_seq_show(struct seq_file *seq, void *v)
 						   meta_tp->copied_seq, 0));
 			seq_putc(seq, '\n');
 		}
-		rcu_read_unlock_bh();
 	}
+	rcu_read_unlock_bh();
 
 	return 0;
 }
@@ -1051,22 +1599,52 @@ static struct pernet_operations mptcp_pm_proc_ops = {
 /* General initialization of MPTCP_PM */
 int mptcp_pm_init(void)
 {
+	struct mptcp_tk_table *tbl;
+	unsigned long size;
 	int i, ret;
+
+	/* At most one bucket per 16KB of memory, like the ehash. We start
+	 * with a sixteenth of it, unless mptcp_thash_entries has been given.
+	 */
+	size = (totalram_pages * (PAGE_SIZE >> 10)) >> 4;
+	size = clamp_t(unsigned long, size, MPTCP_TK_MIN_SIZE,
+		       MPTCP_TK_MAX_SIZE);
+	mptcp_tk_max_size = rounddown_pow_of_two(size);
+
+	if (mptcp_thash_entries)
+		size = clamp_t(unsigned long, mptcp_thash_entries,
+			       MPTCP_TK_MIN_SIZE, mptcp_tk_max_size);
+	else
+		size = max_t(unsigned long, mptcp_tk_max_size >> 4,
+			     MPTCP_TK_MIN_SIZE);
+
+	tbl = mptcp_tk_alloc(roundup_pow_of_two(size), 0);
+	if (!tbl)
+		return -ENOMEM;
+	rcu_assign_pointer(mptcp_tk_tbl, tbl);
+	pr_info("MPTCP: token hash table entries: %u (max %u)\n",
+		tbl->mask + 1, mptcp_tk_max_size);
+
+	ret = percpu_counter_init(&mptcp_tk_count, 0);
+	if (ret)
+		goto percpu_counter_failed;
+
 	for (i = 0; i < MPTCP_HASH_SIZE; i++) {
-		INIT_HLIST_NULLS_HEAD(&tk_hashtable[i], i);
-		INIT_LIST_HEAD(&mptcp_reqsk_htb[i]);
-		INIT_HLIST_NULLS_HEAD(&mptcp_reqsk_tk_htb[i], i);
+		spin_lock_init(&mptcp_reqsk_htb[i].lock);
+		INIT_HLIST_NULLS_HEAD(&mptcp_reqsk_htb[i].head, i);
 	}
 
-	spin_lock_init(&mptcp_reqsk_hlock);
-	spin_lock_init(&mptcp_tk_hashlock);
-
 #ifdef CONFIG_SYSCTL
 	ret = register_pernet_subsys(&mptcp_pm_proc_ops);
 	if (ret)
-		goto out;
+		goto proc_ops_failed;
 #endif
 
+	/* Before the notifiers, as they update the per-netns table */
+	ret = register_pernet_subsys(&mptcp_pm_net_ops);
+	if (ret)
+		goto mptcp_pm_net_failed;
+
 #if IS_ENABLED(CONFIG_IPV6)
 	ret = mptcp_pm_v6_init();
 	if (ret)
@@ -1085,9 +1663,15 @@ mptcp_pm_v4_failed:
 
 mptcp_pm_v6_failed:
 #endif
+	unregister_pernet_subsys(&mptcp_pm_net_ops);
+mptcp_pm_net_failed:
 #ifdef CONFIG_SYSCTL
 	unregister_pernet_subsys(&mptcp_pm_proc_ops);
+proc_ops_failed:
 #endif
+	percpu_counter_destroy(&mptcp_tk_count);
+percpu_counter_failed:
+	mptcp_tk_free(tbl);
 	goto out;
 }
 
@@ -1097,7 +1681,11 @@ void mptcp_pm_undo(void)
 	mptcp_pm_v6_undo();
 #endif
 	mptcp_pm_v4_undo();
+	unregister_pernet_subsys(&mptcp_pm_net_ops);
 #ifdef CONFIG_SYSCTL
 	unregister_pernet_subsys(&mptcp_pm_proc_ops);
 #endif
+	cancel_work_sync(&mptcp_tk_resize_work);
+	percpu_counter_destroy(&mptcp_tk_count);
+	mptcp_tk_free(rcu_dereference_protected(mptcp_tk_tbl, 1));
 }
@@ -0,0 +1,159 @@
+/*
+ *	MPTCP implementation - Redundant scheduler
+ *
+ *	Sends every segment on all the available subflows. The first copy
+ *	reaching the peer is the one that counts, hiding the losses and the
+ *	delay of the slower subflows at the cost of the goodput.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+#include <net/tcp.h>
+#include <net/mptcp.h>
+
+#include <linux/module.h>
+
+/* Does @sk still have to send a copy of @skb? Not, if one of the copies
+ * has already been acked at the subflow-level.
+ */
+static int redsched_needs_copy(struct sock *sk, struct sk_buff *skb)
+{
+	return !(skb && TCP_SKB_CB(skb)->acked_pi) &&
+	       !mptcp_dont_reinject_skb(tcp_sk(sk), skb) &&
+	       mptcp_is_available(sk, skb);
+}
+
+/* Backup-subflows are not differentiated, as anyway all subflows get a copy
+ * of each segment. We start with the lowest-RTT subflow that did not yet
+ * send the segment.
+ */
+static struct sock *redsched_get_subflow(struct sock *meta_sk,
+					 struct sk_buff *skb)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct sock *sk, *bestsk = NULL;
+	u32 min_srtt = 0xffffffff;
+
+	mptcp_for_each_sk(mpcb, sk) {
+		struct tcp_sock *tp = tcp_sk(sk);
+
+		if (!redsched_needs_copy(sk, skb))
+			continue;
+
+		if (tp->srtt < min_srtt) {
+			min_srtt = tp->srtt;
+			bestsk = sk;
+		}
+	}
+
+	return bestsk;
+}
+
+/* Where the walk over the meta write-queue resumes for tp - or NULL if it
+ * reached the end.
+ */
+static struct sk_buff *redsched_resume(struct sock *meta_sk,
+				       const struct tcp_sock *tp)
+{
+	struct sk_buff *hint = tp->mptcp->sched_hint;
+
+	if (!hint)
+		return tcp_write_queue_head(meta_sk);
+	if (skb_queue_is_last(&meta_sk->sk_write_queue, hint))
+		return NULL;
+
+	return tcp_write_queue_next(meta_sk, hint);
+}
+
+/* Segments that have already been sent, but not on every available subflow
+ * are returned as meta-level retransmissions (*@reinject = -1), before
+ * moving on to the send-head.
+ *
+ * Each subflow remembers up to where it is done with the write-queue (see
+ * sched_hint), thus a segment is only looked at once per subflow.
+ */
+static struct sk_buff *redsched_next_segment(struct sock *meta_sk,
+					     int *reinject)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct sk_buff *best = NULL;
+	struct sock *sk;
+
+	/* If we are in fallback-mode, only one subflow is left anyway.
+	 * Segments in the reinject-queue have priority.
+	 */
+	if (mpcb->infinite_mapping || mpcb->send_infinite_mapping ||
+	    mpcb->cnt_subflows == 1 || !mptcp_reinject_queue_empty(mpcb))
+		return __mptcp_next_segment(meta_sk, reinject);
+
+	mptcp_for_each_sk(mpcb, sk) {
+		struct tcp_sock *tp = tcp_sk(sk);
+		struct sk_buff *skb;
+
+		if (!mptcp_is_available(sk, NULL))
+			continue;
+
+		skb = redsched_resume(meta_sk, tp);
+		if (!skb)
+			continue;
+
+		tcp_for_write_queue_from(skb, meta_sk) {
+			if (skb == tcp_send_head(meta_sk))
+				break;
+
+			/* A DATA_FIN without data does not need to be
+			 * duplicated. Neither does a segment that already
+			 * reached the peer, or has been sent on this subflow.
+			 */
+			if (!skb->len || TCP_SKB_CB(skb)->acked_pi ||
+			    mptcp_dont_reinject_skb(tp, skb)) {
+				tp->mptcp->sched_hint = skb;
+				continue;
+			}
+
+			if (mptcp_is_available(sk, skb) &&
+			    (!best || before(TCP_SKB_CB(skb)->seq,
+					     TCP_SKB_CB(best)->seq)))
+				best = skb;
+			break;
+		}
+	}
+
+	if (best) {
+		if (reinject)
+			*reinject = -1;
+		return best;
+	}
+
+	return __mptcp_next_segment(meta_sk, reinject);
+}
+
+static struct mptcp_sched_ops mptcp_sched_redundant = {
+	.get_subflow	= redsched_get_subflow,
+	.next_segment	= redsched_next_segment,
+	.flags		= MPTCP_SCHED_TRACK_ACKED,
+	.name		= "redundant",
+	.owner		= THIS_MODULE,
+};
+
+static int __init redundant_register(void)
+{
+	if (mptcp_register_scheduler(&mptcp_sched_redundant))
+		return -1;
+
+	return 0;
+}
+
+static void __exit redundant_unregister(void)
+{
+	mptcp_unregister_scheduler(&mptcp_sched_redundant);
+}
+
+module_init(redundant_register);
+module_exit(redundant_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("MPTCP REDUNDANT SCHEDULER");
+MODULE_VERSION("0.1");
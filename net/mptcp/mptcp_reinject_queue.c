@@ -0,0 +1,121 @@
+/*
+ *	MPTCP implementation - Reinject queue
+ *
+ *	Segments handed back by a subflow (see mptcp_reinject_data) wait here
+ *	to be sent on another subflow. Like the meta out-of-order queue, the
+ *	reinject queue is a queue of data-sequence intervals (see
+ *	mptcp_seq_queue.c). A failing subflow hands back its send-queue in
+ *	order, thus most segments are simply appended to an interval.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/rbtree.h>
+#include <linux/skbuff.h>
+#include <net/tcp.h>
+#include <net/mptcp.h>
+
+/* The interval holding skb */
+static struct mptcp_seq_interval *
+mptcp_reinject_lookup(const struct mptcp_cb *mpcb, const struct sk_buff *skb)
+{
+	struct mptcp_seq_interval *next;
+
+	return mptcp_seq_queue_find(&mpcb->reinject_tree, TCP_SKB_CB(skb)->seq,
+				    &next);
+}
+
+/* Queues skb for reinjection. Data that is already part of the queue is not
+ * queued twice. On failure, skb is freed.
+ */
+int mptcp_reinject_queue_add(struct mptcp_cb *mpcb, struct sk_buff *skb)
+{
+	int ret = mptcp_seq_queue_add(&mpcb->reinject_tree, skb, NULL);
+
+	return ret < 0 ? ret : 0;
+}
+
+/* The segment to be reinjected next - or NULL */
+struct sk_buff *mptcp_reinject_queue_head(const struct mptcp_cb *mpcb)
+{
+	struct rb_node *p = rb_first(&mpcb->reinject_tree);
+
+	if (!p)
+		return NULL;
+
+	return skb_peek(&mptcp_seq_entry(p)->queue);
+}
+
+/* Takes skb, the head of its interval, off the queue */
+void mptcp_reinject_queue_unlink(struct mptcp_cb *mpcb, struct sk_buff *skb)
+{
+	struct mptcp_seq_interval *it = mptcp_reinject_lookup(mpcb, skb);
+
+	__skb_unlink(skb, &it->queue);
+
+	skb = skb_peek(&it->queue);
+	if (!skb) {
+		mptcp_seq_queue_free(&mpcb->reinject_tree, it);
+		return;
+	}
+
+	/* The key only grows, thus the interval stays in place */
+	it->seq = TCP_SKB_CB(skb)->seq;
+}
+
+/* buff holds the tail of skb, just split by mptcp_reinject_fragment */
+void mptcp_reinject_queue_after(struct mptcp_cb *mpcb, struct sk_buff *skb,
+				struct sk_buff *buff)
+{
+	struct mptcp_seq_interval *it = mptcp_reinject_lookup(mpcb, skb);
+
+	__skb_queue_after(&it->queue, skb, buff);
+}
+
+/* Remove the data acknowledged by the DATA_ACK snd_una */
+void mptcp_clean_reinject_queue(struct mptcp_cb *mpcb, u32 snd_una)
+{
+	struct rb_root *root = &mpcb->reinject_tree;
+	struct rb_node *p;
+
+	while ((p = rb_first(root)) != NULL) {
+		struct mptcp_seq_interval *it = mptcp_seq_entry(p);
+		struct sk_buff *skb;
+
+		if (before(snd_una, it->end_seq)) {
+			while ((skb = skb_peek(&it->queue)) != NULL &&
+			       !before(snd_una, TCP_SKB_CB(skb)->end_seq)) {
+				__skb_unlink(skb, &it->queue);
+				__kfree_skb(skb);
+			}
+			it->seq = TCP_SKB_CB(skb)->seq;
+			return;
+		}
+
+		mptcp_seq_queue_free(root, it);
+	}
+}
+
+/* path_index gets recycled - the segments must not appear as already sent on
+ * the new subflow.
+ */
+void mptcp_reinject_queue_clear_pi(struct mptcp_cb *mpcb, u8 path_index)
+{
+	struct rb_node *p;
+
+	for (p = rb_first(&mpcb->reinject_tree); p; p = rb_next(p)) {
+		struct mptcp_seq_interval *it = mptcp_seq_entry(p);
+		struct sk_buff *skb;
+
+		skb_queue_walk(&it->queue, skb)
+			TCP_SKB_CB(skb)->path_mask &= ~mptcp_pi_to_flag(path_index);
+	}
+}
+
+void mptcp_purge_reinject_queue(struct tcp_sock *meta_tp)
+{
+	mptcp_seq_queue_purge(&meta_tp->mpcb->reinject_tree);
+}
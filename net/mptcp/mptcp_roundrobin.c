@@ -0,0 +1,114 @@
+/*
+ *	MPTCP implementation - Round-Robin scheduler
+ *
+ *	Sends the segments one after the other on all the available
+ *	subflows, independently of their RTT.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+#include <net/tcp.h>
+#include <net/mptcp.h>
+
+#include <linux/module.h>
+
+struct rrsched_priv {
+	u8	last_pi;	/* Path-index of the last selected subflow */
+};
+
+static struct rrsched_priv *rrsched_get_priv(const struct mptcp_cb *mpcb)
+{
+	return (struct rrsched_priv *)mptcp_sched_priv(mpcb);
+}
+
+/* Is the path-index @pi closer to the one after @last than @best is? */
+static int rr_is_next(u8 pi, u8 best, u8 last)
+{
+	if (!best)
+		return 1;
+
+	/* Wrap around the last selected path-index */
+	if ((pi > last) != (best > last))
+		return pi > last;
+
+	return pi < best;
+}
+
+static struct sock *rr_get_subflow(struct sock *meta_sk, struct sk_buff *skb)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct rrsched_priv *rsp = rrsched_get_priv(mpcb);
+	struct sock *sk, *bestsk = NULL;
+	struct tcp_sock *tp_it;
+	int cnt_backups = 0;
+	u8 best_pi = 0;
+
+	/* if there is only one subflow, bypass the scheduling function */
+	if (mpcb->cnt_subflows == 1) {
+		bestsk = (struct sock *)mpcb->connection_list;
+		if (!mptcp_is_available(bestsk, skb))
+			bestsk = NULL;
+		return bestsk;
+	}
+
+	mptcp_for_each_tp(mpcb, tp_it) {
+		if (mptcp_is_backup(tp_it))
+			cnt_backups++;
+	}
+
+	mptcp_for_each_sk(mpcb, sk) {
+		struct tcp_sock *tp = tcp_sk(sk);
+
+		/* Backup-subflows are only used if there is nothing else */
+		if (mptcp_is_backup(tp) && cnt_backups != mpcb->cnt_subflows)
+			continue;
+
+		if (mptcp_dont_reinject_skb(tp, skb))
+			continue;
+
+		if (!mptcp_is_available(sk, skb))
+			continue;
+
+		if (rr_is_next(tp->mptcp->path_index, best_pi, rsp->last_pi)) {
+			best_pi = tp->mptcp->path_index;
+			bestsk = sk;
+		}
+	}
+
+	/* Only the real send-path moves forward in the round */
+	if (bestsk && skb)
+		rsp->last_pi = best_pi;
+
+	return bestsk;
+}
+
+static struct mptcp_sched_ops mptcp_sched_rr = {
+	.get_subflow	= rr_get_subflow,
+	.next_segment	= __mptcp_next_segment,
+	.name		= "roundrobin",
+	.owner		= THIS_MODULE,
+};
+
+static int __init rr_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct rrsched_priv) > MPTCP_SCHED_SIZE);
+
+	if (mptcp_register_scheduler(&mptcp_sched_rr))
+		return -1;
+
+	return 0;
+}
+
+static void __exit rr_unregister(void)
+{
+	mptcp_unregister_scheduler(&mptcp_sched_rr);
+}
+
+module_init(rr_register);
+module_exit(rr_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("MPTCP ROUND-ROBIN SCHEDULER");
+MODULE_VERSION("0.1");
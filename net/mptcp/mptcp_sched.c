@@ -0,0 +1,374 @@
+/*
+ *	MPTCP implementation - Pluggable packet scheduler and the default
+ *	(lowest-RTT first) scheduler.
+ *
+ *	Based on the pluggable TCP congestion control (net/ipv4/tcp_cong.c).
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include <net/mptcp.h>
+
+static DEFINE_SPINLOCK(mptcp_sched_list_lock);
+static LIST_HEAD(mptcp_sched_list);
+
+/* If the sub-socket sk available to send the skb? */
+int mptcp_is_available(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	/* Set of states for which we are allowed to send data */
+	if (!mptcp_sk_can_send(sk))
+		return 0;
+
+	/* We do not send data on this subflow unless it is
+	 * fully established, i.e. the 4th ack has been received.
+	 */
+	if (tp->mptcp->pre_established)
+		return 0;
+
+	if (tp->pf || (tp->mpcb->noneligible & mptcp_pi_to_flag(tp->mptcp->path_index)) ||
+	    inet_csk(sk)->icsk_ca_state == TCP_CA_Loss)
+		return 0;
+
+	/* Don't send on this subflow if we bypass the allowed send-window at
+	 * the per-subflow level. Similar to tcp_snd_wnd_test, but manually
+	 * calculated end_seq (because here at this point end_seq is still at
+	 * the meta-level).
+	 *
+	 * The skb may be bigger than an MSS. It will be split in
+	 * mptcp_write_xmit, thus we only need room for the first segment.
+	 */
+	if (skb && after(tp->write_seq + min(skb->len, tp->mss_cache),
+			 tcp_wnd_end(tp)))
+		return 0;
+
+	return tcp_cwnd_test(tp, skb);
+}
+EXPORT_SYMBOL_GPL(mptcp_is_available);
+
+/**
+ * This is the default scheduler. This function decides on which flow to send
+ * a given MSS. If all subflows are found to be busy, NULL is returned
+ * The flow is selected based on the shortest RTT.
+ * If all paths have full cong windows, we simply return NULL.
+ *
+ * Additionally, this function is aware of the backup-subflows.
+ */
+static struct sock *get_available_subflow(struct sock *meta_sk,
+					  struct sk_buff *skb)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct sock *sk, *bestsk = NULL, *lowpriosk = NULL, *backupsk = NULL;
+	u32 min_time_to_peer = 0xffffffff, lowprio_min_time_to_peer = 0xffffffff;
+	int cnt_backups = 0;
+
+	/* if there is only one subflow, bypass the scheduling function */
+	if (mpcb->cnt_subflows == 1) {
+		bestsk = (struct sock *) mpcb->connection_list;
+		if (!mptcp_is_available(bestsk, skb))
+			bestsk = NULL;
+		return bestsk;
+	}
+
+	/* Answer data_fin on same subflow!!! */
+	if (meta_sk->sk_shutdown & RCV_SHUTDOWN &&
+	    skb && mptcp_is_data_fin(skb)) {
+		mptcp_for_each_sk(mpcb, sk) {
+			if (tcp_sk(sk)->mptcp->path_index == mpcb->dfin_path_index &&
+			    mptcp_is_available(sk, skb))
+				return sk;
+		}
+	}
+
+	/* First, find the best subflow */
+	mptcp_for_each_sk(mpcb, sk) {
+		struct tcp_sock *tp = tcp_sk(sk);
+		if (mptcp_is_backup(tp))
+			cnt_backups++;
+
+		if (mptcp_dont_reinject_skb(tp, skb))
+			continue;
+
+		if (!mptcp_is_available(sk, skb))
+			continue;
+
+		if (mptcp_is_backup(tp) &&
+		    tp->srtt < lowprio_min_time_to_peer &&
+		    !(skb && mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask)) {
+			lowprio_min_time_to_peer = tp->srtt;
+			lowpriosk = sk;
+		} else if (!mptcp_is_backup(tp) &&
+		    tp->srtt < min_time_to_peer &&
+		    !(skb && mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask)) {
+			min_time_to_peer = tp->srtt;
+			bestsk = sk;
+		}
+
+		if (skb && mptcp_pi_to_flag(tp->mptcp->path_index) & TCP_SKB_CB(skb)->path_mask)
+			backupsk = sk;
+	}
+
+	if (mpcb->cnt_subflows == cnt_backups && lowpriosk)
+		return lowpriosk;
+	if (bestsk)
+		return bestsk;
+	return backupsk;
+}
+
+/**
+ * Returns the next segment to be sent from the mptcp meta-queue.
+ * (chooses the reinject queue if any segment is waiting in it, otherwise,
+ * chooses the normal write queue).
+ * Sets *@reinject to 1 if the returned segment comes from the
+ * reinject queue. Sets it to 0 if it is the regular send-head of the meta-sk,
+ * and sets it to -1 if it is a meta-level retransmission to optimize the
+ * receive-buffer.
+ */
+struct sk_buff *__mptcp_next_segment(struct sock *meta_sk, int *reinject)
+{
+	struct mptcp_cb *mpcb = tcp_sk(meta_sk)->mpcb;
+	struct sk_buff *skb = NULL;
+	if (reinject)
+		*reinject = 0;
+
+	/* If we are in fallback-mode, just take from the meta-send-queue */
+	if (mpcb->infinite_mapping || mpcb->send_infinite_mapping)
+		return tcp_send_head(meta_sk);
+
+	skb = mptcp_reinject_queue_head(mpcb);
+
+	if (skb) {
+		if (reinject)
+			*reinject = 1;
+	} else {
+		skb = tcp_send_head(meta_sk);
+
+		if (!skb && meta_sk->sk_write_pending &&
+		    sk_stream_wspace(meta_sk) < sk_stream_min_wspace(meta_sk)) {
+			struct sock *subsk = mpcb->sched_ops->get_subflow(meta_sk, NULL);
+			if (!subsk)
+				return NULL;
+
+			skb = mptcp_rcv_buf_optimization(subsk, 0);
+			if (skb && reinject)
+				*reinject = -1;
+		}
+	}
+	return skb;
+}
+EXPORT_SYMBOL_GPL(__mptcp_next_segment);
+
+static struct mptcp_sched_ops mptcp_sched_default = {
+	.get_subflow	= get_available_subflow,
+	.next_segment	= __mptcp_next_segment,
+	.flags		= MPTCP_SCHED_BATCH,
+	.name		= "default",
+	.owner		= THIS_MODULE,
+};
+
+/* Simple linear search, don't expect many entries! */
+static struct mptcp_sched_ops *mptcp_sched_find(const char *name)
+{
+	struct mptcp_sched_ops *e;
+
+	list_for_each_entry_rcu(e, &mptcp_sched_list, list) {
+		if (strcmp(e->name, name) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+/*
+ * Attach new scheduler to the list of available options.
+ */
+int mptcp_register_scheduler(struct mptcp_sched_ops *sched)
+{
+	int ret = 0;
+
+	if (!sched->get_subflow || !sched->next_segment) {
+		printk(KERN_ERR "MPTCP %s does not implement required ops\n",
+		       sched->name);
+		return -EINVAL;
+	}
+
+	spin_lock(&mptcp_sched_list_lock);
+	if (mptcp_sched_find(sched->name)) {
+		printk(KERN_NOTICE "MPTCP %s already registered\n", sched->name);
+		ret = -EEXIST;
+	} else {
+		list_add_tail_rcu(&sched->list, &mptcp_sched_list);
+		printk(KERN_INFO "MPTCP %s registered\n", sched->name);
+	}
+	spin_unlock(&mptcp_sched_list_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mptcp_register_scheduler);
+
+/*
+ * Remove scheduler, called from the module's remove function. Module ref
+ * counts are used to ensure that this can't be done till all connections
+ * using that scheduler are closed.
+ */
+void mptcp_unregister_scheduler(struct mptcp_sched_ops *sched)
+{
+	spin_lock(&mptcp_sched_list_lock);
+	list_del_rcu(&sched->list);
+	spin_unlock(&mptcp_sched_list_lock);
+}
+EXPORT_SYMBOL_GPL(mptcp_unregister_scheduler);
+
+static void mptcp_assign_scheduler(struct mptcp_cb *mpcb,
+				   struct mptcp_sched_ops *sched)
+{
+	mpcb->sched_ops = sched;
+	memset(mpcb->mptcp_sched, 0, sizeof(mpcb->mptcp_sched));
+	strlcpy(tcp_sk(mpcb->meta_sk)->mptcp_sched_name, sched->name,
+		MPTCP_SCHED_NAME_MAX);
+
+	if (sched->init)
+		sched->init(mpcb->meta_sk);
+}
+
+/* Assign the scheduler chosen through the socket-option, or the default. */
+void mptcp_init_scheduler(struct mptcp_cb *mpcb)
+{
+	struct tcp_sock *meta_tp = tcp_sk(mpcb->meta_sk);
+	struct mptcp_sched_ops *sched;
+
+	rcu_read_lock();
+	if (meta_tp->mptcp_sched_name[0] != '\0') {
+		sched = mptcp_sched_find(meta_tp->mptcp_sched_name);
+		if (sched && try_module_get(sched->owner))
+			goto out;
+	}
+
+	list_for_each_entry_rcu(sched, &mptcp_sched_list, list) {
+		if (try_module_get(sched->owner))
+			goto out;
+
+		/* fallback to next available */
+	}
+
+	/* The default scheduler is built-in, we cannot get here */
+	BUG();
+out:
+	rcu_read_unlock();
+
+	mptcp_assign_scheduler(mpcb, sched);
+}
+
+/* Manage refcounts when the connection gets destroyed. */
+void mptcp_cleanup_scheduler(struct mptcp_cb *mpcb)
+{
+	module_put(mpcb->sched_ops->owner);
+}
+
+/* Change scheduler for socket */
+int mptcp_set_scheduler(struct sock *sk, const char *name)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_sched_ops *sched;
+	int err = 0;
+
+	rcu_read_lock();
+	sched = mptcp_sched_find(name);
+
+#ifdef CONFIG_MODULES
+	/* not found attempt to autoload module */
+	if (!sched && capable(CAP_NET_ADMIN)) {
+		rcu_read_unlock();
+		request_module("mptcp_%s", name);
+		rcu_read_lock();
+		sched = mptcp_sched_find(name);
+	}
+#endif
+	if (!sched) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	/* The connection is already up, switch the scheduler right away.
+	 * Otherwise, the name is picked up by mptcp_init_scheduler.
+	 */
+	if (tp->mpc && is_meta_sk(sk) && sched != tp->mpcb->sched_ops) {
+		if (!try_module_get(sched->owner)) {
+			err = -EBUSY;
+			goto out;
+		}
+		mptcp_cleanup_scheduler(tp->mpcb);
+		mptcp_assign_scheduler(tp->mpcb, sched);
+	} else {
+		strlcpy(tp->mptcp_sched_name, sched->name, MPTCP_SCHED_NAME_MAX);
+	}
+out:
+	rcu_read_unlock();
+	return err;
+}
+
+/* Used by sysctl to change default scheduler */
+int mptcp_set_default_scheduler(const char *name)
+{
+	struct mptcp_sched_ops *sched;
+	int ret = -ENOENT;
+
+	spin_lock(&mptcp_sched_list_lock);
+	sched = mptcp_sched_find(name);
+#ifdef CONFIG_MODULES
+	if (!sched && capable(CAP_NET_ADMIN)) {
+		spin_unlock(&mptcp_sched_list_lock);
+
+		request_module("mptcp_%s", name);
+		spin_lock(&mptcp_sched_list_lock);
+		sched = mptcp_sched_find(name);
+	}
+#endif
+
+	if (sched) {
+		list_move(&sched->list, &mptcp_sched_list);
+		ret = 0;
+	} else {
+		printk(KERN_INFO "MPTCP scheduler %s not available\n", name);
+	}
+	spin_unlock(&mptcp_sched_list_lock);
+
+	return ret;
+}
+
+/* Get current default scheduler */
+void mptcp_get_default_scheduler(char *name)
+{
+	struct mptcp_sched_ops *sched;
+
+	BUG_ON(list_empty(&mptcp_sched_list));
+
+	rcu_read_lock();
+	sched = list_entry(mptcp_sched_list.next, struct mptcp_sched_ops, list);
+	strncpy(name, sched->name, MPTCP_SCHED_NAME_MAX);
+	rcu_read_unlock();
+}
+
+/* Register the default scheduler and set the default value from the kernel
+ * configuration at bootup.
+ */
+static int __init mptcp_scheduler_default(void)
+{
+	int ret = mptcp_register_scheduler(&mptcp_sched_default);
+
+	if (ret)
+		return ret;
+
+	return mptcp_set_default_scheduler(CONFIG_DEFAULT_MPTCP_SCHED);
+}
+late_initcall(mptcp_scheduler_default);
@@ -0,0 +1,185 @@
+/*
+ *	MPTCP implementation - Queues of data-sequence intervals
+ *
+ *	The meta out-of-order queue and the reinject queue both hold segments
+ *	sorted by their data-sequence number. They are rbtrees of intervals,
+ *	each interval holding a list of skbs covering contiguous data. As
+ *	most segments extend the data at the end of an interval, they are
+ *	simply appended to its list.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/rbtree.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <net/tcp.h>
+#include <net/mptcp.h>
+
+static struct kmem_cache *mptcp_seq_cache __read_mostly;
+
+void mptcp_seq_queue_free(struct rb_root *root, struct mptcp_seq_interval *it)
+{
+	rb_erase(&it->node, root);
+	__skb_queue_purge(&it->queue);
+	kmem_cache_free(mptcp_seq_cache, it);
+}
+
+/* Returns the last interval starting at or before seq - or NULL. In *next,
+ * the one after.
+ */
+struct mptcp_seq_interval *mptcp_seq_queue_find(const struct rb_root *root,
+						u32 seq,
+						struct mptcp_seq_interval **next)
+{
+	struct rb_node *p = root->rb_node;
+	struct mptcp_seq_interval *prev = NULL;
+
+	*next = NULL;
+	while (p) {
+		struct mptcp_seq_interval *it = mptcp_seq_entry(p);
+
+		if (after(it->seq, seq)) {
+			*next = it;
+			p = p->rb_left;
+		} else {
+			prev = it;
+			p = p->rb_right;
+		}
+	}
+
+	return prev;
+}
+
+/* The data of it has grown - swallow the intervals it now reaches */
+static void mptcp_seq_queue_merge_next(struct rb_root *root,
+				       struct mptcp_seq_interval *it)
+{
+	struct rb_node *p;
+
+	while ((p = rb_next(&it->node)) != NULL) {
+		struct mptcp_seq_interval *next = mptcp_seq_entry(p);
+		struct sk_buff *skb;
+
+		if (after(next->seq, it->end_seq))
+			break;
+
+		/* Drop the segments covered as whole */
+		while ((skb = skb_peek(&next->queue)) != NULL &&
+		       !after(TCP_SKB_CB(skb)->end_seq, it->end_seq)) {
+			__skb_unlink(skb, &next->queue);
+			__kfree_skb(skb);
+		}
+
+		if (skb) {
+			skb_queue_splice_tail_init(&next->queue, &it->queue);
+			it->end_seq = next->end_seq;
+		}
+		mptcp_seq_queue_free(root, next);
+	}
+}
+
+static void mptcp_seq_queue_insert(struct rb_root *root,
+				   struct mptcp_seq_interval *new)
+{
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (before(new->seq, mptcp_seq_entry(parent)->seq))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, root);
+}
+
+/* Queues skb in root. Data that is already part of the queue is not queued
+ * twice. If meta_sk is given, skb may be coalesced into the segment in front
+ * of it (see mptcp_try_coalesce).
+ *
+ * @return:
+ *  i) 0: skb has been queued.
+ *  ii) 1: All the bits were present already, skb has been freed.
+ *  iii) -ENOBUFS: No memory for a new interval, skb has been freed.
+ */
+int mptcp_seq_queue_add(struct rb_root *root, struct sk_buff *skb,
+			struct sock *meta_sk)
+{
+	struct mptcp_seq_interval *it, *next;
+	u32 seq = TCP_SKB_CB(skb)->seq;
+	u32 end_seq = TCP_SKB_CB(skb)->end_seq;
+	struct sk_buff *skb1;
+
+	it = mptcp_seq_queue_find(root, seq, &next);
+
+	if (it && !after(seq, it->end_seq)) {
+		if (!after(end_seq, it->end_seq)) {
+			/* All the bits are present. */
+			__kfree_skb(skb);
+			return 1;
+		}
+
+		/* Append skb and clean segments covered by it as whole */
+		while ((skb1 = skb_peek_tail(&it->queue)) != NULL &&
+		       !before(TCP_SKB_CB(skb1)->seq, seq)) {
+			__skb_unlink(skb1, &it->queue);
+			__kfree_skb(skb1);
+		}
+		if (skb1 && meta_sk && mptcp_try_coalesce(meta_sk, skb1, skb))
+			__kfree_skb(skb);
+		else
+			__skb_queue_tail(&it->queue, skb);
+		if (!skb1)
+			it->seq = seq;
+		it->end_seq = end_seq;
+	} else if (next && !after(next->seq, end_seq)) {
+		/* Prepend skb to the next interval */
+		while ((skb1 = skb_peek(&next->queue)) != NULL &&
+		       !after(TCP_SKB_CB(skb1)->end_seq, end_seq)) {
+			__skb_unlink(skb1, &next->queue);
+			__kfree_skb(skb1);
+		}
+		__skb_queue_head(&next->queue, skb);
+		next->seq = seq;
+		if (!skb1)
+			next->end_seq = end_seq;
+		it = next;
+	} else {
+		it = kmem_cache_alloc(mptcp_seq_cache, GFP_ATOMIC);
+		if (!it) {
+			__kfree_skb(skb);
+			return -ENOBUFS;
+		}
+		it->seq = seq;
+		it->end_seq = end_seq;
+		skb_queue_head_init(&it->queue);
+		__skb_queue_tail(&it->queue, skb);
+		mptcp_seq_queue_insert(root, it);
+		return 0;
+	}
+
+	mptcp_seq_queue_merge_next(root, it);
+	return 0;
+}
+
+void mptcp_seq_queue_purge(struct rb_root *root)
+{
+	struct rb_node *p;
+
+	while ((p = rb_first(root)) != NULL)
+		mptcp_seq_queue_free(root, mptcp_seq_entry(p));
+}
+
+void __init mptcp_seq_queue_init(void)
+{
+	mptcp_seq_cache = kmem_cache_create("mptcp_seq_interval",
+					    sizeof(struct mptcp_seq_interval),
+					    0, SLAB_HWCACHE_ALIGN|SLAB_PANIC,
+					    NULL);
+}
@@ -0,0 +1,235 @@
+/*
+ * MPTCP implementation - WEIGHTED VEGAS CONGESTION CONTROL:
+ *
+ * Algorithm design:
+ * Yu Cao, Mingwei Xu, Xiaoming Fu
+ * "Delay-based Congestion Control for Multipath TCP"
+ *
+ * Each subflow runs Vegas, but the number of packets all subflows together
+ * keep queued in the network is alpha. Subflow r gets the share
+ * x_r / sum_k(x_k) of it, x_r being its rate as tracked by the
+ * congestion-aggregate of the mpcb (see mptcp_cc_agg_update). Thus, the
+ * traffic moves away from the congested paths. If the queuing delay of a
+ * subflow grows beyond twice the smallest one seen so far, the window is
+ * scaled down by base_rtt / (2 * rtt) to drain the queue.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <net/tcp.h>
+#include <net/mptcp.h>
+
+#include <linux/module.h>
+
+static int alpha = 10;
+static int gamma = 1;
+static int scale = 10;
+
+module_param(alpha, int, 0644);
+MODULE_PARM_DESC(alpha, "packets in network, shared by all subflows");
+module_param(gamma, int, 0644);
+MODULE_PARM_DESC(gamma, "limit on increase (scale by 2)");
+
+struct mptcp_wvegas {
+	u32	beg_snd_nxt;	/* right edge during last RTT */
+	u32	base_rtt;	/* min of all RTT measurements, in usec */
+	u32	min_rtt;	/* min of RTTs measured within last RTT */
+	u32	cnt_rtt;	/* # of RTTs measured within last RTT */
+	u32	queue_delay;	/* smallest queuing delay seen, in usec */
+	u8	doing_wvegas_now;
+};
+
+static inline u64 mptcp_wvegas_scale(u64 val, int scale)
+{
+	return val << scale;
+}
+
+/* See vegas_enable in tcp_vegas.c */
+static void mptcp_wvegas_enable(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_wvegas *wvegas = inet_csk_ca(sk);
+
+	wvegas->doing_wvegas_now = 1;
+	wvegas->beg_snd_nxt = tp->snd_nxt;
+	wvegas->cnt_rtt = 0;
+	wvegas->min_rtt = 0x7fffffff;
+}
+
+static void mptcp_wvegas_init(struct sock *sk)
+{
+	struct mptcp_wvegas *wvegas = inet_csk_ca(sk);
+
+	wvegas->base_rtt = 0x7fffffff;
+	wvegas->queue_delay = 0;
+	mptcp_wvegas_enable(sk);
+}
+
+static void mptcp_wvegas_pkts_acked(struct sock *sk, u32 cnt, s32 rtt_us)
+{
+	struct mptcp_wvegas *wvegas = inet_csk_ca(sk);
+	u32 vrtt;
+
+	if (rtt_us < 0)
+		return;
+
+	/* Never allow zero rtt or base_rtt */
+	vrtt = rtt_us + 1;
+
+	if (vrtt < wvegas->base_rtt)
+		wvegas->base_rtt = vrtt;
+
+	wvegas->min_rtt = min(wvegas->min_rtt, vrtt);
+	wvegas->cnt_rtt++;
+}
+
+static void mptcp_wvegas_state(struct sock *sk, u8 ca_state)
+{
+	struct mptcp_wvegas *wvegas = inet_csk_ca(sk);
+
+	if (ca_state == TCP_CA_Open)
+		mptcp_wvegas_enable(sk);
+	else
+		wvegas->doing_wvegas_now = 0;
+}
+
+static void mptcp_wvegas_cwnd_event(struct sock *sk, enum tcp_ca_event event)
+{
+	if (event == CA_EVENT_CWND_RESTART ||
+	    event == CA_EVENT_TX_START)
+		mptcp_wvegas_init(sk);
+}
+
+/* The share of alpha of this subflow, scaled */
+static u64 mptcp_wvegas_alpha(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	const struct mptcp_cc_agg *agg = &tp->mpcb->cc_agg;
+
+	if (tp->mpcb->cnt_established <= 1)
+		return mptcp_wvegas_scale(alpha, scale);
+
+	mptcp_cc_agg_update(sk);
+	if (!tp->mptcp->cc_rate)
+		return mptcp_wvegas_scale(alpha, scale);
+
+	return div64_u64(mptcp_wvegas_scale(alpha * tp->mptcp->cc_rate, scale),
+			 agg->sum_rate);
+}
+
+static inline u32 mptcp_wvegas_ssthresh(struct tcp_sock *tp)
+{
+	return min(tp->snd_ssthresh, tp->snd_cwnd - 1);
+}
+
+static void mptcp_wvegas_cong_avoid(struct sock *sk, u32 ack, u32 in_flight)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct mptcp_wvegas *wvegas = inet_csk_ca(sk);
+	u64 target_cwnd, diff;
+	u32 rtt, q_delay;
+
+	if (!tp->mpc || !wvegas->doing_wvegas_now) {
+		tcp_reno_cong_avoid(sk, ack, in_flight);
+		return;
+	}
+
+	if (!after(ack, wvegas->beg_snd_nxt)) {
+		if (tp->snd_cwnd <= tp->snd_ssthresh)
+			tcp_slow_start(tp);
+		return;
+	}
+
+	/* Once-per-RTT adjustment, as in tcp_vegas_cong_avoid */
+	wvegas->beg_snd_nxt = tp->snd_nxt;
+
+	/* Most likely only delayed ACKs - behave like Reno */
+	if (wvegas->cnt_rtt <= 2) {
+		tcp_reno_cong_avoid(sk, ack, in_flight);
+		goto reset;
+	}
+
+	rtt = wvegas->min_rtt;
+	target_cwnd = div_u64((u64)tp->snd_cwnd * wvegas->base_rtt, rtt);
+
+	/* Packets of this subflow queued in the network, scaled */
+	diff = div_u64(mptcp_wvegas_scale(tp->snd_cwnd, scale) *
+		       (rtt - wvegas->base_rtt), rtt);
+
+	if (tp->snd_cwnd <= tp->snd_ssthresh) {
+		if (diff > mptcp_wvegas_scale(gamma, scale)) {
+			/* Going too fast - switch to congestion avoidance */
+			tp->snd_cwnd = min(tp->snd_cwnd, (u32)target_cwnd + 1);
+			tp->snd_ssthresh = mptcp_wvegas_ssthresh(tp);
+		} else {
+			tcp_slow_start(tp);
+		}
+	} else {
+		u64 alpha_r = mptcp_wvegas_alpha(sk);
+
+		if (diff > alpha_r) {
+			tp->snd_cwnd--;
+			tp->snd_ssthresh = mptcp_wvegas_ssthresh(tp);
+		} else if (diff < alpha_r) {
+			tp->snd_cwnd++;
+		}
+
+		/* Drain the queue, if it grew too much */
+		q_delay = rtt - wvegas->base_rtt;
+		if (!wvegas->queue_delay || q_delay < wvegas->queue_delay)
+			wvegas->queue_delay = q_delay;
+
+		if (wvegas->queue_delay && q_delay > 2 * wvegas->queue_delay) {
+			tp->snd_cwnd = div_u64((u64)tp->snd_cwnd *
+					       wvegas->base_rtt, 2 * rtt);
+			tp->snd_ssthresh = mptcp_wvegas_ssthresh(tp);
+			wvegas->queue_delay = 0;
+		}
+	}
+
+	if (tp->snd_cwnd < 2)
+		tp->snd_cwnd = 2;
+	else if (tp->snd_cwnd > tp->snd_cwnd_clamp)
+		tp->snd_cwnd = tp->snd_cwnd_clamp;
+
+	tp->snd_ssthresh = tcp_current_ssthresh(sk);
+
+reset:
+	/* Wipe the slate clean for the next RTT. */
+	wvegas->cnt_rtt = 0;
+	wvegas->min_rtt = 0x7fffffff;
+}
+
+static struct tcp_congestion_ops mptcp_wvegas = {
+	.flags		= TCP_CONG_RTT_STAMP,
+	.init		= mptcp_wvegas_init,
+	.ssthresh	= tcp_reno_ssthresh,
+	.cong_avoid	= mptcp_wvegas_cong_avoid,
+	.min_cwnd	= tcp_reno_min_cwnd,
+	.pkts_acked	= mptcp_wvegas_pkts_acked,
+	.set_state	= mptcp_wvegas_state,
+	.cwnd_event	= mptcp_wvegas_cwnd_event,
+	.owner		= THIS_MODULE,
+	.name		= "wvegas",
+};
+
+static int __init mptcp_wvegas_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct mptcp_wvegas) > ICSK_CA_PRIV_SIZE);
+	return tcp_register_congestion_control(&mptcp_wvegas);
+}
+
+static void __exit mptcp_wvegas_unregister(void)
+{
+	tcp_unregister_congestion_control(&mptcp_wvegas);
+}
+
+module_init(mptcp_wvegas_register);
+module_exit(mptcp_wvegas_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("MPTCP WEIGHTED VEGAS CONGESTION CONTROL");
+MODULE_VERSION("0.1");